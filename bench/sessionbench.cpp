@@ -0,0 +1,958 @@
+// End-to-end sync benchmark. The coordinator starts a private dbus-daemon,
+// spawns one driver and N-1 receiver replicas of this binary on it (offscreen,
+// each with its own journal directory), has the driver replay a workload and
+// collects what every replica saw into one JSON report. With --local the
+// replicas talk over local sockets instead of that bus; --pingpong times
+// round trips, to compare the two. --micro runs the
+// in-process benchmarks instead: the replicated model's local and remote
+// insert cost, the wire format's frame size and encode/decode time, and the
+// applier's remote insert time by document size.
+
+#include "dbushandler.h"
+#include "edit.h"
+#include "histogram.h"
+#include "opapplier.h"
+#include "replicatedtext.h"
+#include "wireformat.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSocketNotifier>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QUuid>
+#include <limits>
+#include <random>
+#include <unistd.h>
+
+namespace
+{
+const char *const sessionName = "bench";
+const int startTimeout	      = 30000;
+const int quietPeriod	      = 1000;
+// Milliseconds between the ticks that measure how long the GUI thread stalls.
+const int heartbeat = 1;
+// How long the driver waits for an answer with --pingpong before going on.
+const int pingTimeout = 1000;
+
+//----------workloads-----------------
+struct Step {
+    enum Kind { Type, Paste, Erase, Bold, Color, Wait };
+
+    int kind = Type;
+    QString text;
+    int pos    = -1;
+    int length = 0;
+    int delay  = 0;
+};
+
+QString randomText( std::mt19937 &random, int length )
+{
+    static const QString alphabet = "etaoinshrdlucmfwypvbgkqjxz      ";
+    QString text;
+    text.reserve( length );
+    for ( int i = 0; i < length; ++i )
+        text += alphabet.at( int( random() % alphabet.size() ) );
+    return text;
+}
+
+QVector<Step> typingWorkload( int keys, int interval )
+{
+    std::mt19937 random( 1 );
+    QVector<Step> steps;
+    for ( int i = 0; i < keys; ++i ) {
+        Step step;
+        step.kind  = Step::Type;
+        step.text  = randomText( random, 1 );
+        step.delay = interval;
+        steps.append( step );
+    }
+    return steps;
+}
+
+QVector<Step> pasteWorkload( int pastes, int size, int interval )
+{
+    std::mt19937 random( 2 );
+    QVector<Step> steps;
+    for ( int i = 0; i < pastes; ++i ) {
+        Step step;
+        step.kind  = Step::Paste;
+        step.text  = randomText( random, size );
+        step.pos   = -2;
+        step.delay = interval;
+        steps.append( step );
+    }
+    return steps;
+}
+
+// One large paste, which goes out streamed in chunks, then typing that has
+// to wait for it.
+QVector<Step> streamWorkload( int keys, int size, int interval )
+{
+    std::mt19937 random( 8 );
+    Step paste;
+    paste.kind	= Step::Paste;
+    paste.text	= randomText( random, size );
+    paste.delay = interval;
+    return QVector<Step>() << paste << typingWorkload( keys, interval );
+}
+
+// Types a paragraph, then restyles random words of it.
+QVector<Step> formatWorkload( int changes, int interval )
+{
+    std::mt19937 random( 3 );
+    QVector<Step> steps;
+    Step setup;
+    setup.kind	= Step::Paste;
+    setup.text	= randomText( random, 4096 );
+    setup.delay = 200;
+    steps.append( setup );
+
+    for ( int i = 0; i < changes; ++i ) {
+        Step step;
+        step.kind   = i % 2 ? Step::Color : Step::Bold;
+        step.pos    = int( random() % 4000 );
+        step.length = 1 + int( random() % 32 );
+        step.text   = QColor::fromRgb( random() & 0xffffff ).name();
+        step.delay  = interval;
+        steps.append( step );
+    }
+    return steps;
+}
+
+// One step per line: "type <text>", "paste <chars>", "erase <chars>",
+// "bold <pos> <length>", "color <pos> <length> <#rrggbb>" or "wait <ms>".
+bool traceWorkload( const QString &path, int interval, QVector<Step> &steps )
+{
+    QFile file( path );
+    if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+        return false;
+
+    std::mt19937 random( 4 );
+    QTextStream in( &file );
+    while ( !in.atEnd() ) {
+        const QString line = in.readLine();
+        const QStringList words = line.split( ' ', QString::SkipEmptyParts );
+        if ( words.isEmpty() || words.first().startsWith( '#' ) )
+            continue;
+
+        Step step;
+        step.delay	   = interval;
+        const QString &verb = words.first();
+        if ( verb == "type" ) {
+            step.text = line.mid( line.indexOf( "type" ) + 5 );
+        } else if ( verb == "paste" && words.size() > 1 ) {
+            step.kind = Step::Paste;
+            step.text = randomText( random, words.at( 1 ).toInt() );
+        } else if ( verb == "erase" && words.size() > 1 ) {
+            step.kind	= Step::Erase;
+            step.length = words.at( 1 ).toInt();
+        } else if ( ( verb == "bold" || verb == "color" ) && words.size() > 2 ) {
+            step.kind	= verb == "bold" ? Step::Bold : Step::Color;
+            step.pos	= words.at( 1 ).toInt();
+            step.length = words.at( 2 ).toInt();
+            step.text	= words.value( 3, "#ff0000" );
+        } else if ( verb == "wait" && words.size() > 1 ) {
+            step.kind  = Step::Wait;
+            step.delay = words.at( 1 ).toInt();
+        } else {
+            qWarning() << "skipped trace line:" << line;
+            continue;
+        }
+        steps.append( step );
+    }
+    return true;
+}
+
+QJsonObject summary( const LatencyHistogram &histogram, double scale )
+{
+    QJsonObject out;
+    out["count"] = double( histogram.count() );
+    out["mean"]	 = histogram.mean() / scale;
+    out["p50"]	 = histogram.percentile( 50 ) / scale;
+    out["p90"]	 = histogram.percentile( 90 ) / scale;
+    out["p99"]	 = histogram.percentile( 99 ) / scale;
+    out["max"]	 = histogram.max() / scale;
+    return out;
+}
+
+void emitLine( const QJsonObject &object )
+{
+    QTextStream out( stdout );
+    out << QJsonDocument( object ).toJson( QJsonDocument::Compact ) << '\n';
+    out.flush();
+}
+
+//----------replica-----------------
+// One instance of the session. The driver replays the workload when told
+// "go" on stdin; every replica prints what it applied when told "report".
+// With --pingpong a receiver answers each frame of the first peer it hears
+// from with a keystroke, and the driver times the round trip before taking
+// its next step.
+class Replica : public QObject
+{
+    Edit m_edit;
+    QScopedPointer<DBusHandler> m_handler;
+    QSocketNotifier m_stdin;
+    QVector<Step> m_steps;
+    int m_next = 0;
+
+    QJsonArray m_sent;
+    QJsonArray m_applied;
+    qint64 m_lastChange = 0;
+    // When the last streamed insert from a peer was complete.
+    qint64 m_streamDone = 0;
+
+    QTimer m_heartbeat;
+    qint64 m_lastBeat = 0;
+    LatencyHistogram m_stalls;
+
+    const bool m_pingpong;
+    bool m_driving = false;
+    QString m_answering;
+    qint64 m_pingSent = 0;
+    LatencyHistogram m_roundtrips;
+
+public:
+    Replica( const SessionOptions &options, const QVector<Step> &steps, bool pingpong )
+        : m_stdin( STDIN_FILENO, QSocketNotifier::Read ), m_steps( steps ), m_pingpong( pingpong )
+    {
+        const QString id = QUuid::createUuid().toString().remove( QRegExp( "[{}-]" ) ).left( 30 );
+        m_handler.reset( new DBusHandler( id, options, &m_edit ) );
+        m_edit.setHandler( m_handler.data() );
+
+        connect( m_handler.data(), &DBusHandler::joined, this, [this, id]() {
+            QJsonObject ready;
+            ready["event"]  = "ready";
+            ready["id"]	    = id;
+            ready["joinNs"] = metric( "histograms", "join.ns" ).value( "max" );
+            emitLine( ready );
+        } );
+        connect( m_handler.data(), &DBusHandler::frameApplied, this,
+             [this]( const QString &sender, quint32 seq, qint64 nanos ) {
+                 QJsonArray entry;
+                 entry << sender << double( seq ) << double( LatencyHistogram::now() )
+                       << double( nanos );
+                 m_applied.append( entry );
+                 if ( m_pingpong )
+                     pong( sender );
+             } );
+        connect( m_handler.data(), &DBusHandler::streamProgress, this,
+             [this]( const QString &, qint64, qint64 left ) {
+                 if ( !left )
+                     m_streamDone = LatencyHistogram::now();
+             } );
+        connect( m_edit.document(), &QTextDocument::contentsChanged, this,
+             [this]() { m_lastChange = LatencyHistogram::now(); } );
+        connect( &m_stdin, &QSocketNotifier::activated, this, &Replica::command );
+
+        // A late tick is time the event loop spent on something else.
+        m_heartbeat.setInterval( heartbeat );
+        connect( &m_heartbeat, &QTimer::timeout, this, [this]() {
+            const qint64 now = LatencyHistogram::now();
+            if ( m_lastBeat )
+                m_stalls.record( qMax<qint64>( 0, now - m_lastBeat - heartbeat * 1000000LL ) );
+            m_lastBeat = now;
+        } );
+        m_heartbeat.start();
+
+        m_handler->startJoin();
+    }
+
+private:
+    void command()
+    {
+        char line[64] = {};
+        if ( ::read( STDIN_FILENO, line, sizeof( line ) - 1 ) <= 0 ) {
+            qApp->quit();
+            return;
+        }
+        const QByteArray verb = QByteArray( line ).trimmed();
+        if ( verb == "go" ) {
+            m_driving = true;
+            nextStep();
+        }
+        else if ( verb == "report" )
+            report();
+    }
+
+    void nextStep()
+    {
+        if ( m_next >= m_steps.size() ) {
+            // Let the batcher flush what the last step produced.
+            QTimer::singleShot( 100, this, &Replica::finished );
+            return;
+        }
+        const Step &step = m_steps.at( m_next++ );
+        perform( step );
+        if ( !m_pingpong ) {
+            QTimer::singleShot( step.delay, this, &Replica::nextStep );
+            return;
+        }
+
+        m_pingSent = LatencyHistogram::now();
+        const int next = m_next;
+        QTimer::singleShot( pingTimeout, this, [this, next]() {
+            if ( m_pingSent && m_next == next ) {
+                m_pingSent = 0;
+                nextStep();
+            }
+        } );
+    }
+
+    // The answer is typed once the frame that asked for it is in the editor.
+    void pong( const QString &sender )
+    {
+        if ( m_driving ) {
+            if ( !m_pingSent )
+                return;
+            m_roundtrips.record( LatencyHistogram::now() - m_pingSent );
+            m_pingSent = 0;
+            QTimer::singleShot( m_steps.at( m_next - 1 ).delay, this, &Replica::nextStep );
+            return;
+        }
+        if ( m_answering.isEmpty() )
+            m_answering = sender;
+        if ( sender != m_answering )
+            return;
+        QTimer::singleShot( 0, this, [this]() {
+            Step answer;
+            answer.text = "y";
+            perform( answer );
+        } );
+    }
+
+    QJsonObject metric( const QString &group, const QString &name ) const
+    {
+        const QJsonValue value = m_handler->metrics().toJson().value( group ).toObject().value( name );
+        if ( value.isObject() )
+            return value.toObject();
+        QJsonObject counter;
+        counter["value"] = value;
+        return counter;
+    }
+
+    void perform( const Step &step )
+    {
+        if ( step.kind == Step::Wait )
+            return;
+
+        // Edits made through a cursor bypass the editor's own flushing.
+        m_handler->flushInbound();
+        const qint64 started = LatencyHistogram::now();
+        QTextCursor cursor( m_edit.document() );
+        const int size = m_edit.document()->characterCount() - 1;
+        switch ( step.kind ) {
+        case Step::Type:
+        case Step::Paste:
+            if ( step.pos == -2 && size > 0 )
+                cursor.setPosition( int( qHash( m_next ) % uint( size ) ) );
+            else
+                cursor.movePosition( QTextCursor::End );
+            cursor.insertText( step.text );
+            break;
+        case Step::Erase:
+            cursor.movePosition( QTextCursor::End );
+            cursor.movePosition( QTextCursor::Left, QTextCursor::KeepAnchor,
+                         qMin( step.length, size ) );
+            cursor.removeSelectedText();
+            break;
+        case Step::Bold:
+        case Step::Color: {
+            cursor.setPosition( qMin( step.pos, size ) );
+            cursor.setPosition( qMin( step.pos + step.length, size ), QTextCursor::KeepAnchor );
+            m_edit.setTextCursor( cursor );
+            QTextCharFormat format;
+            if ( step.kind == Step::Bold )
+                format.setFontWeight( m_next % 4 < 2 ? QFont::Bold : QFont::Normal );
+            else
+                format.setForeground( QColor( step.text ) );
+            m_handler->mergeFormatOnWordOrSelection( format );
+            break;
+        }
+        }
+
+        // The step goes out in the frame after the last one sent.
+        QJsonArray entry;
+        entry << step.kind << double( started ) << double( m_handler->lastSentSeq() + 1 )
+              << step.text.size();
+        m_sent.append( entry );
+    }
+
+    void finished()
+    {
+        if ( m_handler->streamLeft() ) {
+            QTimer::singleShot( 100, this, &Replica::finished );
+            return;
+        }
+        QJsonObject done;
+        done["event"]	  = "done";
+        done["steps"]	  = m_sent;
+        done["lastSeq"]	  = double( m_handler->lastSentSeq() );
+        done["bytes"]	  = double( m_handler->bytesSent() );
+        done["frames"]	  = double( m_handler->batchCounters().frames );
+        done["opsMerged"] = double( m_handler->batchCounters().opsMerged );
+        if ( m_pingpong )
+            done["roundtripUs"] = summary( m_roundtrips, 1e3 );
+        emitLine( done );
+    }
+
+    void report()
+    {
+        QJsonObject out;
+        out["event"]	  = "report";
+        out["applied"]	  = m_applied;
+        out["lastChange"] = double( m_lastChange );
+        out["streamDone"] = double( m_streamDone );
+        out["chars"]	  = m_handler->model().size();
+        out["digest"]	  = QString::number( qHash( m_edit.toHtml() ), 16 );
+        out["ordered"]	  = metric( "counters", "order.assigned" ).value( "value" );
+        out["served"]	  = metric( "histograms", "snapshot.encode.ns" );
+        out["roundtrip"]  = metric( "histograms", "order.roundtrip.ns" );
+        out["stalls"]	  = summary( m_stalls, 1e6 );
+        emitLine( out );
+        qApp->quit();
+    }
+};
+
+//----------coordinator-----------------
+class Coordinator
+{
+    QTemporaryDir m_dir;
+    QProcess m_daemon;
+    QList<QProcess *> m_replicas;
+    QString m_address;
+
+public:
+    ~Coordinator()
+    {
+        for ( QProcess *replica : m_replicas ) {
+            replica->kill();
+            replica->waitForFinished();
+            delete replica;
+        }
+        m_daemon.kill();
+        m_daemon.waitForFinished();
+    }
+
+    bool startBus()
+    {
+        m_daemon.start( "dbus-daemon",
+                QStringList() << "--session" << "--nofork" << "--print-address" );
+        if ( !m_daemon.waitForStarted() || !m_daemon.waitForReadyRead( startTimeout ) )
+            return false;
+        m_address = QString::fromUtf8( m_daemon.readLine() ).trimmed();
+        return !m_address.isEmpty();
+    }
+
+    QProcess *spawn( int index, const QStringList &args )
+    {
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        env.insert( "DBUS_SESSION_BUS_ADDRESS", m_address );
+        env.insert( "QT_QPA_PLATFORM", "offscreen" );
+        env.insert( "XDG_DATA_HOME", m_dir.path() + "/replica" + QString::number( index ) );
+        // With --local the session's sockets go here, apart from any real one.
+        env.insert( "XDG_RUNTIME_DIR", m_dir.path() );
+
+        QProcess *replica = new QProcess;
+        replica->setProcessEnvironment( env );
+        replica->setProcessChannelMode( QProcess::ForwardedErrorChannel );
+        replica->start( QCoreApplication::applicationFilePath(), args );
+        m_replicas.append( replica );
+        return replica;
+    }
+
+    static bool waitFor( QProcess *replica, const QString &event, QJsonObject &line,
+                 int timeout = startTimeout )
+    {
+        while ( true ) {
+            while ( replica->canReadLine() ) {
+                line = QJsonDocument::fromJson( replica->readLine() ).object();
+                if ( line.value( "event" ).toString() == event )
+                    return true;
+            }
+            if ( !replica->waitForReadyRead( timeout ) )
+                return false;
+        }
+    }
+
+    QList<QProcess *> replicas() const
+    {
+        return m_replicas;
+    }
+};
+
+QJsonObject runSession( const QStringList &replicaArgs, int replicas, QString &error )
+{
+    Coordinator coordinator;
+    if ( !coordinator.startBus() ) {
+        error = "can\'t start dbus-daemon";
+        return QJsonObject();
+    }
+
+    // The driver starts the session; the receivers join it one by one.
+    QJsonObject line;
+    LatencyHistogram joins;
+    for ( int i = 0; i < replicas; ++i ) {
+        QProcess *replica = coordinator.spawn( i, replicaArgs );
+        if ( !Coordinator::waitFor( replica, "ready", line ) ) {
+            error = QString( "replica %1 didn\'t start" ).arg( i );
+            return QJsonObject();
+        }
+        if ( i > 0 )
+            joins.record( qint64( line.value( "joinNs" ).toDouble() ) );
+    }
+
+    QProcess *driver = coordinator.replicas().first();
+    const qint64 started = LatencyHistogram::now();
+    driver->write( "go\n" );
+    QJsonObject done;
+    if ( !Coordinator::waitFor( driver, "done", done, -1 ) ) {
+        error = "driver died";
+        return QJsonObject();
+    }
+    const qint64 workloadTime = LatencyHistogram::now() - started;
+    QThread::msleep( quietPeriod );
+
+    QVector<QJsonObject> reports;
+    for ( QProcess *replica : coordinator.replicas() ) {
+        replica->write( "report\n" );
+        QJsonObject report;
+        if ( !Coordinator::waitFor( replica, "report", report ) ) {
+            error = "replica didn\'t report";
+            return QJsonObject();
+        }
+        reports.append( report );
+    }
+
+    // Step latency: from the driver's edit to each receiver applying the
+    // frame that carried it.
+    const QJsonArray steps = done.value( "steps" ).toArray();
+    const quint32 lastSeq  = quint32( done.value( "lastSeq" ).toDouble() );
+    qint64 lastStep	       = 0;
+    qint64 firstStep       = std::numeric_limits<qint64>::max();
+    double chars	       = 0;
+    QHash<quint32, qint64> firstStepOfSeq;
+    for ( const QJsonValue &value : steps ) {
+        const QJsonArray step = value.toArray();
+        const quint32 seq     = quint32( step.at( 2 ).toDouble() );
+        const qint64 at	      = qint64( step.at( 1 ).toDouble() );
+        lastStep	      = qMax( lastStep, at );
+        firstStep	      = qMin( firstStep, at );
+        chars += step.at( 3 ).toDouble();
+        if ( !firstStepOfSeq.contains( seq ) )
+            firstStepOfSeq.insert( seq, at );
+    }
+
+    // With --sequenced: how many frames the leader numbered, how long the
+    // others waited for their own frames to come back numbered, and what
+    // serving the joins cost the replicas that answered them.
+    double ordered     = 0;
+    double served      = 0;
+    double serveMaxUs  = 0;
+    double roundtripUs = 0;
+    for ( const QJsonObject &report : reports ) {
+        ordered += report.value( "ordered" ).toDouble();
+        const QJsonObject serving = report.value( "served" ).toObject();
+        served += serving.value( "count" ).toDouble();
+        serveMaxUs  = qMax( serveMaxUs, serving.value( "max" ).toDouble() / 1e3 );
+        roundtripUs = qMax( roundtripUs,
+                    report.value( "roundtrip" ).toObject().value( "p99" ).toDouble() / 1e3 );
+    }
+
+    // The receivers' worst GUI stall, and how fast the typed or pasted text
+    // reached the slowest of them.
+    double stallMaxMs = 0;
+    qint64 delivered  = 0;
+
+    // Step latency by kind of step, and for a streamed paste how long the
+    // slowest receiver took to get all of it rather than its first chunk.
+    static const char *const kindNames[] = { "type", "paste", "erase", "bold", "color", "wait" };
+    QHash<QString, LatencyHistogram> latencyByKind;
+    qint64 streamComplete = 0;
+
+    LatencyHistogram latency;
+    LatencyHistogram apply;
+    qint64 convergence = 0;
+    bool converged     = true;
+    const QString digest = reports.first().value( "digest" ).toString();
+    for ( int r = 1; r < reports.size(); ++r ) {
+        const QJsonObject &report = reports.at( r );
+        converged		  = converged && report.value( "digest" ).toString() == digest;
+
+        QHash<quint32, qint64> appliedAt;
+        for ( const QJsonValue &value : report.value( "applied" ).toArray() ) {
+            const QJsonArray entry = value.toArray();
+            appliedAt.insert( quint32( entry.at( 1 ).toDouble() ),
+                      qint64( entry.at( 2 ).toDouble() ) );
+            apply.record( qint64( entry.at( 3 ).toDouble() ) );
+        }
+        for ( const QJsonValue &value : steps ) {
+            const QJsonArray step = value.toArray();
+            const int kind  = step.at( 0 ).toInt();
+            const qint64 at = qint64( step.at( 1 ).toDouble() );
+            // Later frames carry whatever an earlier, merged one didn't.
+            for ( quint32 seq = quint32( step.at( 2 ).toDouble() ); seq <= lastSeq; ++seq ) {
+                if ( !appliedAt.contains( seq ) )
+                    continue;
+                const qint64 applied = appliedAt.value( seq );
+                latency.record( applied - at );
+                latencyByKind[kindNames[kind]].record( applied - at );
+                if ( kind == Step::Paste ) {
+                    const qint64 done = qint64( report.value( "streamDone" ).toDouble() );
+                    streamComplete    = qMax( streamComplete, qMax( applied, done ) - at );
+                }
+                break;
+            }
+        }
+        convergence = qMax( convergence, appliedAt.value( lastSeq, lastStep ) - lastStep );
+        delivered   = qMax( delivered, appliedAt.value( lastSeq, lastStep ) - firstStep );
+        stallMaxMs  = qMax( stallMaxMs, report.value( "stalls" ).toObject().value( "max" ).toDouble() );
+    }
+
+    const double bytes = done.value( "bytes" ).toDouble();
+    QJsonObject result;
+    result["replicas"]	      = replicas;
+    result["steps"]	      = steps.size();
+    result["workloadMs"]      = workloadTime / 1e6;
+    result["latencyUs"]	      = summary( latency, 1e3 );
+    QJsonObject byKind;
+    for ( auto it = latencyByKind.constBegin(); it != latencyByKind.constEnd(); ++it )
+        byKind[it.key()] = summary( it.value(), 1e3 );
+    result["latencyByKindUs"]  = byKind;
+    result["streamCompleteMs"] = streamComplete / 1e6;
+    result["applyUs"]	      = summary( apply, 1e3 );
+    result["bytes"]	      = bytes;
+    result["frames"]	      = done.value( "frames" );
+    result["bytesPerStep"]    = steps.isEmpty() ? 0.0 : bytes / steps.size();
+    result["convergenceMs"]   = convergence / 1e6;
+    result["converged"]	      = converged;
+    result["documentChars"]   = reports.first().value( "chars" );
+    result["joinUs"]	      = summary( joins, 1e3 );
+    result["snapshotsServed"] = served;
+    result["serveMaxUs"]      = serveMaxUs;
+    result["framesOrdered"]   = ordered;
+    result["roundtripP99Us"]  = roundtripUs;
+    if ( done.contains( "roundtripUs" ) )
+        result["pingRoundtripUs"] = done.value( "roundtripUs" );
+    result["stallMaxMs"]      = stallMaxMs;
+    result["throughputMBps"]  = delivered > 0 ? chars / 1e6 / ( delivered / 1e9 ) : 0.0;
+    return result;
+}
+
+//----------micro benchmarks-----------------
+template <typename F> double nanosPer( int count, F body )
+{
+    const qint64 started = LatencyHistogram::now();
+    for ( int i = 0; i < count; ++i )
+        body( i );
+    return double( LatencyHistogram::now() - started ) / count;
+}
+
+// Typing into one model and integrating its ops into another.
+QJsonObject microReplica()
+{
+    std::mt19937 random( 5 );
+    ReplicatedText author( 1 ), follower( 2 );
+    QVector<SyncOp> ops;
+    const QByteArray format = SyncOp::packFormat( QTextCharFormat() );
+
+    const int typed = 100000;
+    const double local = nanosPer( typed, [&]( int i ) {
+        const int pos = i % 50 ? author.size() : int( random() % ( author.size() + 1 ) );
+        ops += author.localInsert( pos, randomText( random, 1 ), format );
+    } );
+    const double remote = nanosPer( ops.size(), [&]( int i ) { follower.integrate( ops.at( i ) ); } );
+
+    QJsonObject out;
+    out["ops"]		    = ops.size();
+    out["localInsertNs"]    = local;
+    out["integrateNs"]	    = remote;
+    out["integrateOpsPerS"] = 1e9 / remote;
+    out["runs"]		    = follower.runCount();
+    out["converged"]	    = follower.text() == author.text();
+    return out;
+}
+
+// Bytes and encode/decode time of a keystroke, a 64k paste and a format
+// delta frame.
+QJsonObject microCodec()
+{
+    FormatTable sender, receiver;
+    auto frameOf = []( const QString &text, int type ) {
+        SyncFrame frame;
+        frame.sender = QString( 30, 'a' );
+        SyncOp op;
+        op.type	  = type;
+        op.pos	  = 1234;
+        op.length = text.isEmpty() ? 8 : text.size();
+        op.text	  = text;
+        op.format = SyncOp::packFormat( QTextCharFormat() );
+        op.clock  = 77;
+        op.site	  = 0xdeadbeef;
+        IdLevel level;
+        level.digit = 4096;
+        level.site  = op.site;
+        level.clock = op.clock;
+        op.id << level;
+        frame.ops << op;
+        return frame;
+    };
+
+    QJsonObject out;
+    const QVector<QPair<QString, SyncFrame>> shapes = {
+        { "keystroke", frameOf( "a", SyncOp::Insert ) },
+        { "paste64k", frameOf( QString( 65536, 'x' ), SyncOp::Insert ) },
+        { "merge", frameOf( QString(), SyncOp::Merge ) },
+    };
+    for ( const auto &shape : shapes ) {
+        QByteArray bytes = WireFormat::encodeFrame( shape.second, sender );
+        const int count	 = shape.first == "paste64k" ? 2000 : 200000;
+        const double encode = nanosPer(
+            count, [&]( int ) { bytes = WireFormat::encodeFrame( shape.second, sender ); } );
+        SyncFrame decoded;
+        WireFormat::decodeFrame( WireFormat::encodeFrame( shape.second, sender ), decoded,
+                     receiver );
+        const double decode =
+            nanosPer( count, [&]( int ) { WireFormat::decodeFrame( bytes, decoded, receiver ); } );
+
+        QJsonObject entry;
+        entry["bytes"]	   = bytes.size();
+        entry["encodeNs"]  = encode;
+        entry["decodeNs"]  = decode;
+        out[shape.first] = entry;
+    }
+    return out;
+}
+
+// Cost of one remote keystroke applied mid-document, by document size.
+QJsonObject microApply()
+{
+    QJsonObject out;
+    std::mt19937 random( 6 );
+    for ( int size : { 10000, 100000, 1000000 } ) {
+        Edit edit;
+        OpApplier applier( &edit );
+        QString text = randomText( random, size );
+        for ( int i = 80; i < text.size(); i += 81 )
+            text[i] = QChar::ParagraphSeparator;
+        edit.setPlainText( text );
+        edit.resize( 800, 600 );
+
+        LatencyHistogram histogram;
+        for ( int i = 0; i < 500; ++i ) {
+            SyncOp op;
+            op.type	  = SyncOp::Insert;
+            op.pos	  = int( random() % size );
+            op.length = 1;
+            op.text	  = "x";
+            op.format = SyncOp::packFormat( QTextCharFormat() );
+            const qint64 started = LatencyHistogram::now();
+            applier.apply( QVector<SyncOp>() << op );
+            QCoreApplication::processEvents();
+            histogram.record( LatencyHistogram::now() - started );
+        }
+        out[QString::number( size )] = summary( histogram, 1e3 );
+    }
+    return out;
+}
+
+qint64 residentBytes()
+{
+    QFile statm( "/proc/self/statm" );
+    if ( !statm.open( QIODevice::ReadOnly ) )
+        return 0;
+    const QList<QByteArray> fields = statm.readAll().split( ' ' );
+    return fields.value( 1 ).toLongLong() * sysconf( _SC_PAGESIZE );
+}
+
+// Memory and edit latency with documents of the given sizes in megabytes:
+// the model, the editor window over it, local edits anywhere in the model
+// and remote edits inside and before the window.
+QJsonObject microLarge( const QStringList &sizes )
+{
+    QJsonObject out;
+    std::mt19937 random( 7 );
+    const QByteArray format = SyncOp::packFormat( QTextCharFormat() );
+    for ( const QString &megabytes : sizes ) {
+        const int size = megabytes.toInt() * 1024 * 1024;
+        if ( size <= 0 )
+            continue;
+
+        QJsonObject entry;
+        const qint64 baseline = residentBytes();
+        {
+            QString text = randomText( random, size );
+            for ( int i = 80; i < text.size(); i += 81 )
+                text[i] = QChar::ParagraphSeparator;
+
+            ReplicatedText model( 1 );
+            qint64 started = LatencyHistogram::now();
+            model.localInsert( 0, text, format );
+            entry["loadMs"] = ( LatencyHistogram::now() - started ) / 1e6;
+            text.clear();
+            entry["modelBytes"] = double( residentBytes() - baseline );
+
+            Edit edit;
+            edit.resize( 800, 600 );
+            OpApplier applier( &edit );
+            applier.setWindow( SessionOptions().viewWindow );
+            edit.setWindow( size / 2, false );
+            started = LatencyHistogram::now();
+            applier.load( model );
+            QCoreApplication::processEvents();
+            entry["materializeMs"] = ( LatencyHistogram::now() - started ) / 1e6;
+            entry["editorChars"]   = edit.document()->characterCount() - 1;
+            entry["totalBytes"]    = double( residentBytes() - baseline );
+
+            LatencyHistogram local;
+            for ( int i = 0; i < 2000; ++i ) {
+                const int pos = int( random() % uint( model.size() ) );
+                started	      = LatencyHistogram::now();
+                model.localInsert( pos, "x", format );
+                local.record( LatencyHistogram::now() - started );
+            }
+            entry["localInsertUs"] = summary( local, 1e3 );
+
+            LatencyHistogram inside, before;
+            for ( int i = 0; i < 500; ++i ) {
+                SyncOp op;
+                op.type	  = SyncOp::Insert;
+                op.length = 1;
+                op.text	  = "y";
+                op.format = format;
+                op.pos	  = edit.windowStart() + int( random() % 1000 );
+                started	  = LatencyHistogram::now();
+                applier.apply( QVector<SyncOp>() << op );
+                QCoreApplication::processEvents();
+                inside.record( LatencyHistogram::now() - started );
+
+                op.pos	= qMax( 0, edit.windowStart() - 1 );
+                started = LatencyHistogram::now();
+                applier.apply( QVector<SyncOp>() << op );
+                before.record( LatencyHistogram::now() - started );
+            }
+            entry["applyInWindowUs"]	 = summary( inside, 1e3 );
+            entry["applyBeforeWindowUs"] = summary( before, 1e3 );
+        }
+        out[megabytes + "MB"] = entry;
+    }
+    return out;
+}
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    if ( qgetenv( "QT_QPA_PLATFORM" ).isEmpty() )
+        qputenv( "QT_QPA_PLATFORM", "offscreen" );
+    QApplication app( argc, argv );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Session sync benchmark" );
+    parser.addHelpOption();
+    QCommandLineOption replicasOption( "replicas", "Replicas in the session", "n", "3" );
+    QCommandLineOption workloadOption( "workload", "typing, paste, stream, format or a trace file",
+                       "name", "typing" );
+    QCommandLineOption stepsOption( "steps", "Keystrokes, pastes or style changes", "n", "2000" );
+    QCommandLineOption intervalOption( "interval", "Milliseconds between steps", "ms", "5" );
+    QCommandLineOption pasteOption( "pasteSize", "Characters per paste", "n", "262144" );
+    QCommandLineOption ringOption( "ring", "Exchange frames through shared memory" );
+    QCommandLineOption localOption( "local", "Connect the replicas through local sockets" );
+    QCommandLineOption sequencedOption( "sequenced", "Order frames through an elected leader" );
+    QCommandLineOption flushOption( "flushWindow", "Batching window", "ms", "12" );
+    QCommandLineOption pingpongOption( "pingpong",
+                       "Receivers answer every step; time the round trip" );
+    QCommandLineOption batchSizeOption( "maxBatchSize",
+                        "Bytes per frame; larger inserts are streamed in chunks",
+                        "bytes", QString::number( SessionOptions().maxBatchSize ) );
+    QCommandLineOption jsonOption( "json", "Write the report to a file", "path" );
+    QCommandLineOption microOption( "micro", "Run the in-process benchmarks" );
+    QCommandLineOption largeOption( "large", "Document sizes for --micro, in megabytes", "list",
+                    "1,10,100" );
+    QCommandLineOption replicaOption( "replica", "Internal: run as a replica" );
+    parser.addOptions( { replicasOption, workloadOption, stepsOption, intervalOption,
+                 pasteOption, ringOption, localOption, sequencedOption, flushOption,
+                 pingpongOption, batchSizeOption, jsonOption, microOption, largeOption,
+                 replicaOption } );
+    parser.process( app );
+
+    const int steps	 = parser.value( stepsOption ).toInt();
+    const int interval	 = parser.value( intervalOption ).toInt();
+    const QString workload = parser.value( workloadOption );
+
+    QJsonObject report;
+    if ( parser.isSet( microOption ) ) {
+        report["replica"] = microReplica();
+        report["codec"]	  = microCodec();
+        report["apply"]	  = microApply();
+        report["large"]	  = microLarge( parser.value( largeOption ).split( ',' ) );
+    } else if ( parser.isSet( replicaOption ) ) {
+        QVector<Step> plan;
+        if ( workload == "typing" )
+            plan = typingWorkload( steps, interval );
+        else if ( workload == "paste" )
+            plan = pasteWorkload( steps, parser.value( pasteOption ).toInt(), interval );
+        else if ( workload == "stream" )
+            plan = streamWorkload( steps, parser.value( pasteOption ).toInt(), interval );
+        else if ( workload == "format" )
+            plan = formatWorkload( steps, interval );
+        else if ( !traceWorkload( workload, interval, plan ) )
+            return 1;
+
+        SessionOptions options;
+        options.session      = sessionName;
+        options.ring         = parser.isSet( ringOption );
+        options.local        = parser.isSet( localOption );
+        options.sequenced    = parser.isSet( sequencedOption );
+        options.flushWindow  = parser.value( flushOption ).toInt();
+        options.maxBatchSize = parser.value( batchSizeOption ).toInt();
+        options.startedAt    = LatencyHistogram::now();
+        Replica replica( options, plan, parser.isSet( pingpongOption ) );
+        return app.exec();
+    } else {
+        QStringList args = QStringList() << "--replica" << "--workload" << workload << "--steps"
+                         << QString::number( steps ) << "--interval"
+                         << QString::number( interval ) << "--pasteSize"
+                         << parser.value( pasteOption ) << "--flushWindow"
+                         << parser.value( flushOption ) << "--maxBatchSize"
+                         << parser.value( batchSizeOption );
+        if ( parser.isSet( ringOption ) )
+            args << "--ring";
+        if ( parser.isSet( localOption ) )
+            args << "--local";
+        if ( parser.isSet( sequencedOption ) )
+            args << "--sequenced";
+        if ( parser.isSet( pingpongOption ) )
+            args << "--pingpong";
+
+        QString error;
+        report = runSession( args, qMax( 2, parser.value( replicasOption ).toInt() ), error );
+        if ( !error.isEmpty() ) {
+            fprintf( stderr, "%s\n", qPrintable( error ) );
+            return 1;
+        }
+        report["workload"]     = workload;
+        report["transport"]    = parser.isSet( localOption ) ? "local"
+                         : parser.isSet( ringOption ) ? "ring" : "bus";
+        report["sequenced"]    = parser.isSet( sequencedOption );
+        report["maxBatchSize"] = parser.value( batchSizeOption ).toInt();
+        report["pingpong"]     = parser.isSet( pingpongOption );
+    }
+
+    const QByteArray json = QJsonDocument( report ).toJson();
+    if ( parser.isSet( jsonOption ) ) {
+        QFile file( parser.value( jsonOption ) );
+        if ( !file.open( QIODevice::WriteOnly ) || file.write( json ) != json.size() ) {
+            fprintf( stderr, "can\'t write %s\n", qPrintable( parser.value( jsonOption ) ) );
+            return 1;
+        }
+    }
+    fprintf( stdout, "%s", json.constData() );
+    return 0;
+}
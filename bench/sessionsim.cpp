@@ -0,0 +1,755 @@
+// Deterministic simulation of a session inside one process. Headless replicas
+// talk through a fake network instead of the bus, and one seed decides every
+// delay, reordering, duplicate and crash along with the edits, format changes
+// and joins of each scenario. A scenario ends with the network drained and
+// checks that every replica still alive holds the same document; the report
+// has the time that took and what went over the network. The schedule is
+// virtual and reproducible; the replicas' own timers still run on the wall
+// clock. Before the scenarios it checks that a format passed on by one peer
+// reaches another that hears from it before hearing from the first.
+
+#include "dbushandler.h"
+#include "histogram.h"
+#include "transport.h"
+#include "wireformat.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QSet>
+#include <QTimer>
+#include <limits>
+#include <random>
+
+namespace
+{
+// Wall time a scenario may spend getting quiet, and the gap timeout of its
+// replicas, shorter than an editor's since nothing is ever lost for good.
+const int settleTimeout = 10000;
+const int gapTimeout	= 20;
+const int wakeInterval	= 5;
+const qint64 msec	= 1000 * 1000;
+
+struct Params {
+    int replicas	= 3;
+    int maxReplicas = 8;
+    int actions	= 200;
+    // Virtual milliseconds a message takes, and between two actions.
+    int minDelay = 1;
+    int maxDelay = 20;
+    int think	 = 5;
+    // Chances per message and per action.
+    double reorder   = 0.2;
+    double duplicate = 0.05;
+    double crash     = 0.01;
+    double join	     = 0.02;
+    double format    = 0.2;
+};
+
+QJsonObject summary( const LatencyHistogram &histogram, double scale )
+{
+    QJsonObject out;
+    out["count"] = double( histogram.count() );
+    out["mean"]	 = histogram.mean() / scale;
+    out["p50"]	 = histogram.percentile( 50 ) / scale;
+    out["p90"]	 = histogram.percentile( 90 ) / scale;
+    out["p99"]	 = histogram.percentile( 99 ) / scale;
+    out["max"]	 = histogram.max() / scale;
+    return out;
+}
+
+QString randomText( std::mt19937 &random, int length )
+{
+    static const QString alphabet = "etaoinshrdlucmfwypvbgkqjxz  \n";
+    QString text;
+    for ( int i = 0; i < length; ++i )
+        text += alphabet.at( int( random() % alphabet.size() ) );
+    return text;
+}
+
+bool chance( std::mt19937 &random, double p )
+{
+    return random() < p * double( std::mt19937::max() );
+}
+
+// A writes in a new format and B, having seen it, writes in it too; C gets
+// B's frame first, so it must carry the format in full.
+bool formatsRelayed()
+{
+    FormatTable a, b, c;
+    QTextCharFormat bold;
+    bold.setFontWeight( QFont::Bold );
+    SyncOp op;
+    op.type   = SyncOp::Insert;
+    op.pos    = 0;
+    op.length = 1;
+    op.text   = "x";
+    op.format = SyncOp::packFormat( bold );
+    SyncFrame frame;
+    frame.ops << op;
+
+    frame.sender	   = "a";
+    const QByteArray first = WireFormat::encodeFrame( frame, a );
+    SyncFrame decoded;
+    if ( !WireFormat::decodeFrame( first, decoded, b ) )
+        return false;
+    frame.sender	    = "b";
+    const QByteArray second = WireFormat::encodeFrame( frame, b );
+    return WireFormat::decodeFrame( second, decoded, c ) &&
+           decoded.ops.first().format == op.format && WireFormat::decodeFrame( first, decoded, c );
+}
+
+//----------network-----------------
+class SimLink;
+
+// Messages in flight, delivered in the order of their virtual arrival; ties
+// go in the order they were sent. A replica's calls reach a peer only after
+// the frames that were under way when it came up, as the bus would route
+// them.
+class SimNetwork
+{
+public:
+    struct Counters {
+        quint64 frames     = 0;
+        quint64 bytes      = 0;
+        quint64 duplicates = 0;
+        quint64 reordered  = 0;
+        quint64 dropped    = 0;
+        quint64 requests   = 0;
+        quint64 answers    = 0;
+        quint64 failed     = 0;
+    };
+
+    SimNetwork( std::mt19937 &random, const Params &params ) : m_random( random ), m_params( params )
+    {
+    }
+
+    qint64 now() const
+    {
+        return m_now;
+    }
+
+    bool isEmpty() const
+    {
+        return m_queue.isEmpty();
+    }
+
+    Counters counters() const
+    {
+        return m_counters;
+    }
+
+    void attach( SimLink *link, const QString &id );
+    void detach( const QString &id );
+    // The peer's calls in progress fail; what it sent already still arrives.
+    void crash( const QString &id );
+    QString pick( const QString &self, const QSet<QString> &failed );
+
+    void broadcast( const QString &from, const QByteArray &frame );
+    void request( const QString &from, const QString &to );
+    void answer( const QString &from, const QString &to, const QByteArray &snapshot );
+
+    // Delivers the next message due by the deadline; false if there is none.
+    bool step( qint64 deadline );
+    void advance( qint64 to )
+    {
+        m_now = qMax( m_now, to );
+    }
+
+private:
+    struct Message {
+        enum Kind { Frame, Request, Answer };
+        int kind = Frame;
+        QString from;
+        QString to;
+        QByteArray bytes;
+        qint64 sentAt = 0;
+    };
+
+    std::mt19937 &m_random;
+    const Params m_params;
+    qint64 m_now  = 0;
+    quint64 m_seq = 0;
+    QMap<QPair<qint64, quint64>, Message> m_queue;
+    QMap<QString, SimLink *> m_links;
+    QHash<QString, qint64> m_horizon;
+    QSet<QString> m_dead;
+    QMultiHash<QString, QString> m_serving;
+    Counters m_counters;
+
+    void post( const Message &message, qint64 notBefore = 0 );
+    qint64 delay();
+};
+
+// One replica's end of the network.
+class SimLink : public PeerLink
+{
+    SimNetwork &m_network;
+    const QString m_id;
+    QSet<QString> m_failed;
+    bool m_joined = false;
+
+public:
+    SimLink( SimNetwork &network, const QString &id ) : m_network( network ), m_id( id )
+    {
+        m_network.attach( this, id );
+    }
+
+    ~SimLink()
+    {
+        m_network.detach( m_id );
+    }
+
+    // The network knows every peer from the start.
+    bool isReady() const override
+    {
+        return true;
+    }
+
+    // Only a replica that has joined is asked for its state.
+    bool isJoined() const
+    {
+        return m_joined;
+    }
+
+    void setJoined()
+    {
+        m_joined = true;
+    }
+
+    QString name() const override
+    {
+        return "sim";
+    }
+
+    bool send( const QByteArray &frame ) override
+    {
+        m_network.broadcast( m_id, frame );
+        return true;
+    }
+
+    QString bestPeer() const override
+    {
+        return m_network.pick( m_id, m_failed );
+    }
+
+    void markFailed( const QString &peer ) override
+    {
+        m_failed.insert( peer );
+    }
+
+    void requestSnapshot( const QString &peer ) override
+    {
+        m_network.request( m_id, peer );
+    }
+
+    void answerSnapshot( const QString &joiner, const QByteArray &snapshot ) override
+    {
+        m_network.answer( m_id, joiner, snapshot );
+    }
+
+    void deliverFrame( const QByteArray &frame, qint64 latency )
+    {
+        m_latency.record( latency );
+        emit frameReceived( frame );
+    }
+
+    void deliverRequest( const QString &joiner )
+    {
+        emit snapshotRequested( joiner );
+    }
+
+    void deliverAnswer( const QString &peer, const QByteArray &snapshot )
+    {
+        if ( !snapshot.isEmpty() )
+            m_failed.clear();
+        emit snapshotReceived( peer, snapshot );
+    }
+};
+
+void SimNetwork::attach( SimLink *link, const QString &id )
+{
+    m_links.insert( id, link );
+    m_horizon.insert( id, m_queue.isEmpty() ? m_now : m_queue.lastKey().first );
+}
+
+void SimNetwork::detach( const QString &id )
+{
+    m_links.remove( id );
+}
+
+void SimNetwork::crash( const QString &id )
+{
+    m_dead.insert( id );
+    for ( const QString &joiner : m_serving.values( id ) ) {
+        Message failure;
+        failure.kind = Message::Answer;
+        failure.from = id;
+        failure.to   = joiner;
+        post( failure );
+    }
+    m_serving.remove( id );
+}
+
+QString SimNetwork::pick( const QString &self, const QSet<QString> &failed )
+{
+    QStringList candidates;
+    for ( auto it = m_links.constBegin(); it != m_links.constEnd(); ++it ) {
+        if ( it.key() != self && !m_dead.contains( it.key() ) && !failed.contains( it.key() ) &&
+             it.value()->isJoined() )
+            candidates << it.key();
+    }
+    if ( candidates.isEmpty() )
+        return QString();
+    return candidates.at( int( m_random() % candidates.size() ) );
+}
+
+void SimNetwork::broadcast( const QString &from, const QByteArray &frame )
+{
+    if ( m_dead.contains( from ) )
+        return;
+    for ( auto it = m_links.constBegin(); it != m_links.constEnd(); ++it ) {
+        if ( it.key() == from )
+            continue;
+        Message message;
+        message.to    = it.key();
+        message.bytes = frame;
+        post( message );
+        if ( chance( m_random, m_params.duplicate ) ) {
+            ++m_counters.duplicates;
+            post( message );
+        }
+    }
+}
+
+void SimNetwork::request( const QString &from, const QString &to )
+{
+    Message message;
+    message.kind = Message::Request;
+    message.from = from;
+    message.to   = to;
+    ++m_counters.requests;
+    post( message, m_horizon.value( from ) );
+}
+
+void SimNetwork::answer( const QString &from, const QString &to, const QByteArray &snapshot )
+{
+    if ( m_dead.contains( from ) )
+        return;
+    m_serving.remove( from, to );
+    Message message;
+    message.kind  = Message::Answer;
+    message.from  = from;
+    message.to    = to;
+    message.bytes = snapshot;
+    ++m_counters.answers;
+    post( message );
+}
+
+// Most messages take a delay from the usual range; a reordered one is held
+// back long enough for later ones to overtake it.
+qint64 SimNetwork::delay()
+{
+    const int spread = qMax( 1, m_params.maxDelay - m_params.minDelay + 1 );
+    qint64 delay     = ( m_params.minDelay + int( m_random() % spread ) ) * msec;
+    if ( chance( m_random, m_params.reorder ) ) {
+        ++m_counters.reordered;
+        delay += ( 1 + int( m_random() % spread ) ) * msec;
+    }
+    return delay;
+}
+
+void SimNetwork::post( const Message &message, qint64 notBefore )
+{
+    Message sent = message;
+    sent.sentAt	 = m_now;
+    m_queue.insert( qMakePair( qMax( m_now + delay(), notBefore ), m_seq++ ), sent );
+}
+
+// A call to a peer that is gone fails back to the caller.
+bool SimNetwork::step( qint64 deadline )
+{
+    if ( m_queue.isEmpty() || m_queue.firstKey().first > deadline )
+        return false;
+    const qint64 at	    = m_queue.firstKey().first;
+    const Message message = m_queue.take( m_queue.firstKey() );
+    m_now		    = qMax( m_now, at );
+
+    SimLink *link = m_links.value( message.to );
+    if ( !link || m_dead.contains( message.to ) ) {
+        ++m_counters.dropped;
+        if ( message.kind == Message::Request ) {
+            Message failure;
+            failure.kind = Message::Answer;
+            failure.from = message.to;
+            failure.to   = message.from;
+            post( failure );
+        }
+        return true;
+    }
+
+    switch ( message.kind ) {
+    case Message::Frame:
+        ++m_counters.frames;
+        m_counters.bytes += message.bytes.size();
+        link->deliverFrame( message.bytes, m_now - message.sentAt );
+        break;
+    case Message::Request:
+        m_serving.insert( message.to, message.from );
+        link->deliverRequest( message.from );
+        break;
+    case Message::Answer:
+        if ( message.bytes.isEmpty() )
+            ++m_counters.failed;
+        else
+            m_counters.bytes += message.bytes.size();
+        link->deliverAnswer( message.from, message.bytes );
+        break;
+    }
+    return true;
+}
+
+//----------scenario-----------------
+struct Outcome {
+    bool converged = false;
+    bool settled   = false;
+    qint64 virtualNs = 0;
+    qint64 wallNs    = 0;
+    int replicas     = 0;
+    int crashes      = 0;
+    int joins	     = 0;
+    int chars	     = 0;
+    SimNetwork::Counters network;
+    QHash<QString, quint64> counters;
+};
+
+class Scenario
+{
+    std::mt19937 m_random;
+    const Params m_params;
+    const quint32 m_seed;
+    SimNetwork m_network;
+    QMap<QString, DBusHandler *> m_replicas;
+    QHash<QString, SimLink *> m_links;
+    int m_next = 0;
+    Outcome m_outcome;
+    QTimer m_wake;
+
+public:
+    Scenario( quint32 seed, const Params &params )
+        : m_random( seed ), m_params( params ), m_seed( seed ), m_network( m_random, params )
+    {
+        // Keeps the event loop waking while the replicas' timers run.
+        m_wake.start( wakeInterval );
+    }
+
+    ~Scenario()
+    {
+        qDeleteAll( m_replicas );
+    }
+
+    Outcome run()
+    {
+        for ( int i = 0; i < m_params.replicas; ++i )
+            add();
+
+        for ( int i = 0; i < m_params.actions; ++i ) {
+            act();
+            if ( !deliver( m_network.now() + qint64( m_random() % ( m_params.think + 1 ) ) * msec ) )
+                return m_outcome;
+        }
+
+        const qint64 lastEdit = m_network.now();
+        QElapsedTimer wall;
+        wall.start();
+        m_outcome.settled   = drain();
+        m_outcome.virtualNs = m_network.now() - lastEdit;
+        m_outcome.wallNs    = wall.nsecsElapsed();
+        m_outcome.converged = m_outcome.settled && converged();
+        m_outcome.replicas  = m_replicas.size();
+        m_outcome.network   = m_network.counters();
+        for ( const DBusHandler *replica : m_replicas ) {
+            const QJsonObject counters =
+                replica->metrics().toJson().value( "counters" ).toObject();
+            for ( const QString &name : { "frames.sent", "frames.received", "frames.duplicates",
+                              "frames.held", "resyncs", "joins" } )
+                m_outcome.counters[name] += quint64( counters.value( name ).toDouble() );
+        }
+        return m_outcome;
+    }
+
+private:
+    void add()
+    {
+        const QString id = QString( "s%1r%2" ).arg( m_seed ).arg( m_next++ );
+        SessionOptions options;
+        options.session	    = "sim";
+        options.flushWindow = 0;
+        options.gapTimeout  = gapTimeout;
+        options.journaled   = false;
+
+        SimLink *link	     = new SimLink( m_network, id );
+        DBusHandler *replica = new DBusHandler( id, options, nullptr, link );
+        QObject::connect( replica, &DBusHandler::joined, link, &SimLink::setJoined );
+        m_replicas.insert( id, replica );
+        m_links.insert( id, link );
+        replica->startJoin();
+    }
+
+    // Never takes down the last replica with the whole document.
+    void crash()
+    {
+        const QStringList ready = readyReplicas();
+        if ( ready.size() < 2 )
+            return;
+        const QString id = ready.at( int( m_random() % ready.size() ) );
+        m_network.crash( id );
+        delete m_replicas.take( id );
+        m_links.remove( id );
+        ++m_outcome.crashes;
+    }
+
+    QStringList readyReplicas() const
+    {
+        QStringList ready;
+        for ( auto it = m_replicas.constBegin(); it != m_replicas.constEnd(); ++it ) {
+            if ( m_links.value( it.key() )->isJoined() && !it.value()->isJoining() )
+                ready << it.key();
+        }
+        return ready;
+    }
+
+    void act()
+    {
+        if ( chance( m_random, m_params.crash ) ) {
+            crash();
+            return;
+        }
+        if ( chance( m_random, m_params.join ) && m_replicas.size() < m_params.maxReplicas ) {
+            add();
+            ++m_outcome.joins;
+            return;
+        }
+
+        const QStringList ready = readyReplicas();
+        if ( ready.isEmpty() )
+            return;
+        DBusHandler *replica = m_replicas.value( ready.at( int( m_random() % ready.size() ) ) );
+        const int size	     = replica->model().size();
+
+        SyncOp op;
+        if ( size && chance( m_random, m_params.format ) ) {
+            op.type	 = SyncOp::Merge;
+            op.pos	 = int( m_random() % size );
+            op.length	 = 1 + int( m_random() % qMin( 16, size - op.pos ) );
+            QTextCharFormat format;
+            if ( m_random() % 2 )
+                format.setFontWeight( m_random() % 2 ? QFont::Bold : QFont::Normal );
+            else
+                format.setForeground( QColor::fromRgb( QRgb( m_random() % 0x1000000 ) ) );
+            op.format = SyncOp::packFormat( format );
+        } else if ( size && m_random() % 3 == 0 ) {
+            op.type   = SyncOp::Remove;
+            op.pos    = int( m_random() % size );
+            op.length = 1 + int( m_random() % qMin( 8, size - op.pos ) );
+        } else {
+            op.type	 = SyncOp::Insert;
+            op.pos	 = int( m_random() % ( size + 1 ) );
+            op.text	 = randomText( m_random, 1 + int( m_random() % 8 ) );
+            op.format	 = SyncOp::packFormat( QTextCharFormat() );
+        }
+        replica->sendLocalOps( QVector<SyncOp>() << op );
+    }
+
+    // Hands over the messages due by the deadline one at a time, letting the
+    // replicas finish with each before the next.
+    bool deliver( qint64 deadline )
+    {
+        if ( !settle() )
+            return false;
+        while ( m_network.step( deadline ) ) {
+            if ( !settle() )
+                return false;
+        }
+        m_network.advance( deadline );
+        return true;
+    }
+
+    bool settle()
+    {
+        QElapsedTimer clock;
+        clock.start();
+        for ( ;; ) {
+            bool settled = true;
+            for ( const DBusHandler *replica : m_replicas )
+                settled = settled && replica->isSettled();
+            if ( settled )
+                return true;
+            if ( clock.elapsed() > settleTimeout )
+                return false;
+            QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+        }
+    }
+
+    // Done once nothing is in flight and nobody is joining or waiting on a
+    // gap; a gap's timer may still have to run out for that.
+    bool drain()
+    {
+        QElapsedTimer clock;
+        clock.start();
+        for ( ;; ) {
+            if ( !settle() )
+                return false;
+            if ( m_network.step( std::numeric_limits<qint64>::max() ) )
+                continue;
+            bool quiet = true;
+            for ( const DBusHandler *replica : m_replicas )
+                quiet = quiet && !replica->isJoining() && !replica->inboundDepth();
+            if ( quiet )
+                return true;
+            if ( clock.elapsed() > settleTimeout )
+                return false;
+            QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+        }
+    }
+
+    // Runs may be split differently from one replica to the next; the text
+    // and the formats over it may not.
+    bool converged()
+    {
+        if ( m_replicas.isEmpty() )
+            return true;
+        const QVector<SyncOp> expected = m_replicas.first()->model().contents();
+        m_outcome.chars		       = m_replicas.first()->model().size();
+        for ( const DBusHandler *replica : m_replicas ) {
+            const QVector<SyncOp> contents = replica->model().contents();
+            if ( contents.size() != expected.size() )
+                return false;
+            for ( int i = 0; i < contents.size(); ++i ) {
+                if ( contents.at( i ).text != expected.at( i ).text ||
+                     contents.at( i ).format != expected.at( i ).format )
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    QCoreApplication app( argc, argv );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription( "Deterministic session simulation" );
+    parser.addHelpOption();
+    QCommandLineOption seedOption( "seed", "Seed of the first scenario", "n", "1" );
+    QCommandLineOption scenariosOption( "scenarios", "Scenarios to run, seeded one after another",
+                        "n", "1000" );
+    QCommandLineOption replicasOption( "replicas", "Replicas a scenario starts with", "n", "3" );
+    QCommandLineOption maxReplicasOption( "maxReplicas", "Replicas alive at most", "n", "8" );
+    QCommandLineOption actionsOption( "actions", "Edits, joins and crashes per scenario", "n",
+                      "200" );
+    QCommandLineOption delayOption( "delay", "Virtual delay range of a message", "min,max",
+                    "1,20" );
+    QCommandLineOption reorderOption( "reorder", "Chance a message is overtaken", "p", "0.2" );
+    QCommandLineOption duplicateOption( "duplicate", "Chance a frame arrives twice", "p", "0.05" );
+    QCommandLineOption crashOption( "crash", "Chance an action is a crash", "p", "0.01" );
+    QCommandLineOption joinOption( "join", "Chance an action is a new replica", "p", "0.02" );
+    QCommandLineOption formatOption( "format", "Chance an edit is a format change", "p", "0.2" );
+    QCommandLineOption jsonOption( "json", "Write the report to a file", "path" );
+    parser.addOptions( { seedOption, scenariosOption, replicasOption, maxReplicasOption,
+                 actionsOption, delayOption, reorderOption, duplicateOption, crashOption,
+                 joinOption, formatOption, jsonOption } );
+    parser.process( app );
+
+    Params params;
+    params.replicas    = qMax( 1, parser.value( replicasOption ).toInt() );
+    params.maxReplicas = qMax( params.replicas, parser.value( maxReplicasOption ).toInt() );
+    params.actions     = qMax( 0, parser.value( actionsOption ).toInt() );
+    const QStringList delays = parser.value( delayOption ).split( ',' );
+    params.minDelay	   = qMax( 0, delays.value( 0 ).toInt() );
+    params.maxDelay	   = qMax( params.minDelay, delays.value( 1 ).toInt() );
+    params.reorder	   = parser.value( reorderOption ).toDouble();
+    params.duplicate   = parser.value( duplicateOption ).toDouble();
+    params.crash       = parser.value( crashOption ).toDouble();
+    params.join	       = parser.value( joinOption ).toDouble();
+    params.format      = parser.value( formatOption ).toDouble();
+
+    const quint32 seed	= parser.value( seedOption ).toUInt();
+    const int scenarios = qMax( 1, parser.value( scenariosOption ).toInt() );
+
+    const bool relayed = formatsRelayed();
+    LatencyHistogram virtualTime, wallTime;
+    SimNetwork::Counters network;
+    QHash<QString, quint64> counters;
+    QJsonArray diverged, stuck;
+    int crashes = 0, joins = 0;
+    for ( int i = 0; i < scenarios; ++i ) {
+        const Outcome outcome = Scenario( seed + quint32( i ), params ).run();
+        if ( !outcome.settled )
+            stuck.append( double( seed + quint32( i ) ) );
+        else if ( !outcome.converged )
+            diverged.append( double( seed + quint32( i ) ) );
+        if ( outcome.settled ) {
+            virtualTime.record( outcome.virtualNs );
+            wallTime.record( outcome.wallNs );
+        }
+        crashes += outcome.crashes;
+        joins += outcome.joins;
+        network.frames += outcome.network.frames;
+        network.bytes += outcome.network.bytes;
+        network.duplicates += outcome.network.duplicates;
+        network.reordered += outcome.network.reordered;
+        network.dropped += outcome.network.dropped;
+        network.requests += outcome.network.requests;
+        network.answers += outcome.network.answers;
+        network.failed += outcome.network.failed;
+        for ( auto it = outcome.counters.constBegin(); it != outcome.counters.constEnd(); ++it )
+            counters[it.key()] += it.value();
+    }
+
+    QJsonObject messages;
+    messages["frames"]	       = double( network.frames );
+    messages["bytes"]	       = double( network.bytes );
+    messages["duplicated"]     = double( network.duplicates );
+    messages["reordered"]      = double( network.reordered );
+    messages["toCrashed"]      = double( network.dropped );
+    messages["joinRequests"]   = double( network.requests );
+    messages["joinAnswers"]    = double( network.answers );
+    messages["failedRequests"] = double( network.failed );
+
+    QJsonObject replicas;
+    for ( auto it = counters.constBegin(); it != counters.constEnd(); ++it )
+        replicas[it.key()] = double( it.value() );
+
+    QJsonObject report;
+    report["seed"]		= double( seed );
+    report["scenarios"]		= scenarios;
+    report["actions"]		= params.actions;
+    report["crashes"]		= crashes;
+    report["joins"]		= joins;
+    report["converged"]		= scenarios - diverged.size() - stuck.size();
+    report["diverged"]		= diverged;
+    report["stuck"]		= stuck;
+    report["convergenceVirtualMs"] = summary( virtualTime, 1e6 );
+    report["convergenceWallMs"]	= summary( wallTime, 1e6 );
+    report["messages"]		= messages;
+    report["survivors"]		= replicas;
+    report["formatsRelayed"]	= relayed;
+
+    const QByteArray json = QJsonDocument( report ).toJson();
+    if ( parser.isSet( jsonOption ) ) {
+        QFile file( parser.value( jsonOption ) );
+        if ( !file.open( QIODevice::WriteOnly ) || file.write( json ) != json.size() ) {
+            fprintf( stderr, "can\'t write %s\n", qPrintable( parser.value( jsonOption ) ) );
+            return 1;
+        }
+    }
+    fprintf( stdout, "%s", json.constData() );
+    return relayed && diverged.isEmpty() && stuck.isEmpty() ? 0 : 1;
+}
@@ -1,42 +1,141 @@
 #ifndef STRUCTS_H
 #define STRUCTS_H
-#include <QDBusArgument>
+#include <QDataStream>
 #include <QDebug>
+#include <QHash>
+#include <QTextCharFormat>
+#include <QVector>
 
-enum Params { BOLD, UNDERLINE, ITALIC, SIZE, FONT, COLOR, POSITION };
+struct SessionOptions {
+    QString session;
+    bool isolated    = false;
+    int flushWindow  = 12;
+    int maxBatchOps  = 256;
+    int maxBatchSize = 64 * 1024;
+    bool ring	     = false;
+    // --local: the replicas of a named session talk over local sockets and
+    // need no session bus.
+    bool local       = false;
+    // Every frame goes through the session's elected leader, which numbers it.
+    bool sequenced   = false;
+    // Characters of a large document materialized in the editor; 0 for all.
+    int viewWindow   = 1 << 20;
+    // Milliseconds a gap in a peer's frames may stay open before a resync.
+    int gapTimeout   = 1000;
+    // Keep the session's history on disk for the next instance to start from.
+    bool journaled   = true;
+    qint64 startedAt = 0;
+    // --stats: seconds between dumps, 0 for one, -1 to run the editor.
+    int statsInterval = -1;
+    // --daemon: keep every session named on the command line, headless.
+    bool daemon = false;
+    QStringList sessions;
+};
+
+// One level of a dense character identifier. Digits order the document,
+// site and clock make the identifier unique among replicas.
+struct IdLevel {
+    quint32 digit = 0;
+    quint32 site  = 0;
+    quint32 clock = 0;
+
+    bool operator==( const IdLevel &other ) const
+    {
+        return digit == other.digit && site == other.site && clock == other.clock;
+    }
+
+    friend QDataStream &operator<<( QDataStream &out, const IdLevel &level )
+    {
+        return out << level.digit << level.site << level.clock;
+    }
+    friend QDataStream &operator>>( QDataStream &in, IdLevel &level )
+    {
+        return in >> level.digit >> level.site >> level.clock;
+    }
+};
+Q_DECLARE_TYPEINFO( IdLevel, Q_PRIMITIVE_TYPE );
+
+typedef QVector<IdLevel> CharId;
 
-struct CharInfo {
+// One edit of the document, taken from QTextDocument::contentsChange.
+// On the wire an op addresses characters by id (the first character of a run
+// of consecutive ids); pos is only the sender's view. Ops handed to the
+// editor are positional and leave id empty.
+struct SyncOp {
+    enum Type { Insert, Remove, Format, Merge };
+
+    int type   = Insert;
+    int pos    = -1;
+    int length = 0;
     QString text;
-    int pos = -1;
+    QByteArray format;
+    CharId id;
+    quint32 clock = 0;
+    quint32 site  = 0;
 
-    CharInfo() = default;
-    ~CharInfo()			  = default;
-    CharInfo( const CharInfo &other ) = default;
-    CharInfo &operator=( const CharInfo &other ) = default;
+    SyncOp() = default;
+    ~SyncOp()			= default;
+    SyncOp( const SyncOp &other ) = default;
+    SyncOp &operator=( const SyncOp &other ) = default;
 
-    friend QDBusArgument &operator<<( QDBusArgument &argument, const CharInfo &info )
+    static QByteArray packFormat( const QTextCharFormat &fmt )
     {
-        argument.beginStructure();
-        argument << info.text;
-        argument << info.pos;
-        argument.endStructure();
-        return argument;
+        QByteArray bytes;
+        QDataStream out( &bytes, QIODevice::WriteOnly );
+        out << QTextFormat( fmt );
+        return bytes;
     }
-    friend const QDBusArgument &operator>>( const QDBusArgument &argument, CharInfo &info )
+
+    static QTextCharFormat unpackFormat( const QByteArray &bytes )
     {
-        argument.beginStructure();
-        argument >> info.text;
-        argument >> info.pos;
-        argument.endStructure();
-        return argument;
+        QTextFormat fmt;
+        QDataStream in( bytes );
+        in >> fmt;
+        return fmt.toCharFormat();
     }
 
-    friend QDebug operator<<( QDebug dbg, const CharInfo &info )
+    friend QDebug operator<<( QDebug dbg, const SyncOp &op )
     {
-        dbg << "key:" << info.text << "position:" << info.pos;
+        dbg << "op:" << op.type << "position:" << op.pos << "length:" << op.length;
         return dbg;
     }
 };
-Q_DECLARE_METATYPE( CharInfo )
+Q_DECLARE_METATYPE( SyncOp )
+
+// Ops and the sender's cursor, flushed together by OpBatcher.
+struct SyncFrame {
+    QString sender;
+    quint32 seq = 0;
+    QVector<SyncOp> ops;
+    int cursor = -1;
+    // Characters of a large insert still to come in the sender's next frames.
+    int streamLeft = 0;
+};
+
+// State handed to a joiner: the serialized model at some version, the last
+// frame seen from every sender at that point, and the frames logged since.
+struct Snapshot {
+    quint64 version = 0;
+    QHash<QString, quint32> seen;
+    QByteArray model;
+    QVector<QByteArray> tail;
+};
+Q_DECLARE_METATYPE( Snapshot )
+
+// Toolbar state a joiner takes over from the peer that fed it.
+struct CharState {
+    bool bold	   = false;
+    bool underline = false;
+    bool italic	   = false;
+    QString size;
+    QString font;
+    QString color;
+    int position = -1;
+
+    bool isValid() const
+    {
+        return position >= 0;
+    }
+};
 
 #endif // STRUCTS_H
@@ -0,0 +1,112 @@
+#include "applyscheduler.h"
+
+namespace
+{
+// Frames handed to the applier in one go between looks at the clock.
+const int sliceFrames = 16;
+} // namespace
+
+ApplyScheduler::ApplyScheduler( const OpApplier &applier, int frameInterval, qint64 budget,
+                QObject *parent )
+    : QObject( parent ), m_applier( applier ), m_frameInterval( frameInterval ),
+      m_budget( budget )
+{
+    m_timer.setSingleShot( true );
+    m_timer.setTimerType( Qt::PreciseTimer );
+    connect( &m_timer, &QTimer::timeout, this, &ApplyScheduler::tick );
+}
+
+void ApplyScheduler::queue( const QVector<SyncOp> &ops )
+{
+    ++m_counters.frames;
+    if ( ops.isEmpty() )
+        return;
+    m_pending.enqueue( ops );
+    schedule();
+}
+
+// Each move puts the one local cursor somewhere, so a later one makes an
+// earlier one pointless.
+void ApplyScheduler::moveCursor( const QString &sender, int pos )
+{
+    ++m_counters.cursorsIn;
+    if ( m_cursor >= 0 )
+        ++m_counters.cursorsMerged;
+    m_cursorSender = sender;
+    m_cursor       = pos;
+    schedule();
+}
+
+void ApplyScheduler::flush()
+{
+    m_timer.stop();
+    apply( -1 );
+}
+
+void ApplyScheduler::clear()
+{
+    m_timer.stop();
+    for ( const QVector<SyncOp> &ops : m_pending )
+        m_counters.dropped += ops.size();
+    m_pending.clear();
+    m_cursor = -1;
+}
+
+int ApplyScheduler::size() const
+{
+    return m_pending.size();
+}
+
+ApplyScheduler::Counters ApplyScheduler::counters() const
+{
+    return m_counters;
+}
+
+const LatencyHistogram &ApplyScheduler::tickTime() const
+{
+    return m_tickTime;
+}
+
+// An idle editor takes the first change on the next turn of the event loop;
+// after that, changes go in a frame apart.
+void ApplyScheduler::schedule()
+{
+    if ( m_timer.isActive() )
+        return;
+    const qint64 since = m_lastTick.isValid() ? m_lastTick.elapsed() : m_frameInterval;
+    m_timer.start( int( qMax<qint64>( 0, m_frameInterval - since ) ) );
+}
+
+void ApplyScheduler::tick()
+{
+    m_lastTick.start();
+    apply( m_budget );
+    if ( !m_pending.isEmpty() ) {
+        ++m_counters.overBudget;
+        schedule();
+    }
+}
+
+// A negative budget applies everything.
+void ApplyScheduler::apply( qint64 budget )
+{
+    if ( m_pending.isEmpty() && m_cursor < 0 )
+        return;
+
+    const qint64 started = LatencyHistogram::now();
+    while ( !m_pending.isEmpty() ) {
+        QVector<SyncOp> ops;
+        for ( int i = 0; i < sliceFrames && !m_pending.isEmpty(); ++i )
+            ops += m_pending.dequeue();
+        m_applier.apply( ops );
+        if ( budget >= 0 && LatencyHistogram::now() - started >= budget )
+            break;
+    }
+    if ( m_pending.isEmpty() && m_cursor >= 0 ) {
+        const int cursor = m_cursor;
+        m_cursor	 = -1;
+        emit cursorMoved( m_cursorSender, cursor );
+    }
+    ++m_counters.ticks;
+    m_tickTime.record( LatencyHistogram::now() - started );
+}
@@ -0,0 +1,67 @@
+#ifndef APPLYSCHEDULER_H
+#define APPLYSCHEDULER_H
+
+#include "Structs.h"
+#include "histogram.h"
+#include "opapplier.h"
+#include <QElapsedTimer>
+#include <QObject>
+#include <QQueue>
+#include <QTimer>
+
+// Paces remote changes into the editor at most once per display frame. The
+// model takes every frame at once; the ops it hands back for the editor queue
+// here and go in together, one relayout for the lot, until the frame's time
+// budget is spent. Only the latest remote cursor move is kept, and it goes
+// in once the ops before it have.
+class ApplyScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Counters {
+        quint64 frames	      = 0;
+        quint64 ticks	      = 0;
+        quint64 overBudget    = 0;
+        quint64 cursorsIn     = 0;
+        quint64 cursorsMerged = 0;
+        quint64 dropped	      = 0;
+    };
+
+    ApplyScheduler( const OpApplier &applier, int frameInterval, qint64 budget,
+            QObject *parent = nullptr );
+
+    void queue( const QVector<SyncOp> &ops );
+    void moveCursor( const QString &sender, int pos );
+    // Applies everything now; the user is about to edit, or the view moves.
+    void flush();
+    // Forgets what is queued; the editor is about to be reloaded.
+    void clear();
+    int size() const;
+
+    Counters counters() const;
+    const LatencyHistogram &tickTime() const;
+
+signals:
+    void cursorMoved( const QString &sender, int pos );
+
+private:
+    const OpApplier &m_applier;
+    const int m_frameInterval;
+    const qint64 m_budget;
+    QTimer m_timer;
+    QElapsedTimer m_lastTick;
+
+    QQueue<QVector<SyncOp>> m_pending;
+    QString m_cursorSender;
+    int m_cursor = -1;
+
+    Counters m_counters;
+    LatencyHistogram m_tickTime;
+
+    void schedule();
+    void tick();
+    void apply( qint64 budget );
+};
+
+#endif // APPLYSCHEDULER_H
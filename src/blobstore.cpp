@@ -0,0 +1,93 @@
+#include "blobstore.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace
+{
+const char *const blobScheme = "blob";
+const int hashLength	     = 64;
+} // namespace
+
+BlobStore::BlobStore( const QString &session )
+    : m_dir( QStandardPaths::writableLocation( QStandardPaths::AppLocalDataLocation ) +
+         "/blobs/" + ( session.isEmpty() ? QString( "default" ) : session ) )
+{
+    QDir().mkpath( m_dir );
+}
+
+QByteArray BlobStore::hashOf( const QByteArray &bytes )
+{
+    return QCryptographicHash::hash( bytes, QCryptographicHash::Sha256 ).toHex();
+}
+
+QUrl BlobStore::urlOf( const QByteArray &hash )
+{
+    return QUrl( QString( blobScheme ) + ':' + QString::fromLatin1( hash ) );
+}
+
+QByteArray BlobStore::hashIn( const QUrl &url )
+{
+    if ( url.scheme() != blobScheme )
+        return QByteArray();
+    const QByteArray hash = url.path().toLatin1();
+    return isHash( hash ) ? hash : QByteArray();
+}
+
+// Written under a temporary name and renamed, so a reader never maps half a
+// blob; two instances storing the same one write the same bytes.
+QByteArray BlobStore::put( const QByteArray &bytes )
+{
+    const QByteArray hash = hashOf( bytes );
+    if ( contains( hash ) )
+        return hash;
+
+    QSaveFile file( pathOf( hash ) );
+    if ( !file.open( QIODevice::WriteOnly ) || file.write( bytes ) != bytes.size() ||
+         !file.commit() ) {
+        qInfo() << "can\'t store blob" << hash << file.errorString();
+        return QByteArray();
+    }
+    return hash;
+}
+
+bool BlobStore::contains( const QByteArray &hash ) const
+{
+    return m_mapped.contains( hash ) || ( isHash( hash ) && QFile::exists( pathOf( hash ) ) );
+}
+
+// The mapping stays until the store goes; a blob's file is never written
+// again once it exists.
+QByteArray BlobStore::map( const QByteArray &hash )
+{
+    auto it = m_mapped.constFind( hash );
+    if ( it != m_mapped.constEnd() )
+        return it->bytes;
+
+    if ( !isHash( hash ) )
+        return QByteArray();
+    Mapping mapping;
+    mapping.file.reset( new QFile( pathOf( hash ) ) );
+    if ( !mapping.file->open( QIODevice::ReadOnly ) || !mapping.file->size() )
+        return QByteArray();
+    const uchar *data = mapping.file->map( 0, mapping.file->size() );
+    if ( !data )
+        return QByteArray();
+    mapping.bytes = QByteArray::fromRawData( reinterpret_cast<const char *>( data ),
+                         int( mapping.file->size() ) );
+    m_mapped.insert( hash, mapping );
+    return mapping.bytes;
+}
+
+// Hashes come from peers too, and name files.
+bool BlobStore::isHash( const QByteArray &hash )
+{
+    return hash.size() == hashLength && QByteArray::fromHex( hash ).toHex() == hash;
+}
+
+QString BlobStore::pathOf( const QByteArray &hash ) const
+{
+    return m_dir + '/' + QString::fromLatin1( hash );
+}
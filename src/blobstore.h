@@ -0,0 +1,45 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QSharedPointer>
+#include <QString>
+#include <QUrl>
+
+// Images of one session, kept once each under the hash of their bytes. The
+// document names an image "blob:<hash>", so ops and snapshots carry only the
+// name. Every instance on the host shares the files and maps them read-only;
+// an instance that doesn't have one fetches it from a peer, once.
+class BlobStore
+{
+    struct Mapping {
+        QSharedPointer<QFile> file;
+        QByteArray bytes;
+    };
+
+    const QString m_dir;
+    QHash<QByteArray, Mapping> m_mapped;
+
+public:
+    explicit BlobStore( const QString &session );
+
+    static QByteArray hashOf( const QByteArray &bytes );
+    static QUrl urlOf( const QByteArray &hash );
+    // The hash a blob url names, empty for any other url.
+    static QByteArray hashIn( const QUrl &url );
+
+    // Stores bytes unless they are there already; returns their hash.
+    QByteArray put( const QByteArray &bytes );
+    bool contains( const QByteArray &hash ) const;
+    // The blob's bytes without a copy, valid while the store lives; empty if
+    // the blob isn't here.
+    QByteArray map( const QByteArray &hash );
+
+private:
+    static bool isHash( const QByteArray &hash );
+    QString pathOf( const QByteArray &hash ) const;
+};
+
+#endif // BLOBSTORE_H
@@ -0,0 +1,86 @@
+#include "daemon.h"
+#include "dbushandler.h"
+#include <QCoreApplication>
+#include <QSharedPointer>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QUuid>
+#include <QVector>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+int signalFd[2] = { -1, -1 };
+
+void onSignal( int )
+{
+    const char byte = 1;
+    if ( ::write( signalFd[0], &byte, sizeof( byte ) ) < 0 )
+        return;
+}
+
+// Turns SIGTERM and friends into a normal quit, so the replicas are destroyed
+// and checkpoint their sessions like a closed window would.
+bool catchSignals()
+{
+    if ( ::socketpair( AF_UNIX, SOCK_STREAM, 0, signalFd ) )
+        return false;
+
+    struct sigaction action = {};
+    action.sa_handler = onSignal;
+    sigemptyset( &action.sa_mask );
+    action.sa_flags = SA_RESTART;
+    for ( int sig : { SIGTERM, SIGINT, SIGHUP } )
+        if ( sigaction( sig, &action, nullptr ) )
+            return false;
+
+    QSocketNotifier *notifier =
+        new QSocketNotifier( signalFd[1], QSocketNotifier::Read, QCoreApplication::instance() );
+    QObject::connect( notifier, &QSocketNotifier::activated, QCoreApplication::instance(),
+              &QCoreApplication::quit );
+    return true;
+}
+
+QString newId()
+{
+    const int idSize = 30;
+    return QUuid::createUuid()
+        .toString()
+        .replace( QString( "-" ), QString( "" ) )
+        .remove( 0, 1 )
+        .left( idSize );
+}
+} // namespace
+
+int runDaemon( const SessionOptions &options )
+{
+    if ( options.isolated ) {
+        qWarning() << "an isolated session has nothing to keep";
+        return 1;
+    }
+    // A keeper that a stop would kill without a checkpoint isn't worth running.
+    if ( !catchSignals() ) {
+        qWarning() << "can\'t catch signals, sessions wouldn\'t be checkpointed on exit";
+        return 1;
+    }
+
+    QStringList sessions = options.sessions;
+    if ( sessions.isEmpty() )
+        sessions << QString();
+    sessions.removeDuplicates();
+
+    QVector<QSharedPointer<DBusHandler>> keepers;
+    for ( const QString &session : sessions ) {
+        SessionOptions keeper = options;
+        keeper.session        = session;
+
+        QSharedPointer<DBusHandler> handler( new DBusHandler( newId(), keeper, nullptr ) );
+        QTimer::singleShot( 0, handler.data(), &DBusHandler::startJoin );
+        keepers.append( handler );
+        qInfo() << "keeping session" << DBusHandler::interfaceName( session );
+    }
+
+    return QCoreApplication::exec();
+}
@@ -0,0 +1,12 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "Structs.h"
+
+// --daemon: keeps the sessions named in options.sessions alive without a
+// display. Each gets a headless replica on the shared bus connection that
+// holds the model and the op log, serves joins and snapshots ahead of the
+// editors, and writes its checkpoint when the process is told to stop.
+int runDaemon( const SessionOptions &options );
+
+#endif // DAEMON_H
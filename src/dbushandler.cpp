@@ -1,41 +1,154 @@
 #include "dbushandler.h"
 #include "edit.h"
+#include <QJsonDocument>
+#include <QLoggingCategory>
 
-QVariantList DBusHandler::getToolbarState() const
+namespace
+{
+const int logEntries	  = 4096;
+const qint64 logBytes	  = 8 * 1024 * 1024;
+const int snapshotRefresh = 256;
+const int publishTimeout  = 30000;
+const int journalRetry	  = 5000;
+const int callTimeout	  = 5000;
+const int viewSettle	  = 30;
+// Frames waiting to be applied before the backlog is dropped for a resync,
+// and frames held back behind gaps.
+const int maxInbound	  = 4096;
+const int maxHeld	  = 512;
+// Remote changes reach the editor once per display frame, taking at most
+// half of it.
+const int frameInterval	  = 16;
+const qint64 applyBudget  = 8 * 1000 * 1000;
+const int undoDepth	  = 1000;
+
+// QT_LOGGING_RULES="session.snapshot.debug=true" compares snapshots with HTML.
+Q_LOGGING_CATEGORY( lcSnapshot, "session.snapshot", QtWarningMsg )
+
+// With --local every replica of a named session is reached through local
+// sockets instead of the bus.
+PeerLink *linkFor( const QString &id, const SessionOptions &options, PeerLink *link )
+{
+    if ( link || !options.local || options.isolated )
+        return link;
+    return new LocalTransport( id, options.session, options.daemon );
+}
+} // namespace
+
+CharState DBusHandler::getToolbarState() const
 {
     return m_toolbarState;
 }
 
-DBusHandler::DBusHandler( const QString &id, const QString &privateSession, bool isolated,
-              Edit *textEdit )
-    : m_id( id ), m_isolated( isolated ),
-      m_conn( new QDBusConnection( QDBusConnection::sessionBus() ) ), m_textEdit( textEdit ),
-      m_sharedMemory( "SharedMemory" ), QObject( textEdit )
+const ReplicatedText &DBusHandler::model() const
+{
+    return m_replica;
+}
+
+bool DBusHandler::isJoining() const
+{
+    return m_joining;
+}
+
+bool DBusHandler::isSettled() const
 {
-    setupDBusParameters( privateSession );
-    registerClass();
-    setupConnections();
-    feedTextEditor();
+    return !m_pipeline->queued() && m_batcher.isIdle() && !m_scheduler.size();
 }
 
+// A replica on a link never touches the bus; its connection stays unconnected.
+DBusHandler::DBusHandler( const QString &id, const SessionOptions &options, Edit *textEdit,
+              PeerLink *link )
+    : m_id( id ), m_isolated( options.isolated ), m_keeper( options.daemon ),
+      m_startedAt( options.startedAt ? options.startedAt : LatencyHistogram::now() ),
+      m_textEdit( textEdit ),
+      m_applier( textEdit ), m_scheduler( m_applier, frameInterval, applyBudget ),
+      m_replica( qHash( id ) ),
+      m_batcher( options.flushWindow, options.maxBatchOps, options.maxBatchSize ),
+      m_log( logEntries, logBytes ), m_history( undoDepth ),
+      m_blobs( options.isolated ? QString( "isolated" ) : options.session ),
+      m_link( linkFor( id, options, link ) ), QObject( textEdit )
+{
+    m_conn.reset( new QDBusConnection( m_link ? QDBusConnection( QString() )
+                          : QDBusConnection::sessionBus() ) );
+    setupMetrics();
+    setupPipeline();
+    connect( &m_batcher, &OpBatcher::frameReady, this, &DBusHandler::sendFrame );
+    m_applier.setWindow( options.viewWindow );
+    m_viewTimer.setSingleShot( true );
+    m_viewTimer.setInterval( viewSettle );
+    connect( &m_viewTimer, &QTimer::timeout, this, [this]() {
+        m_scheduler.flush();
+        m_applier.fit( m_replica );
+    } );
+    connect( &m_scheduler, &ApplyScheduler::cursorMoved, this, &DBusHandler::changeCursorPosition );
+    m_gapTimer.setSingleShot( true );
+    m_gapTimer.setInterval( options.gapTimeout );
+    connect( &m_gapTimer, &QTimer::timeout, this, &DBusHandler::gapExpired );
+    setupDBusParameters( options.session );
+    if ( m_link ) {
+        setupLink();
+    } else {
+        registerClass();
+        setupConnections( options.ring );
+        setupMembership();
+        setupSequencer( options.sequenced );
+    }
+
+    if ( !m_isolated && options.journaled ) {
+        m_journal.reset( new SessionJournal( options.session ) );
+        m_journalRetry.setInterval( journalRetry );
+        connect( &m_journalRetry, &QTimer::timeout, this, &DBusHandler::acquireJournal );
+        if ( !m_journal->isWriter() )
+            m_journalRetry.start();
+    }
+}
+
+// The last checkpoint is written in place, after the pipeline has finished
+// whatever it was doing.
 DBusHandler::~DBusHandler()
 {
+    m_batcher.flush();
+    m_pipeline->stop();
+    if ( m_journal && m_journal->isWriter() ) {
+        Snapshot snapshot;
+        snapshot.version = m_log.version();
+        snapshot.seen    = m_log.seen();
+        QDataStream out( &snapshot.model, QIODevice::WriteOnly );
+        out << m_replica;
+        m_journal->checkpoint( snapshot );
+    }
+    for ( const Transport *transport : { static_cast<Transport *>( m_bus.data() ),
+                         static_cast<Transport *>( m_ring.data() ),
+                         static_cast<Transport *>( m_link.data() ) } ) {
+        if ( transport && transport->latency().count() )
+            qInfo() << transport->name() << "latency" << qPrintable( transport->latency().summary() );
+    }
 }
 
 //----------prepare-----------------
-void DBusHandler::setupDBusParameters( const QString &privateSession )
+QString DBusHandler::interfaceName( const QString &session )
 {
-    m_objName = "/test";
+    return session.isEmpty() ? "test.session" : ( "test." + session );
+}
 
-    m_ifaceName   = privateSession.isEmpty() ? "test.session" : ( "test." + privateSession );
-    m_serviceName = privateSession.isEmpty() ? ( "test.session._" + m_id )
-                         : ( "test." + privateSession + "._" + m_id );
+// Each session has its own path, so the replicas of several sessions can
+// share one connection: "/test/session", "/test/abc".
+QString DBusHandler::objectPath( const QString &ifaceName )
+{
+    return "/" + QString( ifaceName ).replace( '.', '/' );
+}
+
+void DBusHandler::setupDBusParameters( const QString &privateSession )
+{
+    m_ifaceName   = interfaceName( privateSession );
+    m_serviceName = m_ifaceName + "._" + m_id;
 
     if ( m_isolated ) {
         m_serviceName = "test.isolated._" + m_id;
         m_ifaceName   = "test.isolated";
         m_rangedName  = m_serviceName;
     }
+    m_objName = objectPath( m_ifaceName );
 }
 
 void DBusHandler::registerClass()
@@ -43,181 +156,1260 @@ void DBusHandler::registerClass()
     if ( !m_conn->registerObject( m_objName, m_ifaceName, this,
                       QDBusConnection::ExportAllSlots ) ) {
         fprintf( stderr, "%s\n",
-             qPrintable( QDBusConnection::sessionBus().lastError().message() ) );
+             qPrintable( m_conn->lastError().message() ) );
         exit( 0 );
     }
 
     if ( !m_conn->registerService( m_serviceName ) ) {
         fprintf( stderr, "%s\n",
-             qPrintable( QDBusConnection::sessionBus().lastError().message() ) );
+             qPrintable( m_conn->lastError().message() ) );
         exit( 0 );
     }
 
-    m_iface.reset( new QDBusInterface( m_serviceName, m_objName, m_ifaceName,
-                       QDBusConnection::sessionBus() ) );
+    m_iface.reset( new QDBusInterface( m_serviceName, m_objName, m_ifaceName, *m_conn ) );
     if ( !m_iface->isValid() ) {
         fprintf( stderr, "%s\n",
-             qPrintable( QDBusConnection::sessionBus().lastError().message() ) );
+             qPrintable( m_conn->lastError().message() ) );
+        exit( 0 );
+    }
+}
+
+// Frames go through the shared-memory ring when asked for and available; the
+// bus stays subscribed for peers' frames too large for a ring slot.
+void DBusHandler::setupConnections( bool ring )
+{
+    m_bus.reset( new BusTransport( *m_conn, m_objName, m_ifaceName, m_rangedName ) );
+    connect( m_bus.data(), &Transport::frameReceived, this, &DBusHandler::syncFrame );
+
+    if ( ring && !m_isolated ) {
+        m_ring.reset( new RingTransport( m_ifaceName + ".ring" ) );
+        if ( m_ring->open() ) {
+            connect( m_ring.data(), &Transport::frameReceived, this, &DBusHandler::syncFrame );
+            connect( m_ring.data(), &Transport::framesLost, this, &DBusHandler::resync );
+        } else {
+            m_ring.reset();
+        }
+    }
+
+    m_metrics.attach( "transport.bus.latency.ns", &m_bus->latency() );
+    if ( m_ring )
+        m_metrics.attach( "transport.ring.latency.ns", &m_ring->latency() );
+}
+
+// A link brings the frames, the peers to join from and their snapshots by
+// itself; nothing of this replica is exported on the bus.
+void DBusHandler::setupLink()
+{
+    connect( m_link.data(), &Transport::frameReceived, this, &DBusHandler::syncFrame );
+    connect( m_link.data(), &Transport::framesLost, this, &DBusHandler::resync );
+    connect( m_link.data(), &PeerLink::snapshotRequested, this, &DBusHandler::publishSnapshot );
+    connect( m_link.data(), &PeerLink::snapshotReceived, this, &DBusHandler::snapshotReceived );
+    connect( m_link.data(), &PeerLink::ready, this, [this]() {
+        if ( m_joining )
+            joinNext();
+    } );
+    m_metrics.attach( "transport." + m_link->name() + ".latency.ns", &m_link->latency() );
+    if ( !m_link->open() ) {
+        fprintf( stderr, "can\'t reach the session over %s\n", qPrintable( m_link->name() ) );
         exit( 0 );
     }
+}
+
+void DBusHandler::setupMembership()
+{
+    if ( m_isolated )
+        return;
+
+    m_members.reset( new Membership( *m_conn, m_objName, m_ifaceName ) );
+    connect( m_members.data(), &Membership::announceRequested, this,
+         [this]() { m_members->announce( m_log.version() ); } );
+    connect( m_members.data(), &Membership::peerJoined, m_bus.data(), &BusTransport::follow );
+    connect( m_members.data(), &Membership::peerLeft, m_bus.data(), &BusTransport::unfollow );
+    connect( m_members.data(), &Membership::peerLeft, this, &DBusHandler::acquireJournal );
+    connect( m_members.data(), &Membership::settled, this, [this]() {
+        if ( m_joining )
+            joinNext();
+    } );
+    if ( !m_members->start() )
+        m_members.reset();
+
+    // Joiners go to a headless keeper first; it is never too busy to answer.
+    if ( m_keeper &&
+         !m_conn->interface()
+              ->registerService( keeperName(), QDBusConnectionInterface::QueueService,
+                     QDBusConnectionInterface::DontAllowReplacement )
+              .isValid() )
+        qInfo() << "can\'t register as keeper" << m_conn->interface()->lastError().message();
+}
+
+QString DBusHandler::keeperName() const
+{
+    return m_ifaceName + ".keeper";
+}
+
+void DBusHandler::setupSequencer( bool sequenced )
+{
+    if ( !sequenced || m_isolated )
+        return;
+
+    m_sequencer.reset( new Sequencer( *m_conn, m_ifaceName ) );
+    connect( m_sequencer.data(), &Sequencer::leaderChanged, this, &DBusHandler::leaderChanged );
+    if ( !m_sequencer->start() )
+        m_sequencer.reset();
+}
+
+void DBusHandler::setupMetrics()
+{
+    m_stats.framesSent	   = &m_metrics.counter( "frames.sent" );
+    m_stats.framesReceived = &m_metrics.counter( "frames.received" );
+    m_stats.selfEchoes	   = &m_metrics.counter( "frames.selfEchoes" );
+    m_stats.duplicates	   = &m_metrics.counter( "frames.duplicates" );
+    m_stats.undecodable	   = &m_metrics.counter( "frames.undecodable" );
+    m_stats.bytesSent	   = &m_metrics.counter( "bytes.sent" );
+    m_stats.bytesReceived  = &m_metrics.counter( "bytes.received" );
+    m_stats.opsSent	   = &m_metrics.counter( "ops.sent" );
+    m_stats.opsApplied	   = &m_metrics.counter( "ops.applied" );
+    m_stats.joins	   = &m_metrics.counter( "joins" );
+    m_stats.resyncs	   = &m_metrics.counter( "resyncs" );
+    m_stats.ordered	   = &m_metrics.counter( "order.assigned" );
+    m_stats.resubmitted	   = &m_metrics.counter( "order.resubmitted" );
+    m_stats.orderGaps	   = &m_metrics.counter( "order.gaps" );
+    m_stats.held	   = &m_metrics.counter( "frames.held" );
+    m_stats.gapsSkipped	   = &m_metrics.counter( "frames.gapsSkipped" );
+    m_stats.gapResyncs	   = &m_metrics.counter( "resyncs.gap" );
+    m_stats.shed	   = &m_metrics.counter( "inbound.shed" );
+    m_stats.streamed	   = &m_metrics.counter( "frames.streamed" );
+    m_stats.blobsStored	   = &m_metrics.counter( "blobs.stored" );
+    m_stats.blobsFetched   = &m_metrics.counter( "blobs.fetched" );
+    m_stats.blobsServed	   = &m_metrics.counter( "blobs.served" );
+    m_stats.sentSize	   = &m_metrics.histogram( "frame.sent.bytes" );
+    m_stats.receivedSize   = &m_metrics.histogram( "frame.received.bytes" );
+    m_stats.encode	   = &m_metrics.histogram( "frame.encode.ns" );
+    m_stats.decode	   = &m_metrics.histogram( "frame.decode.ns" );
+    m_stats.apply	   = &m_metrics.histogram( "frame.apply.ns" );
+    m_stats.join	   = &m_metrics.histogram( "join.ns" );
+    m_stats.snapshotEncode = &m_metrics.histogram( "snapshot.encode.ns" );
+    m_stats.snapshotDecode = &m_metrics.histogram( "snapshot.decode.ns" );
+    m_stats.checkpoint	   = &m_metrics.histogram( "journal.checkpoint.ns" );
+    m_stats.orderRoundtrip = &m_metrics.histogram( "order.roundtrip.ns" );
+    m_metrics.attach( "inbound.tick.ns", &m_scheduler.tickTime() );
+}
+
+void DBusHandler::setupPipeline()
+{
+    Pipeline::Timings timings;
+    timings.parse      = m_stats.decode;
+    timings.encode     = m_stats.snapshotEncode;
+    timings.decode     = m_stats.snapshotDecode;
+    timings.checkpoint = m_stats.checkpoint;
+    m_pipeline.reset( new Pipeline( timings ) );
+
+    connect( m_pipeline.data(), &Pipeline::parsed, this, &DBusHandler::frameParsed );
+    connect( m_pipeline.data(), &Pipeline::snapshotEncoded, this, &DBusHandler::snapshotEncoded );
+    connect( m_pipeline.data(), &Pipeline::snapshotLoaded, this, &DBusHandler::snapshotLoaded );
+    connect( m_pipeline.data(), &Pipeline::checkpointWritten, this,
+         &DBusHandler::checkpointWritten );
+}
+
+// Joins from the best peer without blocking the window, passing over the
+// peers that don't answer. The join waits for a link that is still reaching
+// its peers, and on the bus for the members to answer, so that they all
+// listen to this replica before it sends anything. A replica starting with
+// nobody to answer falls back to the journal. The snapshot is read on the
+// pipeline; frames that arrive meanwhile are held back and replayed after
+// it, and the seen table drops the ones it already contains.
+void DBusHandler::startJoin()
+{
+    if ( m_joining )
+        return;
+    m_joining	  = true;
+    m_joinStarted = LatencyHistogram::now();
+    m_stats.joins->add();
+    emit joinStarted();
+    if ( ( m_link && !m_link->isReady() ) || ( m_members && !m_members->isSettled() ) )
+        return;
+    joinNext();
+}
+
+// In sequenced mode the leader's log is the authoritative one; otherwise a
+// keeper daemon is preferred over whichever window is most up to date.
+QString DBusHandler::joinSource() const
+{
+    if ( m_link )
+        return m_link->bestPeer();
+    if ( !m_members )
+        return QString();
+    if ( m_sequencer && !m_sequencer->isLeader() &&
+         m_members->isAnswering( m_sequencer->leader() ) )
+        return m_sequencer->leader();
+
+    const QDBusReply<QString> keeper = m_conn->interface()->serviceOwner( keeperName() );
+    if ( keeper.isValid() && keeper.value() != m_conn->baseService() &&
+         m_members->isAnswering( keeper.value() ) )
+        return keeper.value();
+    return m_members->bestPeer();
+}
+
+void DBusHandler::joinNext()
+{
+    m_joinPeer = joinSource();
+    if ( m_joinPeer.isEmpty() ) {
+        if ( m_log.version() || !restoreJournal() )
+            finishJoin();
+        return;
+    }
+    if ( m_link ) {
+        m_link->requestSnapshot( m_joinPeer );
+        return;
+    }
+
+    QDBusPendingCallWatcher *watcher =
+        callAsync( m_joinPeer, "publishSnapshot", QVariantList() << m_id );
+    connect( watcher, &QDBusPendingCallWatcher::finished, this,
+         [this]( QDBusPendingCallWatcher *call ) {
+             call->deleteLater();
+             QDBusPendingReply<QString> key = *call;
+             if ( key.isError() || key.value().isEmpty() ) {
+                 snapshotLoaded( m_joinPeer, false, Snapshot(), m_replica );
+                 return;
+             }
+             m_pipeline->loadSnapshot( key.value(), m_replica );
+         } );
+}
+
+// A link's answer comes as bytes; one from a peer given up on meanwhile is
+// too late.
+void DBusHandler::snapshotReceived( const QString &peer, const QByteArray &bytes )
+{
+    if ( !m_joining || peer != m_joinPeer )
+        return;
+    if ( bytes.isEmpty() )
+        snapshotLoaded( peer, false, Snapshot(), m_replica );
+    else
+        m_pipeline->decodeSnapshot( peer, bytes, m_replica );
+}
+
+// Both a peer's snapshot and the journal end up here; the journal's comes
+// without a key.
+void DBusHandler::snapshotLoaded( const QString &key, bool ok, const Snapshot &snapshot,
+                  const ReplicatedText &model )
+{
+    if ( !m_joining )
+        return;
+    if ( key.isEmpty() ) {
+        if ( ok )
+            journalLoaded( snapshot, model );
+        finishJoin();
+        return;
+    }
+
+    const QString service = m_joinPeer;
+    if ( !ok ) {
+        qInfo() << "peer" << service << "didn't answer";
+        if ( m_link )
+            m_link->markFailed( service );
+        else
+            m_members->markFailed( service );
+        joinNext();
+        return;
+    }
+    restore( snapshot, model );
+    // A link hands the snapshot over whole and has no toolbar to pass on.
+    if ( m_link ) {
+        finishJoin();
+        return;
+    }
+
+    callAsync( service, "releaseSnapshot", QVariantList() << m_id )->deleteLater();
+    QDBusPendingCallWatcher *state = callAsync( service, "getCharState" );
+    connect( state, &QDBusPendingCallWatcher::finished, this,
+         [this]( QDBusPendingCallWatcher *call ) {
+             call->deleteLater();
+             QDBusPendingReply<QByteArray> reply = *call;
+             CharState state;
+             if ( !reply.isError() && WireFormat::decodeCharState( reply.value(), state ) ) {
+                 m_toolbarState = state;
+                 changeCursorPosition( "0", state.position );
+                 textColored( state.color );
+                 emit toolbarStateChanged();
+             }
+         } );
+    finishJoin();
+}
+
+// Frames held behind a gap may have been covered by the snapshot. A backlog
+// dropped while joining calls for another join.
+void DBusHandler::finishJoin()
+{
+    m_joining = false;
+    for ( ParsedFrame &frame : m_joinBuffer )
+        applyParsed( frame, true, false );
+    m_joinBuffer.clear();
+    for ( const QString &sender : m_held.keys() )
+        drainHeld( sender, false );
+    if ( m_heldCount )
+        m_gapTimer.start();
+    m_stats.join->record( LatencyHistogram::now() - m_joinStarted );
+    emit joined();
+
+    if ( m_resyncAfterJoin ) {
+        m_resyncAfterJoin = false;
+        startJoin();
+    }
+}
+
+QDBusPendingCallWatcher *DBusHandler::callAsync( const QString &serviceName,
+                         const QString &functionName,
+                         const QVariantList &args )
+{
+    QDBusMessage msg =
+        QDBusMessage::createMethodCall( serviceName, m_objName, m_ifaceName, functionName );
+    msg.setArguments( args );
+    return new QDBusPendingCallWatcher( m_conn->asyncCall( msg, callTimeout ), this );
+}
+//------------accept signals---------------
+
+// Frames are parsed on the pipeline and come back in the order they arrived
+// in, to be applied here or held back while joining.
+void DBusHandler::syncFrame( const QByteArray &bytes )
+{
+    QString sender;
+    quint32 seq;
+    m_stats.framesReceived->add();
+    m_stats.bytesReceived->add( bytes.size() );
+    m_stats.receivedSize->record( bytes.size() );
+    if ( WireFormat::kindOf( bytes ) == WireFormat::OrderedKind ) {
+        ordered( bytes );
+        return;
+    }
+    if ( !WireFormat::peekSender( bytes, sender, seq ) )
+        return;
+    // Only the ring hands a replica its own frames; the bus rules name peers.
+    if ( sender == m_id ) {
+        m_stats.selfEchoes->add();
+        return;
+    }
+    enqueue( bytes );
+}
+
+// Everything received and not applied yet counts against one bound. A
+// replica that falls that far behind drops the lot and resyncs once, rather
+// than working through stale frames one by one.
+void DBusHandler::enqueue( const QByteArray &bytes )
+{
+    if ( inboundDepth() >= maxInbound ) {
+        shed();
+        return;
+    }
+    ++m_inflight;
+    m_pipeline->parse( bytes );
+}
+
+int DBusHandler::inboundDepth() const
+{
+    return m_inflight - m_discard + m_joinBuffer.size() + m_heldCount;
+}
+
+void DBusHandler::shed()
+{
+    const int dropped = inboundDepth() + 1;
+    qInfo() << "dropping a backlog of" << dropped << "frames";
+    m_stats.shed->add( dropped );
+    m_discard = m_inflight;
+    m_joinBuffer.clear();
+    m_held.clear();
+    m_heldCount   = 0;
+    m_gapResynced = false;
+    m_gapTimer.stop();
+    if ( m_joining )
+        m_resyncAfterJoin = true;
+    else
+        resync( quint64( dropped ) );
+}
+
+void DBusHandler::frameParsed( const ParsedFrame &frame, bool ok )
+{
+    --m_inflight;
+    if ( m_discard ) {
+        --m_discard;
+        return;
+    }
+
+    ParsedFrame parsed = frame;
+    if ( !m_joining )
+        applyParsed( parsed, ok, true );
+    else if ( ok )
+        m_joinBuffer.append( parsed );
+    else
+        m_stats.undecodable->add();
+}
+
+void DBusHandler::resync( quint64 lost )
+{
+    qInfo() << lost << "frames lost, resyncing";
+    m_stats.resyncs->add();
+    startJoin();
+}
+
+// Frames handed over with a snapshot, parsed in place.
+void DBusHandler::applyFrame( const QByteArray &bytes )
+{
+    QString sender;
+    quint32 seq;
+    if ( !WireFormat::peekSender( bytes, sender, seq ) || sender == m_id )
+        return;
+    if ( m_log.isSeen( sender, seq ) ) {
+        m_stats.duplicates->add();
+        return;
+    }
 
-    qRegisterMetaType<CharInfo>( "CharInfo" );
-    qDBusRegisterMetaType<CharInfo>();
+    const qint64 decodeStarted = LatencyHistogram::now();
+    ParsedFrame parsed;
+    const bool ok = WireFormat::parseFrame( bytes, parsed );
+    m_stats.decode->record( LatencyHistogram::now() - decodeStarted );
+    applyParsed( parsed, ok, false );
 }
 
-void DBusHandler::setupConnections()
+// A frame ahead of its sender's next one waits for the frames in between,
+// which the other transport may still be delivering.
+void DBusHandler::applyParsed( ParsedFrame &parsed, bool ok, bool live )
 {
-    m_conn->connect( m_rangedName, m_objName, m_ifaceName, "cursorPosition", this,
-             SLOT( changeCursorPosition( QString, int ) ) );
-    m_conn->connect( m_rangedName, m_objName, m_ifaceName, "textChange", this,
-             SLOT( textChange( QString, QVariantList ) ) );
+    const SyncFrame &frame = parsed.frame;
+    if ( ok && frame.sender == m_id )
+        return;
+    if ( ok && m_log.isSeen( frame.sender, frame.seq ) ) {
+        m_stats.duplicates->add();
+        return;
+    }
+    if ( ok && frame.seq > m_log.lastSeq( frame.sender ) + 1 ) {
+        hold( parsed );
+        return;
+    }
+
+    if ( integrate( parsed, ok, live ) )
+        drainHeld( frame.sender, live );
 }
 
-void DBusHandler::feedTextEditor()
+void DBusHandler::hold( const ParsedFrame &parsed )
 {
-    QString service = getServiceName();
-    if ( !service.isEmpty() ) {
-        if ( callFunction( service, "loadToSharedMemory" ).first().toBool() ) {
-            loadFromMemory();
-            callFunction( service, "detachSharedMemory" );
-            QVariantList lst = callFunction( service, "getCharState" );
-            if ( !lst.isEmpty() ) {
-                m_toolbarState = lst;
-                textColored( lst.at( COLOR ).toString() );
-                changeCursorPosition( "0", lst.at( POSITION ).toInt() );
+    QMap<quint32, ParsedFrame> &frames = m_held[parsed.frame.sender];
+    if ( !frames.contains( parsed.frame.seq ) )
+        ++m_heldCount;
+    frames.insert( parsed.frame.seq, parsed );
+    m_stats.held->add();
+
+    if ( m_heldCount > maxHeld && !m_joining ) {
+        m_stats.gapResyncs->add();
+        resync( quint64( m_heldCount ) );
+    } else if ( !m_gapTimer.isActive() ) {
+        m_gapTimer.start();
+    }
+}
+
+// Applies the held frames of sender that are now next in line; with force,
+// all of them, giving up on the missing ones.
+void DBusHandler::drainHeld( const QString &sender, bool live, bool force )
+{
+    auto it = m_held.find( sender );
+    while ( it != m_held.end() && !it->isEmpty() ) {
+        const quint32 last = m_log.lastSeq( sender );
+        const quint32 seq  = it->firstKey();
+        if ( seq > last + 1 && !force )
+            break;
+
+        ParsedFrame parsed = it->take( seq );
+        --m_heldCount;
+        if ( seq > last ) {
+            if ( seq > last + 1 )
+                m_stats.gapsSkipped->add();
+            integrate( parsed, true, live );
+        }
+        it = m_held.find( sender );
+    }
+    if ( it != m_held.end() && it->isEmpty() )
+        m_held.erase( it );
+    if ( !m_heldCount ) {
+        m_gapTimer.stop();
+        m_gapResynced = false;
+    }
+}
+
+// A gap that outlived its timeout is resynced once; if the snapshot didn't
+// have the missing frames either, nobody does, and the held ones go in.
+void DBusHandler::gapExpired()
+{
+    if ( !m_heldCount || m_joining )
+        return;
+    if ( !m_gapResynced ) {
+        m_gapResynced = true;
+        m_stats.gapResyncs->add();
+        resync( quint64( m_heldCount ) );
+        return;
+    }
+    m_gapResynced = false;
+    for ( const QString &sender : m_held.keys() )
+        drainHeld( sender, false, true );
+}
+
+bool DBusHandler::integrate( ParsedFrame &parsed, bool ok, bool live )
+{
+    const SyncFrame &frame = parsed.frame;
+
+    // A frame that names a format we never got means we missed frames.
+    if ( !ok || !WireFormat::resolveFrame( parsed, m_replica.formats() ) ) {
+        m_stats.undecodable->add();
+        qInfo() << "dropped undecodable frame";
+        if ( live )
+            resync( 1 );
+        return false;
+    }
+    record( frame.sender, frame.seq, parsed.bytes );
+
+    const qint64 started = LatencyHistogram::now();
+    QVector<SyncOp> ops;
+    for ( const SyncOp &op : frame.ops )
+        ops += m_replica.integrate( op );
+    m_history.rebase( ops );
+    wantBlobs( frame.ops );
+    show( ops );
+    const qint64 nanos = LatencyHistogram::now() - started;
+    m_stats.apply->record( nanos );
+    m_stats.opsApplied->add( ops.size() );
+    emit frameApplied( frame.sender, frame.seq, nanos );
+
+    if ( live && frame.cursor >= 0 && m_textEdit )
+        m_scheduler.moveCursor( frame.sender, frame.cursor );
+    if ( live && ( frame.streamLeft > 0 || m_streams.contains( frame.sender ) ) )
+        streamed( frame );
+    return true;
+}
+
+void DBusHandler::streamed( const SyncFrame &frame )
+{
+    m_stats.streamed->add();
+    qint64 &done = m_streams[frame.sender];
+    for ( const SyncOp &op : frame.ops )
+        done += op.text.size();
+    emit streamProgress( frame.sender, done, frame.streamLeft );
+    if ( !frame.streamLeft )
+        m_streams.remove( frame.sender );
+}
+
+void DBusHandler::sendLocalOps( const QVector<SyncOp> &ops )
+{
+    m_history.record( applyLocal( ops ) );
+}
+
+// Puts local ops into the model and the outgoing frames. Returns the ops
+// that revert them, read off the model before each one goes in.
+QVector<SyncOp> DBusHandler::applyLocal( const QVector<SyncOp> &ops )
+{
+    QVector<SyncOp> inverse;
+    for ( const SyncOp &op : ops ) {
+        QVector<SyncOp> sent;
+        QVector<SyncOp> undo;
+        switch ( op.type ) {
+        case SyncOp::Insert: {
+            sent = m_replica.localInsert( op.pos, op.text, op.format );
+            SyncOp remove;
+            remove.type   = SyncOp::Remove;
+            remove.pos    = op.pos;
+            remove.length = op.text.size();
+            if ( !sent.isEmpty() )
+                undo.append( remove );
+            break;
+        }
+        case SyncOp::Remove:
+            undo = m_replica.contents( op.pos, op.length );
+            sent = m_replica.localRemove( op.pos, op.length );
+            break;
+        case SyncOp::Format:
+        case SyncOp::Merge:
+            undo = m_replica.contents( op.pos, op.length );
+            for ( SyncOp &format : undo ) {
+                format.type = SyncOp::Format;
+                format.text.clear();
             }
+            sent = op.type == SyncOp::Format
+                       ? m_replica.localFormat( op.pos, op.length, op.format )
+                       : m_replica.localMerge( op.pos, op.length, op.format );
+            break;
         }
+        m_batcher.append( sent );
+        inverse = undo + inverse;
     }
+    return inverse;
 }
-//------------accept signals---------------
 
-void DBusHandler::textChange( const QString &id, const QVariantList &list )
+void DBusHandler::undo()
 {
-    if ( id != this->m_id ) {
-        CharInfo info = qdbus_cast<CharInfo>( list.at( 0 ) );
-        m_textEdit->clear();
-        m_textEdit->insertHtml( info.text );
-        QTextCursor cursor( m_textEdit->textCursor() );
-        cursor.setPosition( info.pos );
-        m_textEdit->setTextCursor( cursor );
+    if ( !m_textEdit || m_joining )
+        return;
+    flushInbound();
+    m_history.undone( revert( m_history.takeUndo() ) );
+}
+
+void DBusHandler::redo()
+{
+    if ( !m_textEdit || m_joining )
+        return;
+    flushInbound();
+    m_history.redone( revert( m_history.takeRedo() ) );
+}
+
+bool DBusHandler::canUndo() const
+{
+    return m_history.canUndo();
+}
+
+bool DBusHandler::canRedo() const
+{
+    return m_history.canRedo();
+}
+
+// The editor shows the step the way it shows peers' ops, and the cursor goes
+// where the step ended. A step outside a large document's window brings the
+// window over it first.
+QVector<SyncOp> DBusHandler::revert( const QVector<SyncOp> &ops )
+{
+    if ( ops.isEmpty() )
+        return ops;
+    m_applier.reveal( m_replica, ops.first().pos );
+    const QVector<SyncOp> inverse = applyLocal( ops );
+    m_applier.apply( ops );
+
+    const SyncOp &last = ops.last();
+    const int length   = m_textEdit->document()->characterCount() - 1;
+    const int pos	   = last.pos + ( last.type == SyncOp::Insert ? last.length : 0 );
+    QTextCursor cursor( m_textEdit->document() );
+    cursor.setPosition( qBound( 0, pos - m_textEdit->windowStart(), length ) );
+    m_textEdit->setTextCursor( cursor );
+    m_textEdit->ensureCursorVisible();
+    viewMoved();
+    return inverse;
+}
+
+void DBusHandler::sendCursor( int pos )
+{
+    m_batcher.setCursor( m_textEdit->windowStart() + pos );
+}
+
+// The editor scrolled or changed; a large document's window may have to
+// follow once it settles.
+void DBusHandler::viewMoved()
+{
+    m_viewTimer.start();
+}
+
+OpBatcher::Counters DBusHandler::batchCounters() const
+{
+    return m_batcher.counters();
+}
+
+int DBusHandler::streamLeft() const
+{
+    return m_batcher.streamLeft();
+}
+
+//-----blobs---------
+QUrl DBusHandler::storeBlob( const QByteArray &bytes )
+{
+    const QByteArray hash = m_blobs.put( bytes );
+    if ( hash.isEmpty() )
+        return QUrl();
+    m_stats.blobsStored->add();
+    return BlobStore::urlOf( hash );
+}
+
+QByteArray DBusHandler::blob( const QByteArray &hash )
+{
+    const QByteArray bytes = m_blobs.map( hash );
+    if ( bytes.isEmpty() )
+        requestBlob( hash );
+    return bytes;
+}
+
+// Called by peers missing an image.
+QByteArray DBusHandler::fetchBlob( const QString &hash )
+{
+    const QByteArray bytes = m_blobs.map( hash.toLatin1() );
+    if ( bytes.isEmpty() ) {
+        if ( calledFromDBus() )
+            sendErrorReply( QDBusError::InvalidArgs, "no such blob" );
+        return QByteArray();
+    }
+    m_stats.blobsServed->add();
+    return bytes;
+}
+
+// Images come in by name. Whatever isn't on this host is fetched as soon as
+// an op names it, so a keeper without an editor has it to hand on too.
+void DBusHandler::wantBlobs( const QVector<SyncOp> &ops )
+{
+    for ( const SyncOp &op : ops ) {
+        if ( op.type != SyncOp::Insert || !op.text.contains( QChar::ObjectReplacementCharacter ) )
+            continue;
+        const QTextCharFormat format = SyncOp::unpackFormat( op.format );
+        if ( !format.isImageFormat() )
+            continue;
+        const QByteArray hash = BlobStore::hashIn( QUrl( format.toImageFormat().name() ) );
+        if ( !hash.isEmpty() && !m_blobs.contains( hash ) )
+            requestBlob( hash );
+    }
+}
+
+void DBusHandler::requestBlob( const QByteArray &hash )
+{
+    if ( !m_members || m_fetching.contains( hash ) )
+        return;
+    m_fetching.insert( hash );
+
+    QStringList owners;
+    for ( const Membership::Peer &peer : m_members->peers() )
+        owners << peer.owner;
+    fetchFrom( hash, owners );
+}
+
+// Asks the peers in turn until one has the blob, and checks it is the one
+// asked for before storing it.
+void DBusHandler::fetchFrom( const QByteArray &hash, QStringList owners )
+{
+    if ( owners.isEmpty() ) {
+        qInfo() << "no peer has blob" << hash;
+        m_fetching.remove( hash );
+        return;
     }
+    const QString owner = owners.takeFirst();
+    QDBusPendingCallWatcher *watcher =
+        callAsync( owner, "fetchBlob", QVariantList() << QString::fromLatin1( hash ) );
+    connect( watcher, &QDBusPendingCallWatcher::finished, this,
+         [this, hash, owners]( QDBusPendingCallWatcher *call ) {
+             call->deleteLater();
+             QDBusPendingReply<QByteArray> reply = *call;
+             if ( reply.isError() || BlobStore::hashOf( reply.value() ) != hash ) {
+                 fetchFrom( hash, owners );
+                 return;
+             }
+             m_fetching.remove( hash );
+             if ( m_blobs.put( reply.value() ).isEmpty() )
+                 return;
+             m_stats.blobsFetched->add();
+             emit blobArrived( hash );
+         } );
+}
+//-----blobs---------
+
+quint32 DBusHandler::lastSentSeq() const
+{
+    return m_sendSeq;
+}
+
+quint64 DBusHandler::bytesSent() const
+{
+    return m_stats.bytesSent->value();
 }
 
+const Metrics &DBusHandler::metrics() const
+{
+    return m_metrics;
+}
+
+void DBusHandler::sendFrame( const QVector<SyncOp> &ops, int cursor )
+{
+    SyncFrame frame;
+    frame.sender     = m_id;
+    frame.seq        = ++m_sendSeq;
+    frame.ops        = ops;
+    frame.cursor     = cursor;
+    frame.streamLeft = m_batcher.streamLeft();
+
+    const qint64 started   = LatencyHistogram::now();
+    const QByteArray bytes = WireFormat::encodeFrame( frame, m_replica.formats() );
+    m_stats.encode->record( LatencyHistogram::now() - started );
+    record( m_id, frame.seq, bytes );
+
+    m_stats.framesSent->add();
+    m_stats.opsSent->add( ops.size() );
+    m_stats.bytesSent->add( bytes.size() );
+    m_stats.sentSize->record( bytes.size() );
+    if ( m_sequencer )
+        submit( bytes );
+    else
+        broadcast( bytes );
+}
+
+void DBusHandler::broadcast( const QByteArray &bytes )
+{
+    if ( m_link )
+        m_link->send( bytes );
+    else if ( !m_ring || !m_ring->send( bytes ) )
+        m_bus->send( bytes );
+}
+
+//-----sequencing---------
+// An own frame only counts as sent once the leader has numbered it; until
+// then it is kept, to be handed to whoever leads next.
+void DBusHandler::submit( const QByteArray &bytes )
+{
+    QString sender;
+    quint32 seq;
+    if ( !WireFormat::peekSender( bytes, sender, seq ) )
+        return;
+    if ( m_sequencer->isLeader() ) {
+        sequence( bytes );
+        return;
+    }
+
+    m_unordered.insert( seq, qMakePair( bytes, LatencyHistogram::now() ) );
+    if ( m_sequencer->leader().isEmpty() )
+        return;
+    QDBusMessage msg = QDBusMessage::createMethodCall( m_sequencer->leader(), m_objName,
+                               m_ifaceName, "submitFrame" );
+    msg << bytes;
+    m_conn->send( msg );
+}
+
+// Called by followers on the leader.
+void DBusHandler::submitFrame( const QByteArray &bytes )
+{
+    if ( m_sequencer && m_sequencer->isLeader() )
+        sequence( bytes );
+}
+
+// Numbers a frame and sends it to everybody. The leader applies the frames of
+// others as they pass; the seen table skips one submitted twice across a
+// change of leader.
+void DBusHandler::sequence( const QByteArray &bytes )
+{
+    QString sender;
+    quint32 seq;
+    if ( !WireFormat::peekSender( bytes, sender, seq ) )
+        return;
+    if ( sender != m_id && m_log.isSeen( sender, seq ) )
+        return;
+
+    broadcast( m_sequencer->order( bytes ) );
+    m_stats.ordered->add();
+    if ( sender != m_id )
+        enqueue( bytes );
+}
+
+// A numbered frame from the leader. Frames of others go on to the pipeline
+// in order; an own one is done with. A gap that grows too wide is given up on
+// for a resync from the leader.
+void DBusHandler::ordered( const QByteArray &bytes )
+{
+    QString term;
+    quint64 order;
+    QByteArray frame;
+    if ( !m_sequencer || !WireFormat::decodeOrdered( bytes, term, order, frame ) )
+        return;
+    if ( m_sequencer->isLeader() ) {
+        // Numbered by a leader before us, and maybe not seen by everybody.
+        if ( term != m_conn->baseService() )
+            sequence( frame );
+        return;
+    }
+
+    QVector<QByteArray> due;
+    if ( !m_sequencer->receive( term, order, frame, due ) ) {
+        const int held = m_sequencer->held();
+        m_stats.orderGaps->add();
+        m_sequencer->reset();
+        resync( quint64( held ) );
+        return;
+    }
+    for ( const QByteArray &next : due ) {
+        QString sender;
+        quint32 seq;
+        if ( !WireFormat::peekSender( next, sender, seq ) )
+            continue;
+        if ( sender != m_id ) {
+            enqueue( next );
+            continue;
+        }
+        auto it = m_unordered.find( seq );
+        if ( it != m_unordered.end() )
+            m_stats.orderRoundtrip->record( LatencyHistogram::now() - it->second );
+        while ( !m_unordered.isEmpty() && m_unordered.firstKey() <= seq )
+            m_unordered.erase( m_unordered.begin() );
+    }
+}
+
+// Own frames still waiting go to the new leader, or get numbered here along
+// with whatever was held back behind a gap when this replica takes over.
+void DBusHandler::leaderChanged( const QString &leader )
+{
+    if ( leader.isEmpty() )
+        return;
+    qInfo() << "session leader is now" << ( m_sequencer->isLeader() ? "this replica" : leader );
+
+    if ( m_sequencer->isLeader() ) {
+        for ( const QByteArray &frame : m_sequencer->takeHeld() )
+            sequence( frame );
+    }
+    const QList<QPair<QByteArray, qint64>> own = m_unordered.values();
+    m_unordered.clear();
+    for ( const QPair<QByteArray, qint64> &frame : own ) {
+        m_stats.resubmitted->add();
+        submit( frame.first );
+    }
+}
+//-----sequencing---------
+
 void DBusHandler::changeCursorPosition( const QString &id, const int &pos )
 {
-    if ( id != this->m_id ) {
+    if ( m_textEdit && id != this->m_id ) {
         QTextCursor cursor( m_textEdit->textCursor() );
-        cursor.setPosition( pos );
+        const int length = m_textEdit->document()->characterCount() - 1;
+        cursor.setPosition( qBound( 0, pos - m_textEdit->windowStart(), length ) );
         m_textEdit->setTextCursor( cursor );
     }
 }
 
 //-----text format---------
+// Takes over the color a peer types in; what is in the document stays as it
+// is, and nothing is sent.
 void DBusHandler::textColored( const QString &c )
 {
     QTextCharFormat fmt;
     QColor col( c );
     fmt.setForeground( col );
-    mergeFormatOnWordOrSelection( fmt );
+    setCurrentFormat( fmt );
 }
 
+// The format of the text typed next, at a cursor without a selection, so the
+// document itself doesn't change.
+void DBusHandler::setCurrentFormat( const QTextCharFormat &format )
+{
+    if ( !m_textEdit )
+        return;
+    QTextCursor cursor( m_textEdit->textCursor() );
+    cursor.clearSelection();
+    cursor.mergeCharFormat( format );
+    m_textEdit->setTextCursor( cursor );
+}
+
+// The delta goes out as one op over the range instead of the resulting
+// formats of every fragment, which the editor would otherwise report.
 void DBusHandler::mergeFormatOnWordOrSelection( const QTextCharFormat &format )
 {
+    if ( !m_textEdit )
+        return;
+    flushInbound();
     QTextCursor cursor( m_textEdit->textCursor() );
     if ( !cursor.hasSelection() )
         cursor.select( QTextCursor::WordUnderCursor );
+
+    m_textEdit->setRemoteUpdate( true );
     cursor.mergeCharFormat( format );
     m_textEdit->mergeCurrentCharFormat( format );
+    m_textEdit->setRemoteUpdate( false );
+
+    if ( cursor.hasSelection() ) {
+        SyncOp op;
+        op.type	  = SyncOp::Merge;
+        op.pos	  = m_textEdit->windowStart() + cursor.selectionStart();
+        op.length = cursor.selectionEnd() - cursor.selectionStart();
+        op.format = SyncOp::packFormat( format );
+        sendLocalOps( QVector<SyncOp>() << op );
+    }
 }
 //-----text format---------
 
-QVariantList DBusHandler::loadToSharedMemory()
+// Publishes the model for one joiner under a key of its own, so concurrent
+// joins of any session never collide. The reply waits for the pipeline to
+// encode the snapshot: the cached model goes out again while the op log still
+// covers everything applied since it was taken, otherwise a copy of the model
+// as it is now gets serialized.
+QString DBusHandler::publishSnapshot( const QString &joiner )
 {
-    QBuffer buffer;
-    buffer.open( QBuffer::ReadWrite );
-    QDataStream out( &buffer );
-    out << m_textEdit->toHtml();
-    int size = buffer.size();
+    m_batcher.flush();
 
-    if ( !m_sharedMemory.create( size ) ) {
-        qInfo() << "can\'t load sharedmemory";
-        return QVariantList() << false;
+    Snapshot snapshot;
+    if ( m_hasSnapshot && m_log.tailSince( m_snapshotVersion, snapshot.tail ) &&
+         snapshot.tail.size() <= snapshotRefresh ) {
+        snapshot.version = m_snapshotVersion;
+        snapshot.seen	 = m_snapshotSeen;
+        snapshot.model	 = m_snapshotModel;
+    } else {
+        snapshot.tail.clear();
+        snapshot.version = m_log.version();
+        snapshot.seen	 = m_log.seen();
     }
-    m_sharedMemory.lock();
-    char *to	 = (char *)m_sharedMemory.data();
-    const char *from = buffer.data().data();
-    memcpy( to, from, qMin( m_sharedMemory.size(), size ) );
-    m_sharedMemory.unlock();
-    return QVariantList() << true;
+
+    Publishing publishing;
+    publishing.generation = m_generation;
+    if ( calledFromDBus() ) {
+        setDelayedReply( true );
+        publishing.call = message();
+    }
+    m_publishing.insert( joiner, publishing );
+    m_pipeline->encodeSnapshot( joiner, snapshot, m_replica );
+    return QString();
 }
 
-void DBusHandler::loadFromMemory()
+void DBusHandler::snapshotEncoded( const QString &joiner, const Snapshot &snapshot,
+                   const QByteArray &bytes )
 {
-    if ( !m_sharedMemory.attach() ) {
-        qInfo() << "Unable to attach to shared memory segment";
+    const Publishing publishing = m_publishing.take( joiner );
+    if ( snapshot.tail.isEmpty() && publishing.generation == m_generation )
+        cacheSnapshot( snapshot );
+    if ( m_link ) {
+        m_link->answerSnapshot( joiner, bytes );
+        return;
+    }
+
+    const QDBusMessage &call = publishing.call;
+    const QString key	     = m_ifaceName + ".snapshot." + joiner;
+    m_published.remove( joiner );
+    QSharedPointer<QSharedMemory> memory( new QSharedMemory( key ) );
+    if ( !memory->create( bytes.size() ) ) {
+        qInfo() << "can\'t publish snapshot" << memory->errorString();
+        if ( call.type() == QDBusMessage::MethodCallMessage )
+            m_conn->send( call.createErrorReply( QDBusError::Failed, memory->errorString() ) );
         return;
     }
+    memory->lock();
+    memcpy( memory->data(), bytes.constData(), bytes.size() );
+    memory->unlock();
+
+    m_published.insert( joiner, memory );
+    QTimer::singleShot( publishTimeout, this, [this, joiner]() { releaseSnapshot( joiner ); } );
+    if ( call.type() == QDBusMessage::MethodCallMessage )
+        m_conn->send( call.createReply( key ) );
+}
+
+bool DBusHandler::releaseSnapshot( const QString &joiner )
+{
+    return m_published.remove( joiner ) > 0;
+}
+
+void DBusHandler::cacheSnapshot( const Snapshot &snapshot )
+{
+    m_snapshotModel   = snapshot.model;
+    m_snapshotVersion = snapshot.version;
+    m_snapshotSeen    = snapshot.seen;
+    m_hasSnapshot     = true;
+
+    if ( lcSnapshot().isDebugEnabled() && m_textEdit ) {
+        const FormatTable &formats = m_replica.formats();
+        qCDebug( lcSnapshot ) << "snapshot" << snapshot.model.size() << "bytes:" << m_replica.size()
+                      << "chars in" << m_replica.runCount() << "runs," << formats.size()
+                      << "formats in" << formats.bytes() << "bytes; html"
+                      << m_textEdit->toHtml().toUtf8().size() << "bytes";
+    }
+}
 
-    QBuffer buffer;
-    QString data;
-    QDataStream in( &buffer );
+// The model comes read from the snapshot on the pipeline. On a resync the
+// peer may not have our latest frames yet; they are replayed over its model.
+void DBusHandler::restore( const Snapshot &snapshot, const ReplicatedText &model )
+{
+    const QVector<QByteArray> own = m_log.framesFrom( m_id, snapshot.seen.value( m_id ) );
 
-    m_sharedMemory.lock();
-    buffer.setData( (char *)m_sharedMemory.constData(), m_sharedMemory.size() );
-    buffer.open( QBuffer::ReadOnly );
-    in >> data;
-    m_sharedMemory.unlock();
+    m_replica = model;
+    m_log.reset( snapshot.version, snapshot.seen );
+    m_history.clear();
+    m_hasSnapshot = false;
+    ++m_generation;
 
-    m_sharedMemory.detach();
+    m_scheduler.clear();
+    m_applier.load( m_replica );
 
-    m_textEdit->setHtml( data );
+    for ( const QByteArray &frame : snapshot.tail )
+        applyFrame( frame );
+    replayOwn( own );
 }
 
-QVariantList DBusHandler::detachSharedMemory()
+void DBusHandler::replayOwn( const QVector<QByteArray> &frames )
 {
-    if ( m_sharedMemory.isAttached() ) {
-        m_sharedMemory.detach();
-        return QVariantList() << true;
+    for ( const QByteArray &bytes : frames ) {
+        SyncFrame frame;
+        if ( !WireFormat::decodeFrame( bytes, frame, m_replica.formats() ) ||
+             m_log.isSeen( frame.sender, frame.seq ) )
+            continue;
+        record( frame.sender, frame.seq, bytes );
+
+        QVector<SyncOp> ops;
+        for ( const SyncOp &op : frame.ops )
+            ops += m_replica.integrate( op );
+        show( ops );
     }
-    return QVariantList() << false;
 }
 
-QVariantList DBusHandler::getCharState()
+// The editor gets the ops on the next display frame, in the order the model
+// took them.
+void DBusHandler::show( const QVector<SyncOp> &ops )
 {
-    QTextCharFormat format( m_textEdit->textCursor().charFormat() );
-    QVariantList lst;
-    lst << QVariant( format.font().bold() );
-    lst << QVariant( format.font().underline() );
-    lst << QVariant( format.font().italic() );
-    lst << QVariant( QString::number( format.font().pointSizeF() ) );
-    lst << QVariant( format.font().toString() );
-    lst << QVariant( format.foreground().color().name() );
-    lst << QVariant( m_textEdit->textCursor().position() );
-    return lst;
+    if ( m_textEdit )
+        m_scheduler.queue( ops );
 }
-//-------------------------------------
-QString DBusHandler::getServiceName() const
+
+void DBusHandler::flushInbound()
 {
-    if ( m_isolated )
-        return QString();
+    m_scheduler.flush();
+}
 
-    auto registeredNames = m_conn->interface()->registeredServiceNames().value();
-    for ( auto &service : registeredNames ) {
-        if ( service.startsWith( m_ifaceName ) ) {
-            if ( service != this->m_serviceName ) {
-                return service;
-            }
-        }
+//-----journal---------
+// The first instance of a session rebuilds it from the journal and compacts
+// what it replayed into a fresh checkpoint.
+bool DBusHandler::restoreJournal()
+{
+    if ( !m_journal )
+        return false;
+    m_pipeline->loadJournal( m_journal.data(), m_replica );
+    return true;
+}
+
+void DBusHandler::journalLoaded( const Snapshot &snapshot, const ReplicatedText &model )
+{
+    m_restoring = true;
+    restore( snapshot, model );
+    m_restoring = false;
+
+    qInfo() << "restored" << m_replica.size() << "chars," << snapshot.model.size()
+        << "checkpoint bytes and" << snapshot.tail.size() << "logged frames in"
+        << ( LatencyHistogram::now() - m_joinStarted ) / 1000000 << "ms";
+
+    if ( !snapshot.tail.isEmpty() )
+        checkpointJournal();
+}
+
+// An instance that joined while another one held the journal takes over once
+// that one exits, starting from its own up-to-date model.
+void DBusHandler::acquireJournal()
+{
+    if ( m_journal && m_journal->acquire() ) {
+        m_journalRetry.stop();
+        checkpointJournal();
     }
-    return QString();
 }
 
+// The pipeline writes the checkpoint from a copy of the model; the log
+// restarts under its epoch once it is on disk, keeping the frames recorded
+// meanwhile.
+void DBusHandler::checkpointJournal()
+{
+    if ( !m_journal || !m_journal->isWriter() || m_checkpointGeneration >= 0 )
+        return;
+    m_checkpointGeneration = m_generation;
+
+    Snapshot snapshot;
+    snapshot.version = m_log.version();
+    snapshot.seen    = m_log.seen();
+    m_pipeline->writeCheckpoint( m_journal->checkpointPath(), m_journal->epoch() + 1, snapshot,
+                     m_replica );
+}
+
+// Until the log restarts it stays one epoch behind the checkpoint, which a
+// restart replays whole; after a restore the op log can't tell what the
+// checkpoint missed, so a fresh one is taken instead.
+void DBusHandler::checkpointWritten( quint64 epoch, bool ok, const Snapshot &snapshot )
+{
+    const bool stale	   = m_checkpointGeneration != m_generation;
+    m_checkpointGeneration = -1;
+    if ( stale ) {
+        checkpointJournal();
+        return;
+    }
+    cacheSnapshot( snapshot );
+
+    QVector<QByteArray> tail;
+    if ( ok && m_journal && m_journal->isWriter() && m_journal->epoch() + 1 == epoch &&
+         m_log.tailSince( snapshot.version, tail ) )
+        m_journal->restartLog( epoch, tail );
+}
+
+void DBusHandler::record( const QString &sender, quint32 seq, const QByteArray &bytes )
+{
+    m_log.record( sender, seq, bytes );
+    if ( !m_journal || m_restoring )
+        return;
+
+    m_journal->append( bytes );
+    if ( m_journal->wantsCheckpoint() )
+        checkpointJournal();
+}
+//-----journal---------
+
+// A keeper has no toolbar to hand over.
+QByteArray DBusHandler::getCharState()
+{
+    if ( !m_textEdit ) {
+        if ( calledFromDBus() )
+            sendErrorReply( QDBusError::NotSupported, "headless replica" );
+        return QByteArray();
+    }
+    QTextCharFormat format( m_textEdit->textCursor().charFormat() );
+    CharState state;
+    state.bold	    = format.font().bold();
+    state.underline = format.font().underline();
+    state.italic    = format.font().italic();
+    state.size	    = QString::number( format.font().pointSizeF() );
+    state.font	    = format.font().toString();
+    state.color	    = format.foreground().color().name();
+    state.position  = m_textEdit->windowStart() + m_textEdit->textCursor().position();
+    return WireFormat::encodeCharState( state );
+}
+
+// Everything this replica counts, as one JSON object for --stats.
+QString DBusHandler::getStats()
+{
+    const OpBatcher::Counters batch = m_batcher.counters();
+    QJsonObject batcher;
+    batcher["opsIn"]	     = double( batch.opsIn );
+    batcher["opsMerged"]     = double( batch.opsMerged );
+    batcher["opsCancelled"]  = double( batch.opsCancelled );
+    batcher["cursorsIn"]     = double( batch.cursorsIn );
+    batcher["cursorsFolded"] = double( batch.cursorsFolded );
+    batcher["frames"]	     = double( batch.frames );
+    batcher["sizeFlushes"]   = double( batch.sizeFlushes );
+    batcher["chunks"]	     = double( batch.chunks );
+
+    const ApplyScheduler::Counters paced = m_scheduler.counters();
+    QJsonObject scheduler;
+    scheduler["frames"]	       = double( paced.frames );
+    scheduler["ticks"]	       = double( paced.ticks );
+    scheduler["overBudget"]    = double( paced.overBudget );
+    scheduler["cursorsIn"]     = double( paced.cursorsIn );
+    scheduler["cursorsMerged"] = double( paced.cursorsMerged );
+    scheduler["opsDropped"]    = double( paced.dropped );
+
+    QJsonObject stats  = m_metrics.toJson();
+    stats["id"]	       = m_id;
+    stats["session"]   = m_ifaceName;
+    stats["transport"] = m_link ? m_link->name() : m_ring ? m_ring->name() : m_bus->name();
+    stats["version"]   = double( m_log.version() );
+    stats["joining"]   = m_joining;
+    stats["peers"]     = m_members ? m_members->size() : 0;
+    stats["keeper"]    = m_keeper;
+    stats["leader"]    = m_sequencer ? m_sequencer->isLeader() : false;
+    stats["order"]     = m_sequencer ? double( m_sequencer->position() ) : 0.0;
+    stats["orderHeld"] = m_sequencer ? m_sequencer->held() : 0;
+    stats["unordered"] = m_unordered.size();
+
+    QJsonObject inbound;
+    inbound["depth"]    = inboundDepth();
+    inbound["parsing"]  = m_inflight - m_discard;
+    inbound["held"]     = m_heldCount;
+    inbound["buffered"] = m_joinBuffer.size();
+    inbound["unshown"]  = m_scheduler.size();
+    inbound["limit"]    = maxInbound;
+    stats["inbound"]    = inbound;
+    stats["chars"]     = m_replica.size();
+    stats["runs"]      = m_replica.runCount();
+    stats["formats"]   = m_replica.formats().size();
+    stats["uptimeNs"]  = double( LatencyHistogram::now() - m_startedAt );
+    stats["batcher"]   = batcher;
+    stats["scheduler"] = scheduler;
+    return QString::fromUtf8( QJsonDocument( stats ).toJson( QJsonDocument::Compact ) );
+}
+//-------------------------------------
 void DBusHandler::sendMessageWithID( const QString &signalName ) const
 {
-    QDBusConnection connection( QDBusConnection::sessionBus() );
     QDBusMessage msg = QDBusMessage::createSignal( m_objName, m_ifaceName, signalName );
     msg << m_id;
-    connection.send( msg );
+    m_conn->send( msg );
 }
 
 void DBusHandler::sendMessageWithID( int arg1, int arg2, const QString &signalName ) const
@@ -226,11 +1418,3 @@ void DBusHandler::sendMessageWithID( int arg1, int arg2, const QString &signalNa
     msg << m_id << arg1 << arg2;
     m_conn->send( msg );
 }
-
-QVariantList DBusHandler::callFunction( const QString &serviceName,
-                    const QString &functionName ) const
-{
-    QDBusInterface _iface( serviceName, m_objName, m_ifaceName, QDBusConnection::sessionBus() );
-    QDBusReply<QVariantList> lst = _iface.call( functionName );
-    return lst;
-}
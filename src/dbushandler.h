@@ -2,33 +2,125 @@
 #define DBUSHANDLER_H
 
 #include "Structs.h"
+#include "applyscheduler.h"
+#include "blobstore.h"
+#include "journal.h"
+#include "localtransport.h"
+#include "membership.h"
+#include "metrics.h"
+#include "opapplier.h"
+#include "opbatcher.h"
+#include "oplog.h"
+#include "pipeline.h"
+#include "replicatedtext.h"
+#include "ringtransport.h"
+#include "sequencer.h"
+#include "transport.h"
+#include "undohistory.h"
+#include "wireformat.h"
 #include <QDBusArgument>
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
+#include <QDBusContext>
 #include <QDBusInterface>
 #include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
 #include <QDBusReply>
 #include <QDebug>
 #include <QMetaType>
 #include <QSharedMemory>
+#include <QSet>
+#include <QSharedPointer>
 #include <QTextEdit>
+#include <QTimer>
 
 class Edit;
-class DBusHandler : public QObject
+class DBusHandler : public QObject, protected QDBusContext
 {
     Q_OBJECT
     QScopedPointer<QDBusConnection> m_conn;
     QScopedPointer<QDBusInterface> m_iface;
-    QStringList m_names;
+    QScopedPointer<Membership> m_members;
+    QScopedPointer<Sequencer> m_sequencer;
 
     Edit *m_textEdit;
-    QSharedMemory m_sharedMemory;
+    OpApplier m_applier;
+    ApplyScheduler m_scheduler;
+    ReplicatedText m_replica;
+    OpBatcher m_batcher;
+    OpLog m_log;
+    UndoHistory m_history;
+    quint32 m_sendSeq = 0;
+
+    BlobStore m_blobs;
+    QSet<QByteArray> m_fetching;
+
+    Metrics m_metrics;
+    struct {
+        Metrics::Counter *framesSent, *framesReceived, *selfEchoes, *duplicates, *undecodable;
+        Metrics::Counter *bytesSent, *bytesReceived, *opsSent, *opsApplied, *joins, *resyncs;
+        Metrics::Counter *ordered, *resubmitted, *orderGaps;
+        Metrics::Counter *held, *gapsSkipped, *gapResyncs, *shed, *streamed;
+        Metrics::Counter *blobsStored, *blobsFetched, *blobsServed;
+        LatencyHistogram *sentSize, *receivedSize, *encode, *decode, *apply, *join;
+        LatencyHistogram *snapshotEncode, *snapshotDecode, *checkpoint, *orderRoundtrip;
+    } m_stats;
+    qint64 m_joinStarted = 0;
+
+    QScopedPointer<BusTransport> m_bus;
+    QScopedPointer<RingTransport> m_ring;
+    QScopedPointer<PeerLink> m_link;
+
+    QScopedPointer<SessionJournal> m_journal;
+    QTimer m_journalRetry;
+    QTimer m_viewTimer;
+    bool m_restoring = false;
+
+    // Work on the pipeline is tagged with the generation it started in; a
+    // restore bumps it, since it renumbers the op log.
+    QScopedPointer<Pipeline> m_pipeline;
+    int m_generation	       = 0;
+    int m_checkpointGeneration = -1;
+    struct Publishing {
+        QDBusMessage call;
+        int generation = -1;
+    };
+    QHash<QString, Publishing> m_publishing;
+
+    QHash<QString, QSharedPointer<QSharedMemory>> m_published;
+    QByteArray m_snapshotModel;
+    quint64 m_snapshotVersion = 0;
+    QHash<QString, quint32> m_snapshotSeen;
+    bool m_hasSnapshot = false;
+
+    // Own frames the leader hasn't numbered yet, by sequence number, with the
+    // time they were first submitted.
+    QMap<quint32, QPair<QByteArray, qint64>> m_unordered;
+
+    bool m_joining = false;
+    QString m_joinPeer;
+    QVector<ParsedFrame> m_joinBuffer;
+    bool m_resyncAfterJoin = false;
+
+    // Inbound frames besides the join buffer: on the pipeline, of which the
+    // first m_discard belong to a dropped backlog, and held back behind a gap
+    // in their sender's sequence numbers.
+    int m_inflight = 0;
+    int m_discard  = 0;
+    QHash<QString, QMap<quint32, ParsedFrame>> m_held;
+    int m_heldCount    = 0;
+    bool m_gapResynced = false;
+    QTimer m_gapTimer;
+
+    // Characters received so far of every peer's insert still streaming in.
+    QHash<QString, qint64> m_streams;
 
     const QString m_id;
     const bool m_isolated;
-    bool cameOutside = false;
+    const bool m_keeper;
+    const qint64 m_startedAt;
 
-    QVariantList m_toolbarState;
+    CharState m_toolbarState;
 
     QString m_objName;
     QString m_ifaceName;
@@ -36,13 +128,45 @@ class DBusHandler : public QObject
     QString m_rangedName;
 
 public:
-    DBusHandler( const QString &id, const QString &privateSession, bool isolated,
-             Edit *textEdit );
+    // Without an editor the replica runs headless, as a keeper. A link, which
+    // the replica takes over, carries the session instead of D-Bus.
+    DBusHandler( const QString &id, const SessionOptions &options, Edit *textEdit,
+             PeerLink *link = nullptr );
     ~DBusHandler();
 
-    QVariantList getToolbarState() const;
+    static QString interfaceName( const QString &session );
+    static QString objectPath( const QString &ifaceName );
+
+    CharState getToolbarState() const;
+    const ReplicatedText &model() const;
+    bool isJoining() const;
+    // Nothing of the replica's own work is under way; see inboundDepth for
+    // what peers have sent it.
+    bool isSettled() const;
+    int inboundDepth() const;
+    void sendLocalOps( const QVector<SyncOp> &ops );
+    // Reverts this replica's own last edit, or the last revert, and sends
+    // that on like any edit.
+    void undo();
+    void redo();
+    bool canUndo() const;
+    bool canRedo() const;
+    void sendCursor( int pos );
+    void viewMoved();
+    OpBatcher::Counters batchCounters() const;
+    int streamLeft() const;
+    // Puts the remote changes still waiting for a display frame into the
+    // editor, before a local edit is diffed against the model.
+    void flushInbound();
+    // An image put in the session's store, and the url the document names it by.
+    QUrl storeBlob( const QByteArray &bytes );
+    // A stored image's bytes; one not here yet is fetched and announced by
+    // blobArrived.
+    QByteArray blob( const QByteArray &hash );
+    quint32 lastSentSeq() const;
+    quint64 bytesSent() const;
+    const Metrics &metrics() const;
 
-    QVariantList callFunction( const QString &serviceName, const QString &functionName ) const;
     void sendMessageWithID( const QString &signalName ) const;
     void sendMessageWithID( int arg1, int arg2, const QString &signalName ) const;
 
@@ -64,22 +188,83 @@ public:
 public:
     void mergeFormatOnWordOrSelection( const QTextCharFormat &format );
 
+signals:
+    void joinStarted();
+    void joined();
+    void toolbarStateChanged();
+    // A peer's frame was applied, costing nanos on the GUI thread.
+    void frameApplied( const QString &sender, quint32 seq, qint64 nanos );
+    // A peer's large insert is coming in; left is 0 once it is complete.
+    void streamProgress( const QString &sender, qint64 done, qint64 left );
+    void blobArrived( const QByteArray &hash );
+
 public slots:
-    void textChange( const QString &id, const QVariantList &list );
+    void startJoin();
     void changeCursorPosition( const QString &id, const int &pos );
     void textColored( const QString &c );
 
-    QVariantList loadToSharedMemory();
-    QVariantList detachSharedMemory();
-    QVariantList getCharState();
+    QString publishSnapshot( const QString &joiner );
+    bool releaseSnapshot( const QString &joiner );
+    QByteArray getCharState();
+    QString getStats();
+    void submitFrame( const QByteArray &bytes );
+    QByteArray fetchBlob( const QString &hash );
+
+private slots:
+    void syncFrame( const QByteArray &bytes );
+    void resync( quint64 lost );
+    void leaderChanged( const QString &leader );
+    void frameParsed( const ParsedFrame &frame, bool ok );
+    void gapExpired();
+    void snapshotEncoded( const QString &joiner, const Snapshot &snapshot, const QByteArray &bytes );
+    void snapshotReceived( const QString &peer, const QByteArray &bytes );
+    void snapshotLoaded( const QString &key, bool ok, const Snapshot &snapshot,
+                 const ReplicatedText &model );
+    void checkpointWritten( quint64 epoch, bool ok, const Snapshot &snapshot );
 
 private:
-    QString getServiceName() const;
+    void setupMembership();
+    void setupSequencer( bool sequenced );
+    void setupMetrics();
+    void joinNext();
+    void finishJoin();
+    QDBusPendingCallWatcher *callAsync( const QString &serviceName, const QString &functionName,
+                        const QVariantList &args = QVariantList() );
     void setupDBusParameters( const QString &privateSession );
     void registerClass();
-    void setupConnections();
-    void feedTextEditor();
-    void loadFromMemory();
+    void setupConnections( bool ring );
+    void setupLink();
+    void setupPipeline();
+    void restore( const Snapshot &snapshot, const ReplicatedText &model );
+    bool restoreJournal();
+    void journalLoaded( const Snapshot &snapshot, const ReplicatedText &model );
+    void acquireJournal();
+    void checkpointJournal();
+    void record( const QString &sender, quint32 seq, const QByteArray &bytes );
+    void cacheSnapshot( const Snapshot &snapshot );
+    void applyFrame( const QByteArray &bytes );
+    void applyParsed( ParsedFrame &parsed, bool ok, bool live );
+    bool integrate( ParsedFrame &parsed, bool ok, bool live );
+    void streamed( const SyncFrame &frame );
+    void show( const QVector<SyncOp> &ops );
+    void setCurrentFormat( const QTextCharFormat &format );
+    QVector<SyncOp> applyLocal( const QVector<SyncOp> &ops );
+    QVector<SyncOp> revert( const QVector<SyncOp> &ops );
+    void wantBlobs( const QVector<SyncOp> &ops );
+    void requestBlob( const QByteArray &hash );
+    void fetchFrom( const QByteArray &hash, QStringList owners );
+    void enqueue( const QByteArray &bytes );
+    void shed();
+    void hold( const ParsedFrame &parsed );
+    void drainHeld( const QString &sender, bool live, bool force = false );
+    void replayOwn( const QVector<QByteArray> &frames );
+    void sendFrame( const QVector<SyncOp> &ops, int cursor );
+    void broadcast( const QByteArray &bytes );
+    void submit( const QByteArray &bytes );
+    void sequence( const QByteArray &bytes );
+    void ordered( const QByteArray &bytes );
+    QString joinSource() const;
+    QString keeperName() const;
 };
 
 #endif // DBUSHANDLER_H
@@ -1,50 +1,314 @@
 #include "edit.h"
 
-void Edit::setHandler( DBusHandler *value )
+namespace
+{
+void appendPiece( QVector<SyncOp> &ops, int type, int pos, const QString &text,
+          const QTextCharFormat &fmt, int from, int to )
 {
-    if ( !m_handler )
-        m_handler = value;
+    const int start = qMax( pos, from );
+    const int end   = qMin( pos + text.length(), to );
+    if ( start >= end )
+        return;
+
+    const QByteArray format = SyncOp::packFormat( fmt );
+    if ( !ops.isEmpty() ) {
+        SyncOp &last = ops.last();
+        if ( last.format == format && last.pos + last.length == start ) {
+            last.length += end - start;
+            if ( type == SyncOp::Insert )
+                last.text += text.mid( start - pos, end - start );
+            return;
+        }
+    }
+
+    SyncOp op;
+    op.type   = type;
+    op.pos    = start;
+    op.length = end - start;
+    if ( type == SyncOp::Insert )
+        op.text = text.mid( start - pos, end - start );
+    op.format = format;
+    ops.append( op );
 }
+} // namespace
 
-void Edit::sendHtml() const
+// The handler keeps the undo history; the document's would hold peers'
+// changes too.
+void Edit::setHandler( DBusHandler *value )
 {
-    QVariantList arg = prepareCharInfo();
     if ( m_handler )
-        m_handler->sendMessageWithID( arg, "textChange" );
+        return;
+    m_handler = value;
+    document()->setUndoRedoEnabled( false );
+    QObject::connect( m_handler, &DBusHandler::blobArrived, this, &Edit::showBlob );
+}
+
+void Edit::setRemoteUpdate( bool value )
+{
+    m_remoteUpdate = value;
+}
+
+int Edit::windowStart() const
+{
+    return m_windowStart;
+}
+
+bool Edit::isWindowed() const
+{
+    return m_windowed;
+}
+
+void Edit::setWindow( int start, bool windowed )
+{
+    m_windowStart = start;
+    m_windowed	  = windowed;
 }
 
 Edit::Edit( QWidget *parent ) : QTextEdit( parent )
 {
-    QObject::connect( this, &QTextEdit::textChanged, this, &Edit::textChange );
+    QObject::connect( document(), &QTextDocument::contentsChange, this, &Edit::contentsChange );
+    QObject::connect( verticalScrollBar(), &QScrollBar::valueChanged, this, [this]() {
+        if ( m_handler && m_windowed )
+            m_handler->viewMoved();
+    } );
+}
+
+// Remote changes still waiting for a display frame go in before anything the
+// user does can change the document, which is then diffed against the model.
+bool Edit::event( QEvent *e )
+{
+    if ( undoKey( e ) )
+        return true;
+    switch ( e->type() ) {
+    case QEvent::KeyPress:
+    case QEvent::ShortcutOverride:
+    case QEvent::InputMethod:
+        if ( m_handler )
+            m_handler->flushInbound();
+        break;
+    default:
+        break;
+    }
+    return QTextEdit::event( e );
+}
+
+bool Edit::viewportEvent( QEvent *e )
+{
+    switch ( e->type() ) {
+    case QEvent::MouseButtonPress:
+    case QEvent::ContextMenu:
+    case QEvent::Drop:
+        if ( m_handler )
+            m_handler->flushInbound();
+        break;
+    default:
+        break;
+    }
+    return QTextEdit::viewportEvent( e );
+}
+
+bool Edit::undoKey( QEvent *e )
+{
+    if ( !m_handler || ( e->type() != QEvent::KeyPress && e->type() != QEvent::ShortcutOverride ) )
+        return false;
+    QKeyEvent *key  = static_cast<QKeyEvent *>( e );
+    const bool undo = key->matches( QKeySequence::Undo );
+    if ( !undo && !key->matches( QKeySequence::Redo ) )
+        return false;
+
+    e->accept();
+    if ( e->type() == QEvent::KeyPress && !isReadOnly() ) {
+        if ( undo )
+            m_handler->undo();
+        else
+            m_handler->redo();
+    }
+    return true;
+}
+
+// The menu's Undo and Redo go to the handler's history as well.
+void Edit::contextMenuEvent( QContextMenuEvent *e )
+{
+    QMenu *menu = createStandardContextMenu( e->pos() );
+    for ( QAction *action : menu->actions() ) {
+        if ( !m_handler || isReadOnly() )
+            break;
+        if ( action->objectName() == "edit-undo" ) {
+            action->setEnabled( m_handler->canUndo() );
+            QObject::connect( action, &QAction::triggered, m_handler, &DBusHandler::undo );
+        } else if ( action->objectName() == "edit-redo" ) {
+            action->setEnabled( m_handler->canRedo() );
+            QObject::connect( action, &QAction::triggered, m_handler, &DBusHandler::redo );
+        }
+    }
+    menu->exec( e->globalPos() );
+    delete menu;
 }
 
 void Edit::cursorChanged() const
 {
     if ( m_handler )
-        m_handler->sendMessageWithID( textCursor().position(), "cursorPosition" );
+        m_handler->sendCursor( textCursor().position() );
 }
 
-void Edit::textChange()
+void Edit::contentsChange( int position, int charsRemoved, int charsAdded )
 {
-    if ( hasFocus() || cameOutside ) {
-        cameOutside = false;
-        sendHtml();
+    const int shownLength = m_windowLength;
+    const int newLength	  = document()->characterCount() - 1;
+    m_windowLength	  = newLength;
+    if ( m_remoteUpdate || !m_handler )
+        return;
+
+    // QTextDocument sometimes reports the whole document or counts the final
+    // paragraph separator, so clamp against the replicated copy of the text.
+    const ReplicatedText &model = m_handler->model();
+    const int oldLength		= m_windowed ? shownLength : model.size();
+    int removed			= qBound( 0, charsRemoved, oldLength - position );
+    int added			= qBound( 0, charsAdded, newLength - position );
+
+    if ( oldLength - removed + added != newLength ) {
+        const QString before = model.text( m_windowStart, oldLength );
+        const QString after  = textRange( 0, newLength );
+        const int common     = qMin( oldLength, newLength );
+        position	     = 0;
+        while ( position < common && before.at( position ) == after.at( position ) )
+            ++position;
+        int suffix = 0;
+        while ( suffix < common - position &&
+            before.at( oldLength - suffix - 1 ) == after.at( newLength - suffix - 1 ) )
+            ++suffix;
+        removed = oldLength - position - suffix;
+        added	= newLength - position - suffix;
+    }
+
+    const QString inserted = textRange( position, added );
+    const bool formatOnly =
+        removed == added && model.text( m_windowStart + position, removed ) == inserted;
+
+    QVector<SyncOp> ops;
+    if ( formatOnly ) {
+        ops = fragmentOps( SyncOp::Format, position, added );
+    } else {
+        if ( removed > 0 ) {
+            SyncOp op;
+            op.type   = SyncOp::Remove;
+            op.pos    = position;
+            op.length = removed;
+            ops.append( op );
+        }
+        ops += fragmentOps( SyncOp::Insert, position, added );
     }
+
+    if ( ops.isEmpty() )
+        return;
+    for ( SyncOp &op : ops )
+        op.pos += m_windowStart;
+    m_handler->sendLocalOps( ops );
+    m_handler->viewMoved();
 }
 
-void Edit::dropEvent( QDropEvent *e )
+//-------------images--------------------------------
+bool Edit::canInsertFromMimeData( const QMimeData *source ) const
 {
-    QTextEdit::dropEvent( e );
-    cameOutside = true;
-    textChange();
+    return source->hasImage() || QTextEdit::canInsertFromMimeData( source );
+}
+
+// Pasted and dropped images go into the session's blob store; the document,
+// and so every op, names them by hash.
+void Edit::insertFromMimeData( const QMimeData *source )
+{
+    if ( m_handler )
+        m_handler->flushInbound();
+
+    QVector<QByteArray> images;
+    if ( m_handler && source->hasImage() ) {
+        QByteArray bytes;
+        QBuffer buffer( &bytes );
+        buffer.open( QIODevice::WriteOnly );
+        if ( qvariant_cast<QImage>( source->imageData() ).save( &buffer, "PNG" ) )
+            images.append( bytes );
+    } else if ( m_handler && source->hasUrls() ) {
+        for ( const QUrl &url : source->urls() ) {
+            QFile file( url.toLocalFile() );
+            if ( !url.isLocalFile() || QImageReader::imageFormat( url.toLocalFile() ).isEmpty() ||
+                 !file.open( QIODevice::ReadOnly ) ) {
+                images.clear();
+                break;
+            }
+            images.append( file.readAll() );
+        }
+    }
+    if ( images.isEmpty() ) {
+        QTextEdit::insertFromMimeData( source );
+        return;
+    }
+
+    QTextCursor cursor = textCursor();
+    for ( const QByteArray &bytes : images ) {
+        QImage image;
+        const QUrl url = image.loadFromData( bytes ) ? m_handler->storeBlob( bytes ) : QUrl();
+        if ( url.isEmpty() )
+            continue;
+        document()->addResource( QTextDocument::ImageResource, url, image );
+        QTextImageFormat format;
+        format.setName( url.toString() );
+        cursor.insertImage( format );
+    }
+    setTextCursor( cursor );
+}
+
+QVariant Edit::loadResource( int type, const QUrl &name )
+{
+    const QByteArray hash = BlobStore::hashIn( name );
+    if ( type != QTextDocument::ImageResource || hash.isEmpty() || !m_handler )
+        return QTextEdit::loadResource( type, name );
+
+    QImage image;
+    if ( image.loadFromData( m_handler->blob( hash ) ) )
+        return image;
+    return QVariant();
+}
+
+// A fetched image takes the place of the empty frame it was laid out with.
+void Edit::showBlob( const QByteArray &hash )
+{
+    QImage image;
+    if ( !image.loadFromData( m_handler->blob( hash ) ) )
+        return;
+    document()->addResource( QTextDocument::ImageResource, BlobStore::urlOf( hash ), image );
+
+    const bool remote = m_remoteUpdate;
+    m_remoteUpdate    = true;
+    document()->markContentsDirty( 0, document()->characterCount() );
+    m_remoteUpdate = remote;
 }
 
 //---------------------------------------------------
 
-QVariantList Edit::prepareCharInfo() const
+QVector<SyncOp> Edit::fragmentOps( int type, int position, int length ) const
+{
+    QVector<SyncOp> ops;
+    const int end = position + length;
+
+    QTextBlock block = document()->findBlock( position );
+    for ( ; block.isValid() && block.position() < end; block = block.next() ) {
+        for ( QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it ) {
+            const QTextFragment fragment = it.fragment();
+            appendPiece( ops, type, fragment.position(), fragment.text(),
+                     fragment.charFormat(), position, end );
+        }
+        appendPiece( ops, type, block.position() + block.length() - 1,
+                 QString( QChar::ParagraphSeparator ), block.charFormat(), position, end );
+    }
+    return ops;
+}
+
+QString Edit::textRange( int position, int length ) const
 {
-    CharInfo charInfo;
-    charInfo.text = toHtml();
-    charInfo.pos  = textCursor().position();
-    return QVariantList() << QVariant::fromValue( charInfo );
+    if ( length <= 0 )
+        return QString();
+    QTextCursor cursor( document() );
+    cursor.setPosition( position );
+    cursor.setPosition( position + length, QTextCursor::KeepAnchor );
+    return cursor.selectedText();
 }
@@ -4,36 +4,58 @@
 #include "Structs.h"
 #include "dbushandler.h"
 #include <QBuffer>
+#include <QContextMenuEvent>
 #include <QDebug>
+#include <QFile>
+#include <QImage>
+#include <QImageReader>
 #include <QKeyEvent>
+#include <QMenu>
 #include <QMimeData>
 #include <QMouseEvent>
 #include <QObject>
+#include <QScrollBar>
+#include <QTextBlock>
 #include <QTextEdit>
 
-struct CharInfo;
-
 class Edit : public QTextEdit
 {
     Q_OBJECT
 
     DBusHandler *m_handler = nullptr;
-    bool cameOutside = false;
+    bool m_remoteUpdate = false;
+
+    // A large document shows only the model's characters from m_windowStart
+    // on; m_windowLength is how many as of the last change.
+    int m_windowStart  = 0;
+    int m_windowLength = 0;
+    bool m_windowed    = false;
 
 public:
     Edit( QWidget *parent = nullptr );
     ~Edit() = default;
     void setHandler( DBusHandler *value );
-    void sendHtml() const;
+    void setRemoteUpdate( bool value );
+
+    int windowStart() const;
+    bool isWindowed() const;
+    void setWindow( int start, bool windowed );
 
 protected:
-    void dropEvent(QDropEvent *e) override;
+    bool event( QEvent *e ) override;
+    bool viewportEvent( QEvent *e ) override;
+    void contextMenuEvent( QContextMenuEvent *e ) override;
+    bool canInsertFromMimeData( const QMimeData *source ) const override;
+    void insertFromMimeData( const QMimeData *source ) override;
+    QVariant loadResource( int type, const QUrl &name ) override;
 
 private:
-    QVariantList prepareCharInfo() const;
+    void showBlob( const QByteArray &hash );
+    bool undoKey( QEvent *e );
     void cursorChanged() const;
-    void textChange();
-
+    void contentsChange( int position, int charsRemoved, int charsAdded );
+    QVector<SyncOp> fragmentOps( int type, int position, int length ) const;
+    QString textRange( int position, int length ) const;
 };
 
 #endif // EDIT_H
@@ -0,0 +1,76 @@
+#include "formattable.h"
+#include "Structs.h"
+#include <QCryptographicHash>
+#include <QtEndian>
+
+quint64 FormatTable::idOf( const QByteArray &format )
+{
+    const QByteArray digest = QCryptographicHash::hash( format, QCryptographicHash::Sha1 );
+    return qFromLittleEndian<quint64>( reinterpret_cast<const uchar *>( digest.constData() ) );
+}
+
+int FormatTable::intern( const QByteArray &format )
+{
+    auto it = m_byFormat.constFind( format );
+    if ( it != m_byFormat.constEnd() )
+        return it.value();
+
+    const int index = m_formats.size();
+    m_formats.append( format );
+    m_ids.append( idOf( format ) );
+    m_announced.append( false );
+    m_unpacked.append( QTextCharFormat() );
+    m_byFormat.insert( format, index );
+    m_byId.insert( m_ids.last(), index );
+    m_bytes += format.size();
+    return index;
+}
+
+// -1 for a format this replica has never seen.
+int FormatTable::indexOf( quint64 id ) const
+{
+    return m_byId.value( id, -1 );
+}
+
+int FormatTable::size() const
+{
+    return m_formats.size();
+}
+
+qint64 FormatTable::bytes() const
+{
+    return m_bytes;
+}
+
+quint64 FormatTable::id( int index ) const
+{
+    return m_ids.at( index );
+}
+
+const QByteArray &FormatTable::format( int index ) const
+{
+    return m_formats.at( index );
+}
+
+QTextCharFormat FormatTable::charFormat( int index ) const
+{
+    QTextCharFormat &format = m_unpacked[index];
+    if ( !format.isValid() )
+        format = SyncOp::unpackFormat( m_formats.at( index ) );
+    return format;
+}
+
+QVector<QByteArray> FormatTable::formats() const
+{
+    return m_formats;
+}
+
+// True the first time this replica sends the format, which is when it goes
+// out in full.
+bool FormatTable::announce( int index )
+{
+    if ( m_announced.at( index ) )
+        return false;
+    m_announced[index] = true;
+    return true;
+}
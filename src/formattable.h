@@ -0,0 +1,41 @@
+#ifndef FORMATTABLE_H
+#define FORMATTABLE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QTextCharFormat>
+#include <QVector>
+
+// Session-wide table of the distinct character formats. Each packed format is
+// stored once and known locally by a small index; peers refer to it by an id
+// derived from its content, so every replica agrees on ids without
+// coordination. A sender includes a format in full only the first time it
+// uses it, even one a peer spelled out before: frames of different senders
+// may arrive in any order. Snapshots carry the whole table.
+class FormatTable
+{
+    QVector<QByteArray> m_formats;
+    QVector<quint64> m_ids;
+    QVector<bool> m_announced;
+    QHash<QByteArray, int> m_byFormat;
+    QHash<quint64, int> m_byId;
+    mutable QVector<QTextCharFormat> m_unpacked;
+    qint64 m_bytes = 0;
+
+public:
+    static quint64 idOf( const QByteArray &format );
+
+    int intern( const QByteArray &format );
+    int indexOf( quint64 id ) const;
+
+    int size() const;
+    qint64 bytes() const;
+    quint64 id( int index ) const;
+    const QByteArray &format( int index ) const;
+    QTextCharFormat charFormat( int index ) const;
+    QVector<QByteArray> formats() const;
+
+    bool announce( int index );
+};
+
+#endif // FORMATTABLE_H
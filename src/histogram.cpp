@@ -0,0 +1,98 @@
+#include "histogram.h"
+#include <QDeadlineTimer>
+#include <QtAlgorithms>
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+// Monotonic clock shared by every process on the host, so a timestamp taken
+// by the sender can be compared with one taken by the receiver.
+qint64 LatencyHistogram::now()
+{
+    return QDeadlineTimer::current( Qt::PreciseTimer ).deadlineNSecs();
+}
+
+void LatencyHistogram::record( qint64 nanos )
+{
+    const quint64 value = nanos > 0 ? quint64( nanos ) : 0;
+    m_buckets[bucketOf( value )].fetch_add( 1, std::memory_order_relaxed );
+    m_count.fetch_add( 1, std::memory_order_relaxed );
+    m_sum.fetch_add( value, std::memory_order_relaxed );
+
+    quint64 seen = m_max.load( std::memory_order_relaxed );
+    while ( value > seen && !m_max.compare_exchange_weak( seen, value ) ) {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for ( std::atomic<quint64> &bucket : m_buckets )
+        bucket.store( 0 );
+    m_count.store( 0 );
+    m_sum.store( 0 );
+    m_max.store( 0 );
+}
+
+quint64 LatencyHistogram::count() const
+{
+    return m_count.load();
+}
+
+quint64 LatencyHistogram::max() const
+{
+    return m_max.load();
+}
+
+quint64 LatencyHistogram::mean() const
+{
+    const quint64 total = m_count.load();
+    return total ? m_sum.load() / total : 0;
+}
+
+quint64 LatencyHistogram::percentile( double p ) const
+{
+    const quint64 total = m_count.load();
+    if ( !total )
+        return 0;
+
+    const quint64 rank = qMax<quint64>( 1, quint64( p / 100.0 * total + 0.5 ) );
+    quint64 seen       = 0;
+    for ( int i = 0; i < Buckets; ++i ) {
+        seen += m_buckets[i].load( std::memory_order_relaxed );
+        if ( seen >= rank )
+            return qMin( bucketUpper( i ), m_max.load() );
+    }
+    return m_max.load();
+}
+
+QString LatencyHistogram::summary() const
+{
+    return QString( "n=%1 mean=%2us p50=%3us p90=%4us p99=%5us max=%6us" )
+        .arg( count() )
+        .arg( mean() / 1000.0, 0, 'f', 1 )
+        .arg( percentile( 50 ) / 1000.0, 0, 'f', 1 )
+        .arg( percentile( 90 ) / 1000.0, 0, 'f', 1 )
+        .arg( percentile( 99 ) / 1000.0, 0, 'f', 1 )
+        .arg( max() / 1000.0, 0, 'f', 1 );
+}
+
+int LatencyHistogram::bucketOf( quint64 value )
+{
+    if ( value < ( 1u << SubBits ) )
+        return int( value );
+    const int exponent = 63 - qCountLeadingZeroBits( value );
+    const int mantissa = int( ( value >> ( exponent - SubBits ) ) & ( ( 1u << SubBits ) - 1 ) );
+    return ( ( exponent - SubBits + 1 ) << SubBits ) + mantissa;
+}
+
+quint64 LatencyHistogram::bucketUpper( int bucket )
+{
+    if ( bucket < ( 1 << SubBits ) )
+        return quint64( bucket );
+    const int exponent	 = ( bucket >> SubBits ) + SubBits - 1;
+    const quint64 lower	 = quint64( ( 1 << SubBits ) | ( bucket & ( ( 1 << SubBits ) - 1 ) ) )
+                  << ( exponent - SubBits );
+    return lower + ( quint64( 1 ) << ( exponent - SubBits ) ) - 1;
+}
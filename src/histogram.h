@@ -0,0 +1,38 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <QString>
+#include <atomic>
+
+// Log-linear histogram of durations in nanoseconds: 16 sub-buckets per power
+// of two, so any value is within about 6% of its bucket bound. Recording is
+// lock-free and may happen from any thread.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    static qint64 now();
+
+    void record( qint64 nanos );
+    void reset();
+    quint64 count() const;
+    quint64 max() const;
+    quint64 mean() const;
+    quint64 percentile( double p ) const;
+    QString summary() const;
+
+private:
+    static const int SubBits = 4;
+    static const int Buckets = ( 64 - SubBits + 1 ) << SubBits;
+
+    std::atomic<quint64> m_buckets[Buckets];
+    std::atomic<quint64> m_count;
+    std::atomic<quint64> m_sum;
+    std::atomic<quint64> m_max;
+
+    static int bucketOf( quint64 value );
+    static quint64 bucketUpper( int bucket );
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,282 @@
+#include "journal.h"
+#include "wireformat.h"
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtEndian>
+
+namespace
+{
+const quint32 logMagic	      = 0x4c4e4a53; // "SJNL"
+const quint32 checkpointMagic = 0x504b4353; // "SCKP"
+const quint32 journalVersion  = 1;
+
+// magic, version, epoch
+const int fileHeader   = 16;
+// size, checksum
+const int recordHeader = 8;
+
+const qint64 growStep	       = 4 * 1024 * 1024;
+const int checkpointRecords    = 4096;
+const qint64 checkpointLogSize = 16 * 1024 * 1024;
+
+void putHeader( uchar *out, quint32 magic, quint64 epoch )
+{
+    qToLittleEndian<quint32>( magic, out );
+    qToLittleEndian<quint32>( journalVersion, out + 4 );
+    qToLittleEndian<quint64>( epoch, out + 8 );
+}
+
+bool getHeader( const uchar *in, qint64 size, quint32 magic, quint64 &epoch )
+{
+    if ( size < fileHeader || qFromLittleEndian<quint32>( in ) != magic ||
+         qFromLittleEndian<quint32>( in + 4 ) != journalVersion )
+        return false;
+    epoch = qFromLittleEndian<quint64>( in + 8 );
+    return true;
+}
+
+quint32 checksum( const uchar *data, quint32 size )
+{
+    // Never zero, so a zeroed record header can't pass for a record.
+    return ( quint32( qChecksum( reinterpret_cast<const char *>( data ), size ) ) << 16 ) |
+           ( size & 0xffff ) | 0x80000000u;
+}
+} // namespace
+
+SessionJournal::SessionJournal( const QString &session )
+    : m_dir( QStandardPaths::writableLocation( QStandardPaths::AppLocalDataLocation ) +
+         "/journal/" + ( session.isEmpty() ? QString( "default" ) : session ) ),
+      m_lock( m_dir + "/writer.lock" )
+{
+    QDir().mkpath( m_dir );
+    m_lock.setStaleLockTime( 0 );
+    m_log.setFileName( logPath() );
+    acquire();
+}
+
+SessionJournal::~SessionJournal()
+{
+    unmap();
+}
+
+QString SessionJournal::checkpointPath() const
+{
+    return m_dir + "/checkpoint";
+}
+
+QString SessionJournal::logPath() const
+{
+    return m_dir + "/log";
+}
+
+bool SessionJournal::isWriter() const
+{
+    return m_map != nullptr;
+}
+
+quint64 SessionJournal::epoch() const
+{
+    return m_epoch;
+}
+
+// Becomes the writer if no other instance is. Appending continues after the
+// last intact record of a log that belongs to the current checkpoint; a log
+// of the epoch before it is carried over into a fresh one, and any other log
+// is stale and restarted.
+bool SessionJournal::acquire()
+{
+    if ( isWriter() )
+        return true;
+    if ( !m_lock.tryLock( 0 ) )
+        return false;
+
+    Snapshot snapshot;
+    quint64 epoch = 0;
+    if ( !readCheckpoint( epoch, snapshot ) )
+        epoch = 0;
+
+    if ( m_log.open( QIODevice::ReadWrite ) && remap( qMax( m_log.size(), growStep ) ) ) {
+        quint64 logEpoch;
+        if ( getHeader( m_map, m_mapped, logMagic, logEpoch ) && logEpoch == epoch ) {
+            m_epoch = epoch;
+            m_end   = scan( m_map, m_mapped, epoch, nullptr );
+            return true;
+        }
+    }
+    QVector<QByteArray> frames;
+    quint64 logEpoch;
+    if ( m_map && getHeader( m_map, m_mapped, logMagic, logEpoch ) && logEpoch + 1 == epoch )
+        scan( m_map, m_mapped, logEpoch, &frames );
+    if ( restartLog( epoch, frames ) )
+        return true;
+
+    qInfo() << "session journal unavailable:" << m_log.errorString();
+    unmap();
+    m_log.close();
+    m_lock.unlock();
+    return false;
+}
+
+// The last checkpoint with the frames logged after it as its tail. A log one
+// epoch behind is what a crash between writing a checkpoint and restarting
+// the log leaves; replaying it whole is safe, since the seen table drops what
+// the checkpoint already holds.
+bool SessionJournal::load( Snapshot &snapshot ) const
+{
+    quint64 epoch = 0;
+    const bool hasCheckpoint = readCheckpoint( epoch, snapshot );
+    if ( !hasCheckpoint ) {
+        snapshot = Snapshot();
+        epoch	 = 0;
+    }
+    snapshot.tail.clear();
+
+    QFile log( logPath() );
+    if ( log.open( QIODevice::ReadOnly ) && log.size() > 0 ) {
+        const uchar *data = log.map( 0, log.size() );
+        quint64 logEpoch;
+        if ( data && getHeader( data, log.size(), logMagic, logEpoch ) &&
+             ( logEpoch == epoch || logEpoch + 1 == epoch ) )
+            scan( data, log.size(), logEpoch, &snapshot.tail );
+    }
+    return hasCheckpoint || !snapshot.tail.isEmpty();
+}
+
+void SessionJournal::append( const QByteArray &frame )
+{
+    if ( !isWriter() )
+        return;
+
+    const qint64 needed = m_end + recordHeader + frame.size() + recordHeader;
+    if ( needed > m_mapped && !remap( ( needed / growStep + 1 ) * growStep ) ) {
+        qInfo() << "session journal stopped:" << m_log.errorString();
+        unmap();
+        return;
+    }
+
+    uchar *out = m_map + m_end;
+    memcpy( out + recordHeader, frame.constData(), frame.size() );
+    qToLittleEndian<quint32>( checksum( out + recordHeader, frame.size() ), out + 4 );
+    qToLittleEndian<quint32>( frame.size(), out );
+    m_end += recordHeader + frame.size();
+    ++m_records;
+}
+
+bool SessionJournal::wantsCheckpoint() const
+{
+    return isWriter() &&
+           ( m_records >= checkpointRecords || m_end - fileHeader >= checkpointLogSize );
+}
+
+// The checkpoint replaces the old one atomically before the log restarts
+// under its epoch; a crash in between leaves a log of the previous epoch,
+// which the next start replays over it.
+bool SessionJournal::checkpoint( const Snapshot &snapshot )
+{
+    if ( !isWriter() || !writeCheckpoint( checkpointPath(), m_epoch + 1, snapshot ) )
+        return false;
+    return startLog( m_epoch + 1 );
+}
+
+bool SessionJournal::writeCheckpoint( const QString &path, quint64 epoch, const Snapshot &snapshot )
+{
+    Snapshot compacted = snapshot;
+    compacted.tail.clear();
+    const QByteArray body = WireFormat::encodeSnapshot( compacted );
+
+    QByteArray header( fileHeader, 0 );
+    putHeader( reinterpret_cast<uchar *>( header.data() ), checkpointMagic, epoch );
+
+    QSaveFile file( path );
+    if ( !file.open( QIODevice::WriteOnly ) || file.write( header ) != header.size() ||
+         file.write( body ) != body.size() || !file.commit() ) {
+        qInfo() << "session checkpoint failed:" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool SessionJournal::restartLog( quint64 epoch, const QVector<QByteArray> &frames )
+{
+    if ( !startLog( epoch ) )
+        return false;
+    for ( const QByteArray &frame : frames )
+        append( frame );
+    return isWriter();
+}
+
+bool SessionJournal::readCheckpoint( quint64 &epoch, Snapshot &snapshot ) const
+{
+    QFile file( checkpointPath() );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    const uchar *data = file.map( 0, file.size() );
+    if ( !data || !getHeader( data, file.size(), checkpointMagic, epoch ) )
+        return false;
+    const QByteArray body( reinterpret_cast<const char *>( data ) + fileHeader,
+                   int( file.size() - fileHeader ) );
+    return WireFormat::decodeSnapshot( body, snapshot );
+}
+
+bool SessionJournal::startLog( quint64 epoch )
+{
+    unmap();
+    if ( !m_log.isOpen() && !m_log.open( QIODevice::ReadWrite ) )
+        return false;
+    if ( !m_log.resize( 0 ) || !remap( growStep ) )
+        return false;
+
+    putHeader( m_map, logMagic, epoch );
+    m_epoch   = epoch;
+    m_end     = fileHeader;
+    m_records = 0;
+    return true;
+}
+
+// Grown files read back as zeros, which is what ends a scan.
+bool SessionJournal::remap( qint64 size )
+{
+    unmap();
+    if ( m_log.size() < size && !m_log.resize( size ) )
+        return false;
+    m_map = m_log.map( 0, size );
+    if ( !m_map )
+        return false;
+    m_mapped = size;
+    return true;
+}
+
+void SessionJournal::unmap()
+{
+    if ( m_map )
+        m_log.unmap( m_map );
+    m_map    = nullptr;
+    m_mapped = 0;
+}
+
+// Walks the intact records of a log of the given epoch and returns where the
+// next one goes.
+qint64 SessionJournal::scan( const uchar *data, qint64 size, quint64 epoch,
+                 QVector<QByteArray> *frames )
+{
+    quint64 logEpoch;
+    if ( !getHeader( data, size, logMagic, logEpoch ) || logEpoch != epoch )
+        return fileHeader;
+
+    qint64 offset = fileHeader;
+    while ( offset + recordHeader <= size ) {
+        const quint32 length = qFromLittleEndian<quint32>( data + offset );
+        const quint32 sum    = qFromLittleEndian<quint32>( data + offset + 4 );
+        if ( !sum || offset + recordHeader + length > size ||
+             sum != checksum( data + offset + recordHeader, length ) )
+            break;
+        if ( frames )
+            frames->append( QByteArray(
+                reinterpret_cast<const char *>( data + offset + recordHeader ), length ) );
+        offset += recordHeader + length;
+    }
+    return offset;
+}
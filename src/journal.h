@@ -0,0 +1,57 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "Structs.h"
+#include <QFile>
+#include <QLockFile>
+#include <QString>
+
+// On-disk history of one session, so the first instance to start finds the
+// text the last one left behind. A compacted checkpoint holds the model; an
+// append-only log written through a shared mapping holds every frame applied
+// since. A crash can leave at most one torn record, whose checksum ends the
+// replay. Only the instance holding the journal's lock file writes to it.
+class SessionJournal
+{
+    const QString m_dir;
+    QLockFile m_lock;
+    QFile m_log;
+    uchar *m_map    = nullptr;
+    qint64 m_mapped = 0;
+    qint64 m_end    = 0;
+    quint64 m_epoch = 0;
+    int m_records   = 0;
+
+public:
+    explicit SessionJournal( const QString &session );
+    ~SessionJournal();
+
+    bool isWriter() const;
+    bool acquire();
+
+    // Only reads the files, so it may run on another thread.
+    bool load( Snapshot &snapshot ) const;
+    void append( const QByteArray &frame );
+    bool wantsCheckpoint() const;
+    bool checkpoint( const Snapshot &snapshot );
+
+    // A checkpoint in two steps, the first of which may run on another
+    // thread: write it under the next epoch, then restart the log with the
+    // frames applied since the snapshot was taken.
+    QString checkpointPath() const;
+    quint64 epoch() const;
+    static bool writeCheckpoint( const QString &path, quint64 epoch, const Snapshot &snapshot );
+    bool restartLog( quint64 epoch, const QVector<QByteArray> &frames );
+
+private:
+    QString logPath() const;
+    bool readCheckpoint( quint64 &epoch, Snapshot &snapshot ) const;
+    bool startLog( quint64 epoch );
+    bool remap( qint64 size );
+    void unmap();
+
+    static qint64 scan( const uchar *data, qint64 size, quint64 epoch,
+                QVector<QByteArray> *frames );
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,361 @@
+#include "localtransport.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QStandardPaths>
+#include <QtEndian>
+
+namespace
+{
+enum Kind { Hello = 1, Frame, Request, Answer };
+
+const int headerSize	 = 4;
+const int stampSize	 = 8;
+const quint32 maxMessage = 1u << 30;
+const int helloTimeout	 = 1000;
+const int closeTimeout	 = 1000;
+// As long as a peer on the bus keeps a published snapshot.
+const int answerTimeout = 30000;
+} // namespace
+
+LocalTransport::LocalTransport( const QString &id, const QString &session, bool keeper,
+                QObject *parent )
+    : PeerLink( parent ), m_id( id ), m_dir( directory( session ) ), m_keeper( keeper ),
+      m_startedAt( QDateTime::currentMSecsSinceEpoch() )
+{
+    m_server.setSocketOptions( QLocalServer::UserAccessOption );
+    connect( &m_server, &QLocalServer::newConnection, this, &LocalTransport::accepted );
+    m_helloTimer.setSingleShot( true );
+    m_helloTimer.setInterval( helloTimeout );
+    connect( &m_helloTimer, &QTimer::timeout, this, &LocalTransport::becomeReady );
+}
+
+// What the replica sent last still goes out.
+LocalTransport::~LocalTransport()
+{
+    for ( QLocalSocket *socket : m_peers.keys() ) {
+        socket->disconnect( this );
+        while ( socket->bytesToWrite() && socket->waitForBytesWritten( closeTimeout ) ) {
+        }
+    }
+    m_server.close();
+}
+
+QString LocalTransport::directory( const QString &session )
+{
+    return QStandardPaths::writableLocation( QStandardPaths::RuntimeLocation ) +
+           "/sessionterminal/" + ( session.isEmpty() ? QString( "default" ) : session );
+}
+
+QString LocalTransport::name() const
+{
+    return "local";
+}
+
+// Listens before dialing, so two replicas starting together find each other
+// one way or the other. The peers' hellos decide whom to join from; they are
+// collected as they come, and the link is ready once they are in.
+bool LocalTransport::open()
+{
+    if ( !QDir().mkpath( m_dir ) || !m_server.listen( m_dir + "/" + m_id ) ) {
+        qInfo() << "can\'t listen in" << m_dir << m_server.errorString();
+        return false;
+    }
+
+    m_helloTimer.start();
+    const QStringList entries = QDir( m_dir ).entryList( QDir::AllEntries | QDir::System |
+                                 QDir::NoDotAndDotDot );
+    for ( const QString &peer : entries ) {
+        if ( peer != m_id )
+            dial( peer );
+    }
+    checkReady();
+    return true;
+}
+
+bool LocalTransport::isReady() const
+{
+    return m_ready;
+}
+
+void LocalTransport::dial( const QString &peer )
+{
+    QLocalSocket *socket = new QLocalSocket( this );
+    Peer &entry		 = m_peers[socket];
+    entry.id		 = peer;
+    entry.dialed	 = true;
+    watch( socket );
+    connect( socket, &QLocalSocket::connected, this, [this, socket]() { greet( socket ); } );
+    connect( socket, QOverload<QLocalSocket::LocalSocketError>::of( &QLocalSocket::error ), this,
+         [this, socket]( QLocalSocket::LocalSocketError error ) { refused( socket, error ); } );
+    socket->connectToServer( m_dir + "/" + peer );
+}
+
+// A socket left behind by a replica that crashed refuses the call and is
+// removed. Errors on a connection that was up end in disconnected instead.
+void LocalTransport::refused( QLocalSocket *socket, QLocalSocket::LocalSocketError error )
+{
+    auto it = m_peers.find( socket );
+    if ( it == m_peers.end() || it->connected )
+        return;
+    if ( error == QLocalSocket::ConnectionRefusedError )
+        QLocalServer::removeServer( m_dir + "/" + it->id );
+    m_peers.erase( it );
+    socket->deleteLater();
+    checkReady();
+}
+
+void LocalTransport::accepted()
+{
+    while ( QLocalSocket *socket = m_server.nextPendingConnection() ) {
+        m_peers[socket];
+        watch( socket );
+        greet( socket );
+    }
+}
+
+void LocalTransport::watch( QLocalSocket *socket )
+{
+    connect( socket, &QLocalSocket::readyRead, this, [this, socket]() { readFrom( socket ); } );
+    connect( socket, &QLocalSocket::disconnected, this, [this, socket]() { dropped( socket ); } );
+}
+
+// Both ends say hello as soon as they are connected.
+void LocalTransport::greet( QLocalSocket *socket )
+{
+    auto it = m_peers.find( socket );
+    if ( it == m_peers.end() )
+        return;
+    it->connected = true;
+
+    QByteArray payload;
+    QDataStream out( &payload, QIODevice::WriteOnly );
+    out << m_id << m_startedAt << m_keeper;
+    write( socket, Hello, payload );
+}
+
+void LocalTransport::write( QLocalSocket *socket, int kind, const QByteArray &payload )
+{
+    char header[headerSize + 1];
+    qToLittleEndian<quint32>( quint32( payload.size() + 1 ), header );
+    header[headerSize] = char( kind );
+    socket->write( header, sizeof( header ) );
+    socket->write( payload );
+    socket->flush();
+}
+
+// Whole messages are handled as they complete; one still coming in stays
+// buffered without being copied again. A length out of range means the
+// stream is broken, and the connection goes.
+void LocalTransport::readFrom( QLocalSocket *socket )
+{
+    auto it = m_peers.find( socket );
+    if ( it == m_peers.end() )
+        return;
+    it->buffer += socket->readAll();
+
+    QByteArray buffer;
+    buffer.swap( it->buffer );
+    int offset = 0;
+    while ( buffer.size() - offset >= headerSize ) {
+        const quint32 length = qFromLittleEndian<quint32>( buffer.constData() + offset );
+        if ( !length || length > maxMessage ) {
+            qInfo() << "broken stream from" << m_peers.value( socket ).id;
+            socket->abort();
+            return;
+        }
+        if ( quint32( buffer.size() - offset - headerSize ) < length )
+            break;
+        const int kind		 = buffer.at( offset + headerSize );
+        const QByteArray payload = buffer.mid( offset + headerSize + 1, int( length ) - 1 );
+        offset += headerSize + int( length );
+        handle( socket, kind, payload );
+    }
+
+    it = m_peers.find( socket );
+    if ( it != m_peers.end() )
+        it->buffer = offset ? buffer.mid( offset ) : buffer;
+}
+
+void LocalTransport::handle( QLocalSocket *socket, int kind, const QByteArray &payload )
+{
+    const QString peer = m_peers.value( socket ).id;
+    switch ( kind ) {
+    case Hello:
+        hello( socket, payload );
+        break;
+    case Frame:
+        if ( payload.size() < stampSize )
+            return;
+        m_latency.record( LatencyHistogram::now() -
+                  qFromLittleEndian<qint64>( payload.constData() ) );
+        emit frameReceived( payload.mid( stampSize ) );
+        break;
+    case Request:
+        if ( !peer.isEmpty() )
+            emit snapshotRequested( peer );
+        break;
+    case Answer: {
+        auto it = m_peers.find( socket );
+        if ( it == m_peers.end() || !it->asked )
+            return;
+        it->asked = 0;
+        // Whoever failed before may answer the next join.
+        if ( !payload.isEmpty() ) {
+            for ( Peer &other : m_peers )
+                other.failed = false;
+        }
+        emit snapshotReceived( peer, payload );
+        break;
+    }
+    }
+}
+
+// Two replicas that dialed each other at once keep the connection the one
+// with the smaller id dialed; both ends come to the same choice.
+void LocalTransport::hello( QLocalSocket *socket, const QByteArray &payload )
+{
+    QString id;
+    qint64 startedAt = 0;
+    bool keeper	     = false;
+    QDataStream in( payload );
+    in >> id >> startedAt >> keeper;
+    auto it = m_peers.find( socket );
+    if ( in.status() != QDataStream::Ok || id.isEmpty() || id == m_id || it == m_peers.end() )
+        return;
+    it->id	  = id;
+    it->startedAt = startedAt;
+    it->keeper	  = keeper;
+
+    const bool keepThis = ( it->dialed ? m_id : id ) < ( it->dialed ? id : m_id );
+    for ( auto other = m_peers.begin(); other != m_peers.end(); ++other ) {
+        if ( other.key() == socket || other->id != id || !other->startedAt )
+            continue;
+        QLocalSocket *closing = keepThis ? other.key() : socket;
+        QTimer::singleShot( 0, closing, &QLocalSocket::disconnectFromServer );
+    }
+    checkReady();
+}
+
+// Ready once no dialed peer still owes a hello; the timer gives up on those
+// that are slow or stuck, and they count as soon as they do say hello.
+void LocalTransport::checkReady()
+{
+    if ( m_ready )
+        return;
+    for ( const Peer &peer : m_peers ) {
+        if ( peer.dialed && !peer.startedAt )
+            return;
+    }
+    becomeReady();
+}
+
+void LocalTransport::becomeReady()
+{
+    if ( m_ready )
+        return;
+    m_ready = true;
+    m_helloTimer.stop();
+    emit ready();
+}
+
+// A peer that goes away in the middle of a join fails it, unless the pair
+// is still connected the other way.
+void LocalTransport::dropped( QLocalSocket *socket )
+{
+    const Peer peer = m_peers.take( socket );
+    socket->deleteLater();
+    checkReady();
+    if ( !peer.asked )
+        return;
+    if ( QLocalSocket *other = socketOf( peer.id ) ) {
+        ask( other );
+        return;
+    }
+    failLater( peer.id );
+}
+
+QLocalSocket *LocalTransport::socketOf( const QString &peer ) const
+{
+    for ( auto it = m_peers.constBegin(); it != m_peers.constEnd(); ++it ) {
+        if ( it->id == peer && it->connected )
+            return it.key();
+    }
+    return nullptr;
+}
+
+bool LocalTransport::send( const QByteArray &frame )
+{
+    QByteArray payload( stampSize, Qt::Uninitialized );
+    qToLittleEndian<qint64>( LatencyHistogram::now(), payload.data() );
+    payload += frame;
+    for ( auto it = m_peers.constBegin(); it != m_peers.constEnd(); ++it ) {
+        if ( it->connected )
+            write( it.key(), Frame, payload );
+    }
+    return true;
+}
+
+// A keeper first, then whoever has been running longest; a peer yet to say
+// hello isn't known to answer at all.
+QString LocalTransport::bestPeer() const
+{
+    const Peer *best = nullptr;
+    auto rank	     = []( const Peer &peer ) { return qMakePair( !peer.keeper, peer.startedAt ); };
+    for ( const Peer &peer : m_peers ) {
+        if ( !peer.startedAt || peer.failed )
+            continue;
+        if ( !best || rank( peer ) < rank( *best ) )
+            best = &peer;
+    }
+    return best ? best->id : QString();
+}
+
+void LocalTransport::markFailed( const QString &peer )
+{
+    for ( Peer &entry : m_peers ) {
+        if ( entry.id == peer )
+            entry.failed = true;
+    }
+}
+
+void LocalTransport::requestSnapshot( const QString &peer )
+{
+    QLocalSocket *socket = socketOf( peer );
+    if ( socket )
+        ask( socket );
+    else
+        failLater( peer );
+}
+
+void LocalTransport::answerSnapshot( const QString &joiner, const QByteArray &snapshot )
+{
+    if ( QLocalSocket *socket = socketOf( joiner ) )
+        write( socket, Answer, snapshot );
+}
+
+// A peer that is still connected but never answers is given up on too.
+void LocalTransport::ask( QLocalSocket *socket )
+{
+    const quint32 request = ++m_requests;
+    const QString peer	  = m_peers.value( socket ).id;
+    m_peers[socket].asked = request;
+    QTimer::singleShot( answerTimeout, this, [this, peer, request]() {
+        for ( Peer &entry : m_peers ) {
+            if ( entry.id == peer && entry.asked == request ) {
+                entry.asked = 0;
+                emit snapshotReceived( peer, QByteArray() );
+                return;
+            }
+        }
+    } );
+    write( socket, Request, QByteArray() );
+}
+
+// Failures are reported from the event loop, never from inside the call
+// that asked.
+void LocalTransport::failLater( const QString &peer )
+{
+    QTimer::singleShot( 0, this, [this, peer]() { emit snapshotReceived( peer, QByteArray() ); } );
+}
@@ -0,0 +1,83 @@
+#ifndef LOCALTRANSPORT_H
+#define LOCALTRANSPORT_H
+
+#include "transport.h"
+#include <QHash>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTimer>
+
+// A session over local sockets, for hosts without a session bus or with a
+// busy one. Every replica listens on a socket named after its id in the
+// session's directory under the runtime dir, and dials each socket it finds
+// there when it starts, so the peers form a full mesh with one connection per
+// pair. Messages are a 32-bit length, a kind byte and the payload. Joiners
+// ask a keeper, or else the longest running peer, for a snapshot over the
+// same connection. Nothing blocks: sockets connect and say hello in the
+// background, and the link is ready once every dialed peer has answered, or
+// after a second at most.
+class LocalTransport : public PeerLink
+{
+    Q_OBJECT
+
+public:
+    LocalTransport( const QString &id, const QString &session, bool keeper,
+            QObject *parent = nullptr );
+    ~LocalTransport();
+
+    static QString directory( const QString &session );
+
+    bool open() override;
+    bool isReady() const override;
+    QString name() const override;
+    bool send( const QByteArray &frame ) override;
+    QString bestPeer() const override;
+    void markFailed( const QString &peer ) override;
+    void requestSnapshot( const QString &peer ) override;
+    void answerSnapshot( const QString &joiner, const QByteArray &snapshot ) override;
+
+private slots:
+    void accepted();
+
+private:
+    struct Peer {
+        // Empty on an accepted connection until the peer says hello;
+        // startedAt stays 0 until then on either kind.
+        QString id;
+        qint64 startedAt = 0;
+        bool keeper	 = false;
+        bool dialed	 = false;
+        bool connected = false;
+        bool failed	 = false;
+        // The snapshot request waiting for an answer, 0 for none.
+        quint32 asked = 0;
+        QByteArray buffer;
+    };
+
+    const QString m_id;
+    const QString m_dir;
+    const bool m_keeper;
+    const qint64 m_startedAt;
+    QLocalServer m_server;
+    QHash<QLocalSocket *, Peer> m_peers;
+    quint32 m_requests = 0;
+    QTimer m_helloTimer;
+    bool m_ready = false;
+
+    void dial( const QString &peer );
+    void watch( QLocalSocket *socket );
+    void greet( QLocalSocket *socket );
+    void refused( QLocalSocket *socket, QLocalSocket::LocalSocketError error );
+    void checkReady();
+    void becomeReady();
+    void write( QLocalSocket *socket, int kind, const QByteArray &payload );
+    void readFrom( QLocalSocket *socket );
+    void handle( QLocalSocket *socket, int kind, const QByteArray &payload );
+    void hello( QLocalSocket *socket, const QByteArray &payload );
+    void dropped( QLocalSocket *socket );
+    void ask( QLocalSocket *socket );
+    void failLater( const QString &peer );
+    QLocalSocket *socketOf( const QString &peer ) const;
+};
+
+#endif // LOCALTRANSPORT_H
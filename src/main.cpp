@@ -2,37 +2,67 @@
 #include <QDesktopWidget>
 #include <QCommandLineOption>
 #include <QCommandLineParser>
+#include "daemon.h"
 #include "mainwindow.h"
+#include "statsdump.h"
 
-void parseCommandLine( QString &arg, bool &isolated, const QApplication &a );
+void parseCommandLine( SessionOptions &options, const QCoreApplication &a );
 
 int main( int argc, char *argv[] )
 {
+    // --stats only talks to the bus and must work without a display.
+    for ( int i = 1; i < argc; ++i ) {
+        if ( !qstrcmp( argv[i], "--stats" ) ) {
+            QCoreApplication a( argc, argv );
+            SessionOptions options;
+            parseCommandLine( options, a );
+            return dumpStats( options );
+        }
+        if ( !qstrcmp( argv[i], "--daemon" ) || !qstrcmp( argv[i], "-d" ) ) {
+            QCoreApplication a( argc, argv );
+            SessionOptions options;
+            options.startedAt = LatencyHistogram::now();
+            parseCommandLine( options, a );
+            return runDaemon( options );
+        }
+    }
+
     QApplication a( argc, argv );
 
-    QString arg;
-    bool isolated = false;
+    SessionOptions options;
+    options.startedAt = LatencyHistogram::now();
+    parseCommandLine( options, a );
 
-    parseCommandLine( arg, isolated, a );
+    // Every session named gets a window; they all share the one bus connection.
+    QStringList sessions = options.sessions;
+    if ( sessions.isEmpty() || options.isolated )
+        sessions = QStringList() << options.session;
+    sessions.removeDuplicates();
 
-    MainWindow w( arg, isolated );
+    QList<QSharedPointer<MainWindow>> windows;
+    for ( int i = 0; i < sessions.size(); ++i ) {
+        SessionOptions session = options;
+        session.session        = sessions.at( i );
+        QSharedPointer<MainWindow> w( new MainWindow( session ) );
 
-    const QRect availableGeometry = QApplication::desktop()->availableGeometry( &w );
-    w.resize( availableGeometry.width() / 2, ( availableGeometry.height() * 2 ) / 3 );
-    w.move( ( availableGeometry.width() - w.width() ) / 2,
-        ( availableGeometry.height() - w.height() ) / 2 );
+        const QRect availableGeometry = QApplication::desktop()->availableGeometry( w.data() );
+        w->resize( availableGeometry.width() / 2, ( availableGeometry.height() * 2 ) / 3 );
+        w->move( ( availableGeometry.width() - w->width() ) / 2 + i * 30,
+             ( availableGeometry.height() - w->height() ) / 2 + i * 30 );
 
-    w.show();
+        w->show();
+        windows.append( w );
+    }
 
     return a.exec();
 }
 
-void parseCommandLine( QString &arg, bool &isolated, const QApplication &a )
+void parseCommandLine( SessionOptions &options, const QCoreApplication &a )
 {
     QCommandLineParser parser;
     parser.setApplicationDescription( "One Session Terminal" );
     parser.addPositionalArgument(
-        "name", QCoreApplication::translate( "main", "Private session name" ) );
+        "name", QCoreApplication::translate( "main", "Private session name; each one named opens a window" ) );
     parser.addHelpOption();
 
     QCommandLineOption privateSessionOption(
@@ -47,14 +77,76 @@ void parseCommandLine( QString &arg, bool &isolated, const QApplication &a )
         QCoreApplication::translate( "main", "Creates isolated sesison terminal" ) );
     parser.addOption( singleTerminalOption );
 
+    QCommandLineOption flushWindowOption(
+        QStringList() << "f"
+              << "flushWindow",
+        QCoreApplication::translate( "main", "Milliseconds to batch edits before sending" ),
+        "ms", QString::number( options.flushWindow ) );
+    parser.addOption( flushWindowOption );
+
+    QCommandLineOption ringOption(
+        QStringList() << "r"
+              << "ring",
+        QCoreApplication::translate(
+            "main", "Exchange edits through shared memory; every peer of the session must use it" ) );
+    parser.addOption( ringOption );
+
+    QCommandLineOption localOption(
+        QStringList() << "l"
+              << "local",
+        QCoreApplication::translate(
+            "main", "Connect the session's replicas through local sockets instead of D-Bus; every peer of the session must use it" ) );
+    parser.addOption( localOption );
+
+    QCommandLineOption sequencedOption(
+        QStringList() << "q"
+              << "sequenced",
+        QCoreApplication::translate(
+            "main", "Order every edit through one elected replica; every peer of the session must use it" ) );
+    parser.addOption( sequencedOption );
+
+    QCommandLineOption viewWindowOption(
+        "viewWindow",
+        QCoreApplication::translate( "main", "Characters of a large document kept in the editor" ),
+        "chars", QString::number( options.viewWindow ) );
+    parser.addOption( viewWindowOption );
+
+    QCommandLineOption statsOption(
+        "stats", QCoreApplication::translate(
+                 "main", "Print the metrics of the session's running replicas and exit" ) );
+    parser.addOption( statsOption );
+
+    QCommandLineOption watchOption(
+        QStringList() << "w"
+              << "watch",
+        QCoreApplication::translate( "main", "With --stats, print them every n seconds" ), "s",
+        "0" );
+    parser.addOption( watchOption );
+
+    QCommandLineOption daemonOption(
+        QStringList() << "d"
+              << "daemon",
+        QCoreApplication::translate(
+            "main", "Keep the named sessions without a window, serving joins to editors" ) );
+    parser.addOption( daemonOption );
+
     if ( parser.parse( QCoreApplication::arguments() ) ) {
         parser.process( a );
 
         QStringList lst = parser.positionalArguments();
         if ( !lst.isEmpty() ) {
-            arg = lst.first();
+            options.session = lst.first();
         }
-        isolated = parser.isSet( singleTerminalOption );
+        options.daemon      = parser.isSet( daemonOption );
+        options.sessions    = lst;
+        options.isolated    = parser.isSet( singleTerminalOption );
+        options.flushWindow = qMax( 0, parser.value( flushWindowOption ).toInt() );
+        options.ring	    = parser.isSet( ringOption );
+        options.local	    = parser.isSet( localOption );
+        options.sequenced   = parser.isSet( sequencedOption );
+        options.viewWindow  = qMax( 0, parser.value( viewWindowOption ).toInt() );
+        if ( parser.isSet( statsOption ) )
+            options.statsInterval = qMax( 0, parser.value( watchOption ).toInt() );
         return;
     }
 
@@ -1,8 +1,17 @@
 #include "mainwindow.h"
 
-MainWindow::MainWindow( const QString &privateSession, bool isolated, QWidget *parent )
-    : QMainWindow( parent )
+namespace
 {
+const int streamMessageTimeout = 3000;
+}
+
+MainWindow::MainWindow( const SessionOptions &options, QWidget *parent )
+    : QMainWindow( parent ), m_startedAt( options.startedAt )
+{
+    m_title = options.session.isEmpty()
+              ? QApplication::applicationName()
+              : tr( "%1 - %2" ).arg( QApplication::applicationName(), options.session );
+
     const int idSize = 30;
     m_id		 = QUuid::createUuid()
            .toString()
@@ -13,22 +22,73 @@ MainWindow::MainWindow( const QString &privateSession, bool isolated, QWidget *p
     setupTextActions();
 
     m_textEdit = new Edit( this );
-    m_handler  = new DBusHandler( m_id, privateSession, isolated, m_textEdit );
+    m_handler  = new DBusHandler( m_id, options, m_textEdit );
     m_textEdit->setHandler( m_handler );
 
     QObject::connect( m_textEdit, &QTextEdit::currentCharFormatChanged, this,
               &MainWindow::currentCharFormatChanged );
+    QObject::connect( m_handler, &DBusHandler::joinStarted, this,
+              [this]() { setSyncing( true ); } );
+    QObject::connect( m_handler, &DBusHandler::joined, this, [this]() {
+        setSyncing( false );
+        qInfo() << "editable after" << sinceStart() << "ms";
+    } );
+    QObject::connect( m_handler, &DBusHandler::toolbarStateChanged, this, &MainWindow::setToolbar );
+    QObject::connect( m_handler, &DBusHandler::streamProgress, this, &MainWindow::showStream );
 
     setCentralWidget( m_textEdit );
     m_textEdit->setFocus();
+    m_textEdit->viewport()->installEventFilter( this );
+
+    // The join starts once the window is up, so a slow peer never holds it.
+    setSyncing( true );
+    QTimer::singleShot( 0, m_handler, &DBusHandler::startJoin );
+}
+
+//-------------startup-------------------------
+// Until the join lands the document is shown read-only and nothing can
+// format it.
+void MainWindow::setSyncing( bool syncing )
+{
+    m_textEdit->setReadOnly( syncing );
+    m_formatBar->setEnabled( !syncing );
+    m_formatMenu->setEnabled( !syncing );
+    setWindowTitle( syncing ? tr( "%1 (syncing)" ).arg( m_title ) : m_title );
+}
+
+// A peer's paste too large for one frame fills in piece by piece. The message
+// times out by itself in case the peer goes away halfway.
+void MainWindow::showStream( const QString &sender, qint64 done, qint64 left )
+{
+    Q_UNUSED( sender );
+    if ( !left ) {
+        statusBar()->clearMessage();
+        return;
+    }
+    statusBar()->showMessage( tr( "Receiving a paste: %1%" ).arg( done * 100 / ( done + left ) ),
+                  streamMessageTimeout );
+}
+
+bool MainWindow::eventFilter( QObject *watched, QEvent *event )
+{
+    if ( !m_painted && event->type() == QEvent::Paint && watched == m_textEdit->viewport() ) {
+        m_painted = true;
+        qInfo() << "first paint after" << sinceStart() << "ms";
+    }
+    return QMainWindow::eventFilter( watched, event );
+}
 
-    setToolbar();
+qint64 MainWindow::sinceStart() const
+{
+    return ( LatencyHistogram::now() - m_startedAt ) / 1000000;
 }
 
 void MainWindow::setupTextActions()
 {
     QToolBar *tb = addToolBar( tr( "Format Actions" ) );
     QMenu *menu  = menuBar()->addMenu( tr( "F&ormat" ) );
+    m_formatBar	 = tb;
+    m_formatMenu = menu;
 
     const QIcon boldIcon =
         QIcon::fromTheme( "format-text-bold", QIcon( ":/images/textbold.png" ) );
@@ -137,7 +197,6 @@ void MainWindow::textColor()
     QColor col = QColorDialog::getColor( m_textEdit->textColor(), this );
     if ( !col.isValid() )
         return;
-    amIchangeTheColor = true;
     QTextCharFormat fmt;
     fmt.setForeground( col );
     m_handler->mergeFormatOnWordOrSelection( fmt );
@@ -148,10 +207,6 @@ void MainWindow::colorChanged( const QColor &c )
     QPixmap pix( 16, 16 );
     pix.fill( c );
     m_actionTextColor->setIcon( pix );
-    if ( amIchangeTheColor ) {
-        m_textEdit->sendHtml();
-    }
-    amIchangeTheColor = false;
 }
 
 void MainWindow::currentCharFormatChanged( const QTextCharFormat &format )
@@ -159,8 +214,7 @@ void MainWindow::currentCharFormatChanged( const QTextCharFormat &format )
     fontChanged( format.font() );
     colorChanged( format.foreground().color() );
     if ( m_textEdit->hasFocus() ) {
-        m_handler->sendMessageWithID( m_textEdit->textCursor().position(),
-                          "cursorPosition" );
+        m_handler->sendCursor( m_textEdit->textCursor().position() );
     }
 }
 
@@ -175,16 +229,16 @@ void MainWindow::fontChanged( const QFont &f )
 
 void MainWindow::setToolbar()
 {
-    QVariantList state = m_handler->getToolbarState();
-    if ( !state.isEmpty() ) {
-        m_actionTextBold->setChecked( state.at( BOLD ).toBool() );
-        m_actionTextUnderline->setChecked( state.at( UNDERLINE ).toBool() );
-        m_actionTextItalic->setChecked( state.at( ITALIC ).toBool() );
-        m_comboSize->setCurrentText( state.at( SIZE ).toString() );
+    CharState state = m_handler->getToolbarState();
+    if ( state.isValid() ) {
+        m_actionTextBold->setChecked( state.bold );
+        m_actionTextUnderline->setChecked( state.underline );
+        m_actionTextItalic->setChecked( state.italic );
+        m_comboSize->setCurrentText( state.size );
         QFont font;
-        font.fromString( state.at( FONT ).toString() );
+        font.fromString( state.font );
         m_comboFont->setCurrentFont( font );
-        QColor color( state.at( COLOR ).toString() );
+        QColor color( state.color );
         colorChanged( color );
     }
 }
@@ -15,7 +15,9 @@
 #include <QMainWindow>
 #include <QMenu>
 #include <QMenuBar>
+#include <QStatusBar>
 #include <QTextEdit>
+#include <QTimer>
 #include <QToolBar>
 #include <QUuid>
 
@@ -24,13 +26,22 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
-    MainWindow( const QString &privateSession, bool isolated, QWidget *parent = nullptr );
+    MainWindow( const SessionOptions &options, QWidget *parent = nullptr );
     ~MainWindow() = default;
 
+protected:
+    bool eventFilter( QObject *watched, QEvent *event ) override;
+
 private:
     Edit *m_textEdit = nullptr;
     DBusHandler *m_handler = nullptr;
     QString m_id;
+    QString m_title;
+    qint64 m_startedAt;
+    bool m_painted = false;
+
+    QToolBar *m_formatBar;
+    QMenu *m_formatMenu;
 
     QAction *m_actionTextBold;
     QAction *m_actionTextUnderline;
@@ -39,8 +50,6 @@ private:
     QFontComboBox *m_comboFont;
     QComboBox *m_comboSize;
 
-    bool amIchangeTheColor = false;
-
 private:
     void setupTextActions();
     void textBold() const;
@@ -54,5 +63,8 @@ private:
     void fontChanged( const QFont &f );
     void colorChanged( const QColor &c );
     void setToolbar();
+    void setSyncing( bool syncing );
+    void showStream( const QString &sender, qint64 done, qint64 left );
+    qint64 sinceStart() const;
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,168 @@
+#include "membership.h"
+#include "histogram.h"
+#include <QDBusConnectionInterface>
+#include <QDBusReply>
+#include <QDebug>
+
+namespace
+{
+const int answerTimeout = 1000;
+} // namespace
+
+Membership::Membership( const QDBusConnection &conn, const QString &objName,
+            const QString &ifaceName, QObject *parent )
+    : QObject( parent ), m_conn( conn ), m_objName( objName ), m_ifaceName( ifaceName ),
+      m_memberName( ifaceName + ".members" ), m_self( conn.baseService() ),
+      m_watcher( QString(), conn, QDBusServiceWatcher::WatchForUnregistration )
+{
+    connect( &m_watcher, &QDBusServiceWatcher::serviceUnregistered, this, &Membership::departed );
+    m_answerTimer.setSingleShot( true );
+    m_answerTimer.setInterval( answerTimeout );
+    connect( &m_answerTimer, &QTimer::timeout, this, &Membership::settle );
+}
+
+// Joins the session's member queue and lists who is already there.
+bool Membership::start()
+{
+    QDBusConnectionInterface *bus = m_conn.interface();
+    m_conn.connect( QString(), m_objName, m_ifaceName, "announce", this,
+            SLOT( announced( qulonglong, bool, QDBusMessage ) ) );
+
+    if ( !bus->registerService( m_memberName, QDBusConnectionInterface::QueueService,
+                    QDBusConnectionInterface::DontAllowReplacement )
+              .isValid() ) {
+        qInfo() << "can\'t join member queue" << bus->lastError().message();
+        return false;
+    }
+
+    QDBusReply<QStringList> owners = bus->call( "ListQueuedOwners", m_memberName );
+    for ( const QString &owner : owners.value() ) {
+        if ( owner != m_self ) {
+            m_unanswered.insert( owner );
+            touch( owner, 0, false );
+        }
+    }
+
+    // Everybody already there announces its version in reply.
+    announce( 0, true );
+    if ( m_unanswered.isEmpty() )
+        settle();
+    else
+        m_answerTimer.start();
+    return true;
+}
+
+void Membership::announce( quint64 version, bool hello )
+{
+    QDBusMessage msg = QDBusMessage::createSignal( m_objName, m_ifaceName, "announce" );
+    msg << qulonglong( version ) << hello;
+    m_conn.send( msg );
+}
+
+bool Membership::isSettled() const
+{
+    return m_settled;
+}
+
+QString Membership::bestPeer() const
+{
+    return m_best;
+}
+
+// A peer that failed to answer is passed over until it announces again.
+void Membership::markFailed( const QString &owner )
+{
+    auto it = m_peers.find( owner );
+    if ( it == m_peers.end() )
+        return;
+    ++it->failures;
+    chooseBest();
+}
+
+bool Membership::isAnswering( const QString &owner ) const
+{
+    auto it = m_peers.constFind( owner );
+    return it != m_peers.constEnd() && !it->failures;
+}
+
+int Membership::size() const
+{
+    return m_peers.size();
+}
+
+QList<Membership::Peer> Membership::peers() const
+{
+    return m_peers.values();
+}
+
+void Membership::departed( const QString &owner )
+{
+    m_watcher.removeWatchedService( owner );
+    if ( m_peers.remove( owner ) ) {
+        chooseBest();
+        emit peerLeft( owner );
+    }
+    answered( owner );
+}
+
+void Membership::announced( qulonglong version, bool hello, const QDBusMessage &msg )
+{
+    const QString owner = msg.service();
+    if ( owner == m_self )
+        return;
+
+    touch( owner, version, !hello );
+    if ( hello )
+        emit announceRequested();
+    else
+        answered( owner );
+}
+
+void Membership::touch( const QString &owner, quint64 version, bool announcedVersion )
+{
+    const bool arrived = !m_peers.contains( owner );
+    Peer &peer	       = m_peers[owner];
+    peer.owner	       = owner;
+    peer.lastSeen      = LatencyHistogram::now();
+    if ( announcedVersion ) {
+        peer.version  = version;
+        peer.failures = 0;
+    }
+    chooseBest();
+    if ( arrived ) {
+        m_watcher.addWatchedService( owner );
+        emit peerJoined( owner );
+    }
+}
+
+void Membership::answered( const QString &owner )
+{
+    if ( m_unanswered.remove( owner ) && m_unanswered.isEmpty() )
+        settle();
+}
+
+void Membership::settle()
+{
+    if ( m_settled )
+        return;
+    m_settled = true;
+    m_answerTimer.stop();
+    emit settled();
+}
+
+// The most caught-up of the peers that answer, then the most recently heard
+// from.
+void Membership::chooseBest()
+{
+    m_best.clear();
+    const Peer *best = nullptr;
+    for ( const Peer &peer : m_peers ) {
+        if ( peer.failures )
+            continue;
+        if ( !best || peer.version > best->version ||
+             ( peer.version == best->version && peer.lastSeen > best->lastSeen ) )
+            best = &peer;
+    }
+    if ( best )
+        m_best = best->owner;
+}
@@ -0,0 +1,75 @@
+#ifndef MEMBERSHIP_H
+#define MEMBERSHIP_H
+
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusServiceWatcher>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+
+// Live table of the other replicas of one session. Every replica queues for
+// the session's member name, so one ListQueuedOwners call lists them all at
+// start without scanning the bus. After that, arrivals announce themselves,
+// the others answer with how far they have got, and NameOwnerChanged on each
+// member's unique name reports departures. The best peer to join from is
+// kept ready. The membership is settled once every member listed at start
+// has answered or left, or after a second at most.
+class Membership : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Peer {
+        QString owner;
+        quint64 version = 0;
+        qint64 lastSeen = 0;
+        int failures	= 0;
+    };
+
+    Membership( const QDBusConnection &conn, const QString &objName, const QString &ifaceName,
+            QObject *parent = nullptr );
+
+    bool start();
+    void announce( quint64 version, bool hello = false );
+    bool isSettled() const;
+
+    QString bestPeer() const;
+    void markFailed( const QString &owner );
+    bool isAnswering( const QString &owner ) const;
+    int size() const;
+    QList<Peer> peers() const;
+
+signals:
+    void peerJoined( const QString &owner );
+    void peerLeft( const QString &owner );
+    // A new member asks the others to announce themselves.
+    void announceRequested();
+    void settled();
+
+private slots:
+    void departed( const QString &owner );
+    void announced( qulonglong version, bool hello, const QDBusMessage &msg );
+
+private:
+    QDBusConnection m_conn;
+    const QString m_objName;
+    const QString m_ifaceName;
+    const QString m_memberName;
+    const QString m_self;
+    QDBusServiceWatcher m_watcher;
+
+    QHash<QString, Peer> m_peers;
+    QString m_best;
+    QSet<QString> m_unanswered;
+    QTimer m_answerTimer;
+    bool m_settled = false;
+
+    void touch( const QString &owner, quint64 version, bool announcedVersion );
+    void chooseBest();
+    void answered( const QString &owner );
+    void settle();
+};
+
+#endif // MEMBERSHIP_H
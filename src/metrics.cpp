@@ -0,0 +1,63 @@
+#include "metrics.h"
+#include <QMutexLocker>
+
+namespace
+{
+QJsonObject histogramJson( const LatencyHistogram &histogram )
+{
+    QJsonObject out;
+    out["count"] = double( histogram.count() );
+    out["mean"]	 = double( histogram.mean() );
+    out["p50"]	 = double( histogram.percentile( 50 ) );
+    out["p90"]	 = double( histogram.percentile( 90 ) );
+    out["p99"]	 = double( histogram.percentile( 99 ) );
+    out["max"]	 = double( histogram.max() );
+    return out;
+}
+} // namespace
+
+Metrics::Counter &Metrics::counter( const QString &name )
+{
+    QMutexLocker lock( &m_mutex );
+    QSharedPointer<Counter> &counter = m_counters[name];
+    if ( !counter )
+        counter.reset( new Counter );
+    return *counter;
+}
+
+LatencyHistogram &Metrics::histogram( const QString &name )
+{
+    QMutexLocker lock( &m_mutex );
+    QSharedPointer<LatencyHistogram> &histogram = m_histograms[name];
+    if ( !histogram )
+        histogram.reset( new LatencyHistogram );
+    return *histogram;
+}
+
+void Metrics::attach( const QString &name, const LatencyHistogram *histogram )
+{
+    QMutexLocker lock( &m_mutex );
+    if ( histogram )
+        m_attached.insert( name, histogram );
+    else
+        m_attached.remove( name );
+}
+
+QJsonObject Metrics::toJson() const
+{
+    QMutexLocker lock( &m_mutex );
+    QJsonObject counters;
+    for ( auto it = m_counters.constBegin(); it != m_counters.constEnd(); ++it )
+        counters[it.key()] = double( it.value()->value() );
+
+    QJsonObject histograms;
+    for ( auto it = m_histograms.constBegin(); it != m_histograms.constEnd(); ++it )
+        histograms[it.key()] = histogramJson( *it.value() );
+    for ( auto it = m_attached.constBegin(); it != m_attached.constEnd(); ++it )
+        histograms[it.key()] = histogramJson( *it.value() );
+
+    QJsonObject out;
+    out["counters"]	 = counters;
+    out["histograms"] = histograms;
+    return out;
+}
@@ -0,0 +1,52 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+#include <QJsonObject>
+#include <QMap>
+#include <QMutex>
+#include <QSharedPointer>
+#include <atomic>
+
+// Named counters and histograms of one replica. Looking a metric up takes a
+// lock, so callers keep the reference; updating it is lock-free and may
+// happen from any thread. Histograms hold nanoseconds or bytes, as the name
+// says.
+class Metrics
+{
+public:
+    class Counter
+    {
+        std::atomic<quint64> m_value;
+
+    public:
+        Counter() : m_value( 0 )
+        {
+        }
+
+        void add( quint64 count = 1 )
+        {
+            m_value.fetch_add( count, std::memory_order_relaxed );
+        }
+
+        quint64 value() const
+        {
+            return m_value.load( std::memory_order_relaxed );
+        }
+    };
+
+    Counter &counter( const QString &name );
+    LatencyHistogram &histogram( const QString &name );
+    // Histograms owned elsewhere, reported along with ours.
+    void attach( const QString &name, const LatencyHistogram *histogram );
+
+    QJsonObject toJson() const;
+
+private:
+    mutable QMutex m_mutex;
+    QMap<QString, QSharedPointer<Counter>> m_counters;
+    QMap<QString, QSharedPointer<LatencyHistogram>> m_histograms;
+    QMap<QString, const LatencyHistogram *> m_attached;
+};
+
+#endif // METRICS_H
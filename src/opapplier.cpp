@@ -0,0 +1,234 @@
+#include "opapplier.h"
+#include "edit.h"
+
+namespace
+{
+// Window edges are moved to the next paragraph when one is close.
+int paragraphAfter( const ReplicatedText &model, int pos )
+{
+    const int lookahead = 4096;
+    if ( pos <= 0 || pos >= model.size() )
+        return pos;
+    const int found = model.text( pos, lookahead ).indexOf( QChar::ParagraphSeparator );
+    return found < 0 ? pos : pos + found + 1;
+}
+} // namespace
+
+OpApplier::OpApplier( Edit *textEdit ) : m_textEdit( textEdit )
+{
+}
+
+void OpApplier::setWindow( int chars )
+{
+    m_window = qMax( 0, chars );
+}
+
+void OpApplier::apply( const QVector<SyncOp> &ops ) const
+{
+    if ( ops.isEmpty() || !m_textEdit )
+        return;
+
+    QTextCursor anchor;
+    int anchorTop = 0;
+    int hscroll   = 0;
+    beginUpdate( anchor, anchorTop, hscroll );
+
+    QTextDocument *doc = m_textEdit->document();
+    QTextCursor cursor( doc );
+    int start	  = m_textEdit->windowStart();
+    bool windowed = m_textEdit->isWindowed();
+    cursor.beginEditBlock();
+    for ( const SyncOp &op : ops ) {
+        SyncOp local	 = op;
+        const int length = doc->characterCount() - 1;
+        if ( !clip( local, start, length ) )
+            continue;
+
+        // A paste that would overflow the window is shown up to a window's
+        // worth, and the window ends there.
+        if ( m_window && local.type == SyncOp::Insert && length + local.length > 2 * m_window ) {
+            cursor.setPosition( local.pos );
+            cursor.movePosition( QTextCursor::End, QTextCursor::KeepAnchor );
+            cursor.removeSelectedText();
+            local.length = qMin( local.length, m_window );
+            local.text.truncate( local.length );
+            windowed = true;
+        }
+        applyOp( cursor, local );
+    }
+    cursor.endEditBlock();
+    m_textEdit->setWindow( start, windowed );
+
+    endUpdate( anchor, anchorTop, hscroll );
+}
+
+// Shows the model, or the window of it the editor was at.
+void OpApplier::load( const ReplicatedText &model ) const
+{
+    if ( !m_textEdit )
+        return;
+    const int size = model.size();
+    if ( !m_window || size <= 2 * m_window ) {
+        materialize( model, 0, size );
+        return;
+    }
+    const int from = paragraphAfter( model, qBound( 0, m_textEdit->windowStart(), size - m_window ) );
+    materialize( model, from, qMin( size, paragraphAfter( model, from + m_window ) ) );
+}
+
+// Slides the window once the viewport gets within a quarter window of one of
+// its edges, or cuts it down after a large local paste.
+void OpApplier::fit( const ReplicatedText &model ) const
+{
+    const int size = model.size();
+    if ( !m_textEdit || !m_window || ( !m_textEdit->isWindowed() && size <= 2 * m_window ) )
+        return;
+    if ( size <= 2 * m_window ) {
+        materialize( model, 0, size );
+        return;
+    }
+
+    const QRect view = m_textEdit->viewport()->rect();
+    const int start  = m_textEdit->windowStart();
+    const int length = m_textEdit->document()->characterCount() - 1;
+    const int top    = start + m_textEdit->cursorForPosition( view.topLeft() ).position();
+    const int bottom = start + m_textEdit->cursorForPosition( view.bottomRight() ).position();
+    const int margin = m_window / 4;
+    if ( m_textEdit->isWindowed() && length <= 2 * m_window &&
+         ( start == 0 || top - start >= margin ) &&
+         ( start + length == size || start + length - bottom >= margin ) )
+        return;
+
+    const int center = top + ( bottom - top ) / 2;
+    const int from   = paragraphAfter( model, qBound( 0, center - m_window / 2, size - m_window ) );
+    materialize( model, from, qMin( size, paragraphAfter( model, from + m_window ) ) );
+}
+
+void OpApplier::reveal( const ReplicatedText &model, int pos ) const
+{
+    if ( !m_textEdit || !m_window || !m_textEdit->isWindowed() )
+        return;
+    const int start  = m_textEdit->windowStart();
+    const int length = m_textEdit->document()->characterCount() - 1;
+    const int size   = model.size();
+    if ( pos >= start && pos <= start + length )
+        return;
+
+    const int from = paragraphAfter( model, qBound( 0, pos - m_window / 2, size - m_window ) );
+    materialize( model, from, qMin( size, paragraphAfter( model, from + m_window ) ) );
+}
+
+// Moves an op from model positions into the window at start, of length
+// characters. Returns false when none of it is shown; start shifts when the
+// op changed text before the window.
+bool OpApplier::clip( SyncOp &op, int &start, int length ) const
+{
+    const int end = start + length;
+    switch ( op.type ) {
+    case SyncOp::Insert:
+        if ( op.pos < start ) {
+            start += op.length;
+            return false;
+        }
+        if ( op.pos > end )
+            return false;
+        op.pos -= start;
+        return true;
+    case SyncOp::Remove: {
+        const int from	 = qMax( op.pos, start );
+        const int to	 = qMin( op.pos + op.length, end );
+        const int before = qBound( 0, start - op.pos, op.length );
+        op.pos		 = from - start;
+        op.length	 = to - from;
+        start -= before;
+        return op.length > 0;
+    }
+    default: {
+        const int from = qMax( op.pos, start );
+        const int to   = qMin( op.pos + op.length, end );
+        op.pos	       = from - start;
+        op.length      = to - from;
+        return op.length > 0;
+    }
+    }
+}
+
+// Replaces the editor's text with the model's characters [from, to), keeping
+// the viewport and the local cursor on the characters they were on.
+void OpApplier::materialize( const ReplicatedText &model, int from, int to ) const
+{
+    QTextCursor anchor;
+    int anchorTop = 0;
+    int hscroll   = 0;
+    beginUpdate( anchor, anchorTop, hscroll );
+
+    const int start	   = m_textEdit->windowStart();
+    const int anchorPos	   = start + anchor.position();
+    const QTextCursor user = m_textEdit->textCursor();
+    const int userAnchor   = start + user.anchor();
+    const int userPos	   = start + user.position();
+
+    QTextDocument *doc = m_textEdit->document();
+    QTextCursor cursor( doc );
+    cursor.beginEditBlock();
+    cursor.select( QTextCursor::Document );
+    cursor.removeSelectedText();
+    for ( SyncOp op : model.contents( from, to - from ) ) {
+        op.pos -= from;
+        applyOp( cursor, op );
+    }
+    cursor.endEditBlock();
+    m_textEdit->setWindow( from, from > 0 || to < model.size() );
+
+    const int length = doc->characterCount() - 1;
+    QTextCursor moved( doc );
+    moved.setPosition( qBound( 0, userAnchor - from, length ) );
+    moved.setPosition( qBound( 0, userPos - from, length ), QTextCursor::KeepAnchor );
+    m_textEdit->setTextCursor( moved );
+    anchor.setPosition( qBound( 0, anchorPos - from, length ) );
+
+    endUpdate( anchor, anchorTop, hscroll );
+}
+
+void OpApplier::applyOp( QTextCursor &cursor, const SyncOp &op ) const
+{
+    const int size = cursor.document()->characterCount() - 1;
+    if ( op.pos < 0 || op.pos > size )
+        return;
+
+    cursor.setPosition( op.pos );
+    switch ( op.type ) {
+    case SyncOp::Insert:
+        cursor.insertText( op.text, SyncOp::unpackFormat( op.format ) );
+        break;
+    case SyncOp::Remove:
+        cursor.setPosition( qMin( op.pos + op.length, size ), QTextCursor::KeepAnchor );
+        cursor.removeSelectedText();
+        break;
+    case SyncOp::Format:
+        cursor.setPosition( qMin( op.pos + op.length, size ), QTextCursor::KeepAnchor );
+        cursor.setCharFormat( SyncOp::unpackFormat( op.format ) );
+        break;
+    case SyncOp::Merge:
+        cursor.setPosition( qMin( op.pos + op.length, size ), QTextCursor::KeepAnchor );
+        cursor.mergeCharFormat( SyncOp::unpackFormat( op.format ) );
+        break;
+    }
+}
+
+void OpApplier::beginUpdate( QTextCursor &anchor, int &anchorTop, int &hscroll ) const
+{
+    anchor    = m_textEdit->cursorForPosition( QPoint( 0, 0 ) );
+    anchorTop = m_textEdit->cursorRect( anchor ).top();
+    hscroll   = m_textEdit->horizontalScrollBar()->value();
+    m_textEdit->setRemoteUpdate( true );
+}
+
+void OpApplier::endUpdate( const QTextCursor &anchor, int anchorTop, int hscroll ) const
+{
+    m_textEdit->setRemoteUpdate( false );
+
+    QScrollBar *bar = m_textEdit->verticalScrollBar();
+    bar->setValue( bar->value() + m_textEdit->cursorRect( anchor ).top() - anchorTop );
+    m_textEdit->horizontalScrollBar()->setValue( hscroll );
+}
@@ -0,0 +1,52 @@
+#ifndef OPAPPLIER_H
+#define OPAPPLIER_H
+
+#include "Structs.h"
+#include "replicatedtext.h"
+#include <QScrollBar>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QVector>
+
+class Edit;
+
+// Applies remote changes to the editor through a private QTextCursor, so only
+// the affected range is touched. The local cursor and selection stay in the
+// document, and the viewport is pinned to the text it showed. The document
+// keeps no undo stack; UndoHistory has this replica's own edits.
+//
+// A document longer than two windows is not handed to the editor whole: only
+// a window of the model around the viewport is, and it slides along as the
+// view scrolls. Ops arrive in model positions and are moved into the window,
+// or just shift it when they change text before it. Sliding reloads the
+// editor's text; the undo history is kept in model positions, so it lives
+// through that.
+//
+// A headless replica has no editor; its applier does nothing.
+class OpApplier
+{
+    Edit *m_textEdit;
+    int m_window = 0;
+
+public:
+    explicit OpApplier( Edit *textEdit );
+
+    // Characters materialized around the viewport; 0 shows everything.
+    void setWindow( int chars );
+
+    void apply( const QVector<SyncOp> &ops ) const;
+    void load( const ReplicatedText &model ) const;
+    void fit( const ReplicatedText &model ) const;
+    // Slides the window over the model position pos unless it shows it.
+    void reveal( const ReplicatedText &model, int pos ) const;
+
+private:
+    void applyOp( QTextCursor &cursor, const SyncOp &op ) const;
+    bool clip( SyncOp &op, int &start, int length ) const;
+    void materialize( const ReplicatedText &model, int from, int to ) const;
+
+    void beginUpdate( QTextCursor &anchor, int &anchorTop, int &hscroll ) const;
+    void endUpdate( const QTextCursor &anchor, int anchorTop, int hscroll ) const;
+};
+
+#endif // OPAPPLIER_H
@@ -0,0 +1,219 @@
+#include "opbatcher.h"
+
+namespace
+{
+// True if b starts right after the length characters of the run at a.
+bool follows( const CharId &a, int length, const CharId &b )
+{
+    if ( a.isEmpty() || a.size() != b.size() )
+        return false;
+    for ( int i = 0; i < a.size() - 1; ++i ) {
+        if ( !( a.at( i ) == b.at( i ) ) )
+            return false;
+    }
+    const IdLevel &left	 = a.last();
+    const IdLevel &right = b.last();
+    return left.site == right.site && left.clock == right.clock &&
+           quint64( left.digit ) + length == right.digit;
+}
+
+int textLength( const QVector<SyncOp> &ops )
+{
+    int length = 0;
+    for ( const SyncOp &op : ops )
+        length += op.text.size();
+    return length;
+}
+} // namespace
+
+OpBatcher::OpBatcher( int flushWindow, int maxOps, int maxBytes, QObject *parent )
+    : QObject( parent ), m_maxOps( maxOps ), m_maxBytes( maxBytes )
+{
+    m_timer.setSingleShot( true );
+    m_timer.setInterval( flushWindow );
+    connect( &m_timer, &QTimer::timeout, this, &OpBatcher::sendPending );
+    m_streamTimer.setSingleShot( true );
+    m_streamTimer.setInterval( 0 );
+    connect( &m_streamTimer, &QTimer::timeout, this, &OpBatcher::streamNext );
+}
+
+void OpBatcher::setFlushWindow( int msec )
+{
+    m_timer.setInterval( msec );
+}
+
+void OpBatcher::append( const QVector<SyncOp> &ops )
+{
+    for ( const SyncOp &op : ops ) {
+        ++m_counters.opsIn;
+        if ( op.type == SyncOp::Insert && !op.id.isEmpty() && op.text.size() * 2 > m_maxBytes ) {
+            stream( op );
+            continue;
+        }
+        m_pendingBytes += op.text.size() * 2 + op.format.size();
+        if ( !m_pending.isEmpty() && mergeInto( m_pending.last(), op ) ) {
+            if ( m_pending.last().length == 0 )
+                m_pending.removeLast();
+            continue;
+        }
+        m_pending.append( op );
+    }
+
+    if ( m_pending.size() >= m_maxOps || m_pendingBytes >= m_maxBytes ) {
+        ++m_counters.sizeFlushes;
+        sendPending();
+        return;
+    }
+    schedule();
+}
+
+void OpBatcher::setCursor( int pos )
+{
+    ++m_counters.cursorsIn;
+    if ( m_cursor >= 0 )
+        ++m_counters.cursorsFolded;
+    m_cursor = pos;
+    schedule();
+}
+
+void OpBatcher::flush()
+{
+    m_streamTimer.stop();
+    while ( !m_stream.isEmpty() )
+        streamNext();
+    sendPending();
+}
+
+// Behind a stream the pending ops become its next frame; the cursor goes
+// out once the stream is done.
+void OpBatcher::sendPending()
+{
+    m_timer.stop();
+    if ( !m_stream.isEmpty() ) {
+        if ( !m_pending.isEmpty() )
+            m_stream.append( m_pending );
+        m_pending.clear();
+        m_pendingBytes = 0;
+        return;
+    }
+    if ( m_pending.isEmpty() && m_cursor < 0 )
+        return;
+
+    const QVector<SyncOp> ops = m_pending;
+    const int cursor	      = m_cursor;
+    m_pending.clear();
+    m_cursor	   = -1;
+    m_pendingBytes = 0;
+
+    ++m_counters.frames;
+    emit frameReady( ops, cursor );
+}
+
+OpBatcher::Counters OpBatcher::counters() const
+{
+    return m_counters;
+}
+
+int OpBatcher::streamLeft() const
+{
+    return m_streamLeft;
+}
+
+bool OpBatcher::isIdle() const
+{
+    return m_pending.isEmpty() && m_cursor < 0 && m_stream.isEmpty();
+}
+
+// The characters of a run have consecutive ids, so every piece of it is a run
+// of its own. Pieces never split a surrogate pair.
+void OpBatcher::stream( const SyncOp &op )
+{
+    sendPending();
+    const int maxChars = qMax( 2, m_maxBytes / 2 );
+    for ( int from = 0; from < op.length; ) {
+        int size = qMin( maxChars, op.length - from );
+        if ( from + size < op.length && op.text.at( from + size - 1 ).isHighSurrogate() )
+            --size;
+
+        SyncOp piece = op;
+        piece.pos    = op.pos + from;
+        piece.length = size;
+        piece.text   = op.text.mid( from, size );
+        piece.id.last().digit += quint32( from );
+        m_stream.append( QVector<SyncOp>() << piece );
+        m_streamLeft += size;
+        from += size;
+    }
+    if ( !m_streamTimer.isActive() )
+        m_streamTimer.start();
+}
+
+void OpBatcher::streamNext()
+{
+    if ( m_stream.isEmpty() )
+        return;
+    const QVector<SyncOp> ops = m_stream.takeFirst();
+    m_streamLeft -= textLength( ops );
+
+    ++m_counters.frames;
+    ++m_counters.chunks;
+    emit frameReady( ops, -1 );
+
+    if ( m_stream.isEmpty() )
+        sendPending();
+    else
+        m_streamTimer.start();
+}
+
+bool OpBatcher::mergeInto( SyncOp &last, const SyncOp &op )
+{
+    if ( last.type == SyncOp::Insert && op.type == SyncOp::Insert ) {
+        if ( last.format != op.format || last.clock != op.clock || last.site != op.site ||
+             !follows( last.id, last.length, op.id ) )
+            return false;
+        last.text += op.text;
+        last.length += op.length;
+        ++m_counters.opsMerged;
+        return true;
+    }
+
+    // Characters erased right after being typed never reach the peers.
+    if ( last.type == SyncOp::Insert && op.type == SyncOp::Remove ) {
+        if ( op.length > last.length || !follows( last.id, last.length - op.length, op.id ) )
+            return false;
+        last.text.chop( op.length );
+        last.length -= op.length;
+        m_counters.opsCancelled += 2;
+        return true;
+    }
+
+    if ( last.type == SyncOp::Remove && op.type == SyncOp::Remove ) {
+        if ( follows( last.id, last.length, op.id ) ) {
+            last.length += op.length;
+        } else if ( follows( op.id, op.length, last.id ) ) {
+            last.id  = op.id;
+            last.pos = op.pos;
+            last.length += op.length;
+        } else {
+            return false;
+        }
+        ++m_counters.opsMerged;
+        return true;
+    }
+
+    if ( ( last.type == SyncOp::Format || last.type == SyncOp::Merge ) && op.type == last.type ) {
+        if ( last.format != op.format || last.clock != op.clock || last.site != op.site ||
+             !follows( last.id, last.length, op.id ) )
+            return false;
+        last.length += op.length;
+        ++m_counters.opsMerged;
+        return true;
+    }
+    return false;
+}
+
+void OpBatcher::schedule()
+{
+    if ( !m_timer.isActive() )
+        m_timer.start();
+}
@@ -0,0 +1,69 @@
+#ifndef OPBATCHER_H
+#define OPBATCHER_H
+
+#include "Structs.h"
+#include <QList>
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+
+// Collects outgoing ops for a short window and hands them on as one frame.
+// Consecutive inserts, removes and format changes over adjacent ids are merged,
+// text typed and erased within the window never leaves, and only the latest
+// cursor position is kept. An insert too big for one frame is cut into
+// pieces that are streamed out one per event loop turn, with whatever comes
+// after it queued behind.
+class OpBatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Counters {
+        quint64 opsIn	      = 0;
+        quint64 opsMerged     = 0;
+        quint64 opsCancelled  = 0;
+        quint64 cursorsIn     = 0;
+        quint64 cursorsFolded = 0;
+        quint64 frames	      = 0;
+        quint64 sizeFlushes   = 0;
+        quint64 chunks	      = 0;
+    };
+
+    OpBatcher( int flushWindow, int maxOps, int maxBytes, QObject *parent = nullptr );
+
+    void setFlushWindow( int msec );
+    void append( const QVector<SyncOp> &ops );
+    void setCursor( int pos );
+    // Sends everything now, a stream in progress included.
+    void flush();
+    Counters counters() const;
+    // Characters of a streamed insert not sent yet.
+    int streamLeft() const;
+    // Nothing waits to go out.
+    bool isIdle() const;
+
+signals:
+    void frameReady( const QVector<SyncOp> &ops, int cursor );
+
+private:
+    QTimer m_timer;
+    QVector<SyncOp> m_pending;
+    int m_cursor       = -1;
+    int m_pendingBytes = 0;
+    const int m_maxOps;
+    const int m_maxBytes;
+    Counters m_counters;
+
+    // Frames waiting their turn behind a streamed insert.
+    QTimer m_streamTimer;
+    QList<QVector<SyncOp>> m_stream;
+    int m_streamLeft = 0;
+
+    bool mergeInto( SyncOp &last, const SyncOp &op );
+    void schedule();
+    void sendPending();
+    void stream( const SyncOp &op );
+    void streamNext();
+};
+
+#endif // OPBATCHER_H
@@ -0,0 +1,81 @@
+#include "oplog.h"
+
+OpLog::OpLog( int maxEntries, qint64 maxBytes )
+    : m_maxEntries( maxEntries ), m_maxBytes( maxBytes )
+{
+}
+
+quint64 OpLog::version() const
+{
+    return m_version;
+}
+
+QHash<QString, quint32> OpLog::seen() const
+{
+    return m_seen;
+}
+
+bool OpLog::isSeen( const QString &sender, quint32 seq ) const
+{
+    auto it = m_seen.constFind( sender );
+    return it != m_seen.constEnd() && seq <= it.value();
+}
+
+quint32 OpLog::lastSeq( const QString &sender ) const
+{
+    return m_seen.value( sender );
+}
+
+void OpLog::record( const QString &sender, quint32 seq, const QByteArray &frame )
+{
+    m_seen[sender] = qMax( m_seen.value( sender ), seq );
+
+    Entry entry;
+    entry.version = ++m_version;
+    entry.sender  = sender;
+    entry.seq	  = seq;
+    entry.frame	  = frame;
+    m_entries.enqueue( entry );
+    m_bytes += frame.size();
+
+    while ( !m_entries.isEmpty() &&
+        ( m_entries.size() > m_maxEntries || m_bytes > m_maxBytes ) )
+        m_bytes -= m_entries.dequeue().frame.size();
+}
+
+// A joiner continues from the version of the snapshot it loaded.
+void OpLog::reset( quint64 version, const QHash<QString, quint32> &seen )
+{
+    m_entries.clear();
+    m_bytes   = 0;
+    m_version = version;
+    m_seen    = seen;
+}
+
+// Frames applied after version, oldest first. Fails when the log no longer
+// reaches back that far.
+bool OpLog::tailSince( quint64 version, QVector<QByteArray> &frames ) const
+{
+    frames.clear();
+    if ( version == m_version )
+        return true;
+    if ( m_entries.isEmpty() || m_entries.first().version > version + 1 )
+        return false;
+
+    for ( const Entry &entry : m_entries ) {
+        if ( entry.version > version )
+            frames.append( entry.frame );
+    }
+    return true;
+}
+
+// Frames of one sender newer than afterSeq that are still in the log.
+QVector<QByteArray> OpLog::framesFrom( const QString &sender, quint32 afterSeq ) const
+{
+    QVector<QByteArray> frames;
+    for ( const Entry &entry : m_entries ) {
+        if ( entry.sender == sender && entry.seq > afterSeq )
+            frames.append( entry.frame );
+    }
+    return frames;
+}
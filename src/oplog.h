@@ -0,0 +1,45 @@
+#ifndef OPLOG_H
+#define OPLOG_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QQueue>
+#include <QString>
+#include <QVector>
+
+// Bounded history of the frames this replica applied, own ones included.
+// Every frame bumps the local version; the log keeps the most recent frames
+// so a joiner handed an older snapshot can catch up from here, and tracks the
+// last sequence number seen from each sender so replays are skipped.
+class OpLog
+{
+    struct Entry {
+        quint64 version;
+        QString sender;
+        quint32 seq;
+        QByteArray frame;
+    };
+
+    QQueue<Entry> m_entries;
+    QHash<QString, quint32> m_seen;
+    quint64 m_version = 0;
+    qint64 m_bytes    = 0;
+    const int m_maxEntries;
+    const qint64 m_maxBytes;
+
+public:
+    OpLog( int maxEntries, qint64 maxBytes );
+
+    quint64 version() const;
+    QHash<QString, quint32> seen() const;
+    bool isSeen( const QString &sender, quint32 seq ) const;
+    // The last sequence number applied from sender, 0 before its first.
+    quint32 lastSeq( const QString &sender ) const;
+
+    void record( const QString &sender, quint32 seq, const QByteArray &frame );
+    void reset( quint64 version, const QHash<QString, quint32> &seen );
+    bool tailSince( quint64 version, QVector<QByteArray> &frames ) const;
+    QVector<QByteArray> framesFrom( const QString &sender, quint32 afterSeq ) const;
+};
+
+#endif // OPLOG_H
@@ -0,0 +1,218 @@
+#include "pipeline.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QSharedMemory>
+
+namespace
+{
+void record( LatencyHistogram *histogram, qint64 started )
+{
+    if ( histogram )
+        histogram->record( LatencyHistogram::now() - started );
+}
+
+void serialize( Snapshot &snapshot, const ReplicatedText &model )
+{
+    if ( !snapshot.model.isEmpty() )
+        return;
+    QDataStream out( &snapshot.model, QIODevice::WriteOnly );
+    out << model;
+}
+
+bool deserialize( const Snapshot &snapshot, ReplicatedText &model )
+{
+    if ( snapshot.model.isEmpty() )
+        return true;
+    QDataStream in( snapshot.model );
+    in >> model;
+    return in.status() == QDataStream::Ok;
+}
+
+bool readShared( const QString &key, QByteArray &bytes )
+{
+    QSharedMemory memory( key );
+    if ( !memory.attach( QSharedMemory::ReadOnly ) ) {
+        qInfo() << "Unable to attach to snapshot" << key;
+        return false;
+    }
+    memory.lock();
+    bytes = QByteArray( static_cast<const char *>( memory.constData() ), memory.size() );
+    memory.unlock();
+    memory.detach();
+    return true;
+}
+} // namespace
+
+Pipeline::Pipeline( const Timings &timings, QObject *parent )
+    : QObject( parent ), m_worker( new PipelineWorker( timings ) )
+{
+    qRegisterMetaType<ParsedFrame>();
+    qRegisterMetaType<Snapshot>();
+    qRegisterMetaType<ReplicatedText>();
+    qRegisterMetaType<const SessionJournal *>();
+
+    m_worker->moveToThread( &m_thread );
+    connect( &m_thread, &QThread::finished, m_worker, &QObject::deleteLater );
+    connect( m_worker, &PipelineWorker::parsed, this,
+         [this]( const ParsedFrame &frame, bool ok ) {
+             --m_queued;
+             emit parsed( frame, ok );
+         } );
+    connect( m_worker, &PipelineWorker::snapshotEncoded, this,
+         [this]( const QString &key, const Snapshot &snapshot, const QByteArray &bytes ) {
+             --m_queued;
+             emit snapshotEncoded( key, snapshot, bytes );
+         } );
+    connect( m_worker, &PipelineWorker::snapshotLoaded, this,
+         [this]( const QString &key, bool ok, const Snapshot &snapshot,
+             const ReplicatedText &model ) {
+             --m_queued;
+             emit snapshotLoaded( key, ok, snapshot, model );
+         } );
+    connect( m_worker, &PipelineWorker::checkpointWritten, this,
+         [this]( quint64 epoch, bool ok, const Snapshot &snapshot ) {
+             --m_queued;
+             emit checkpointWritten( epoch, ok, snapshot );
+         } );
+
+    m_thread.setObjectName( "pipeline" );
+    m_thread.start();
+}
+
+Pipeline::~Pipeline()
+{
+    stop();
+}
+
+void Pipeline::stop()
+{
+    m_thread.quit();
+    m_thread.wait();
+}
+
+int Pipeline::queued() const
+{
+    return m_queued;
+}
+
+void Pipeline::parse( const QByteArray &bytes )
+{
+    ++m_queued;
+    QMetaObject::invokeMethod( m_worker, "parse", Qt::QueuedConnection, Q_ARG( QByteArray, bytes ) );
+}
+
+void Pipeline::encodeSnapshot( const QString &key, const Snapshot &snapshot,
+                   const ReplicatedText &model )
+{
+    ++m_queued;
+    QMetaObject::invokeMethod( m_worker, "encodeSnapshot", Qt::QueuedConnection,
+                   Q_ARG( QString, key ), Q_ARG( Snapshot, snapshot ),
+                   Q_ARG( ReplicatedText, model ) );
+}
+
+void Pipeline::loadSnapshot( const QString &key, const ReplicatedText &base )
+{
+    ++m_queued;
+    QMetaObject::invokeMethod( m_worker, "loadSnapshot", Qt::QueuedConnection,
+                   Q_ARG( QString, key ), Q_ARG( ReplicatedText, base ) );
+}
+
+void Pipeline::decodeSnapshot( const QString &key, const QByteArray &bytes,
+                   const ReplicatedText &base )
+{
+    ++m_queued;
+    QMetaObject::invokeMethod( m_worker, "decodeSnapshot", Qt::QueuedConnection,
+                   Q_ARG( QString, key ), Q_ARG( QByteArray, bytes ),
+                   Q_ARG( ReplicatedText, base ) );
+}
+
+void Pipeline::loadJournal( const SessionJournal *journal, const ReplicatedText &base )
+{
+    ++m_queued;
+    QMetaObject::invokeMethod( m_worker, "loadJournal", Qt::QueuedConnection,
+                   Q_ARG( const SessionJournal *, journal ),
+                   Q_ARG( ReplicatedText, base ) );
+}
+
+void Pipeline::writeCheckpoint( const QString &path, quint64 epoch, const Snapshot &snapshot,
+                const ReplicatedText &model )
+{
+    ++m_queued;
+    QMetaObject::invokeMethod( m_worker, "writeCheckpoint", Qt::QueuedConnection,
+                   Q_ARG( QString, path ), Q_ARG( quint64, epoch ),
+                   Q_ARG( Snapshot, snapshot ), Q_ARG( ReplicatedText, model ) );
+}
+
+//----------worker-----------------
+PipelineWorker::PipelineWorker( const Pipeline::Timings &timings ) : m_timings( timings )
+{
+}
+
+void PipelineWorker::parse( const QByteArray &bytes )
+{
+    const qint64 started = LatencyHistogram::now();
+    ParsedFrame frame;
+    const bool ok = WireFormat::parseFrame( bytes, frame );
+    record( m_timings.parse, started );
+    emit parsed( frame, ok );
+}
+
+void PipelineWorker::encodeSnapshot( const QString &key, const Snapshot &snapshot,
+                     const ReplicatedText &model )
+{
+    const qint64 started = LatencyHistogram::now();
+    Snapshot full	 = snapshot;
+    serialize( full, model );
+    const QByteArray bytes = WireFormat::encodeSnapshot( full );
+    record( m_timings.encode, started );
+    emit snapshotEncoded( key, full, bytes );
+}
+
+void PipelineWorker::loadSnapshot( const QString &key, const ReplicatedText &base )
+{
+    const qint64 started = LatencyHistogram::now();
+    QByteArray bytes;
+    const bool ok = readShared( key, bytes );
+    load( key, ok, bytes, base, started );
+}
+
+void PipelineWorker::decodeSnapshot( const QString &key, const QByteArray &bytes,
+                     const ReplicatedText &base )
+{
+    load( key, true, bytes, base, LatencyHistogram::now() );
+}
+
+void PipelineWorker::load( const QString &key, bool ok, const QByteArray &bytes,
+               const ReplicatedText &base, qint64 started )
+{
+    Snapshot snapshot;
+    ReplicatedText model = base;
+    if ( ok ) {
+        ok = WireFormat::decodeSnapshot( bytes, snapshot ) && deserialize( snapshot, model );
+        if ( !ok )
+            qInfo() << "Malformed snapshot" << key;
+    }
+    record( m_timings.decode, started );
+    emit snapshotLoaded( key, ok, snapshot, model );
+}
+
+void PipelineWorker::loadJournal( const SessionJournal *journal, const ReplicatedText &base )
+{
+    const qint64 started = LatencyHistogram::now();
+    Snapshot snapshot;
+    ReplicatedText model = base;
+    const bool ok	 = journal->load( snapshot ) && deserialize( snapshot, model );
+    record( m_timings.decode, started );
+    emit snapshotLoaded( QString(), ok, snapshot, model );
+}
+
+void PipelineWorker::writeCheckpoint( const QString &path, quint64 epoch,
+                      const Snapshot &snapshot, const ReplicatedText &model )
+{
+    const qint64 started = LatencyHistogram::now();
+    Snapshot full	 = snapshot;
+    serialize( full, model );
+    const bool ok = SessionJournal::writeCheckpoint( path, epoch, full );
+    record( m_timings.checkpoint, started );
+    emit checkpointWritten( epoch, ok, full );
+}
@@ -0,0 +1,92 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "Structs.h"
+#include "histogram.h"
+#include "journal.h"
+#include "replicatedtext.h"
+#include "wireformat.h"
+#include <QObject>
+#include <QThread>
+
+class PipelineWorker;
+
+// The heavy half of syncing, run on one worker thread so the editor keeps
+// painting: parsing incoming frames, serializing the model into snapshots and
+// checkpoints, and reading them back. Models cross over as copies, which
+// share their blocks with the original until either side writes. Results
+// come back as queued signals, in the order the work was handed in.
+class Pipeline : public QObject
+{
+    Q_OBJECT
+    QThread m_thread;
+    PipelineWorker *m_worker;
+    int m_queued = 0;
+
+public:
+    struct Timings {
+        LatencyHistogram *parse      = nullptr;
+        LatencyHistogram *encode     = nullptr;
+        LatencyHistogram *decode     = nullptr;
+        LatencyHistogram *checkpoint = nullptr;
+    };
+
+    explicit Pipeline( const Timings &timings, QObject *parent = nullptr );
+    ~Pipeline();
+
+    // Drops whatever has not started yet and waits for the rest.
+    void stop();
+    // Work handed in whose result hasn't come back yet.
+    int queued() const;
+
+    void parse( const QByteArray &bytes );
+    // Serializes model into the snapshot unless it carries one already.
+    void encodeSnapshot( const QString &key, const Snapshot &snapshot, const ReplicatedText &model );
+    // Reads a peer's snapshot into a copy of base.
+    void loadSnapshot( const QString &key, const ReplicatedText &base );
+    // The same for a snapshot that came in as bytes.
+    void decodeSnapshot( const QString &key, const QByteArray &bytes, const ReplicatedText &base );
+    void loadJournal( const SessionJournal *journal, const ReplicatedText &base );
+    void writeCheckpoint( const QString &path, quint64 epoch, const Snapshot &snapshot,
+                  const ReplicatedText &model );
+
+signals:
+    void parsed( const ParsedFrame &frame, bool ok );
+    void snapshotEncoded( const QString &key, const Snapshot &snapshot, const QByteArray &bytes );
+    void snapshotLoaded( const QString &key, bool ok, const Snapshot &snapshot,
+                 const ReplicatedText &model );
+    void checkpointWritten( quint64 epoch, bool ok, const Snapshot &snapshot );
+};
+
+class PipelineWorker : public QObject
+{
+    Q_OBJECT
+    const Pipeline::Timings m_timings;
+
+public:
+    explicit PipelineWorker( const Pipeline::Timings &timings );
+
+public slots:
+    void parse( const QByteArray &bytes );
+    void encodeSnapshot( const QString &key, const Snapshot &snapshot, const ReplicatedText &model );
+    void loadSnapshot( const QString &key, const ReplicatedText &base );
+    void decodeSnapshot( const QString &key, const QByteArray &bytes, const ReplicatedText &base );
+    void loadJournal( const SessionJournal *journal, const ReplicatedText &base );
+    void writeCheckpoint( const QString &path, quint64 epoch, const Snapshot &snapshot,
+                  const ReplicatedText &model );
+
+signals:
+    void parsed( const ParsedFrame &frame, bool ok );
+    void snapshotEncoded( const QString &key, const Snapshot &snapshot, const QByteArray &bytes );
+    void snapshotLoaded( const QString &key, bool ok, const Snapshot &snapshot,
+                 const ReplicatedText &model );
+    void checkpointWritten( quint64 epoch, bool ok, const Snapshot &snapshot );
+
+private:
+    void load( const QString &key, bool ok, const QByteArray &bytes, const ReplicatedText &base,
+           qint64 started );
+};
+
+Q_DECLARE_METATYPE( const SessionJournal * )
+
+#endif // PIPELINE_H
@@ -0,0 +1,999 @@
+#include "replicatedtext.h"
+#include <algorithm>
+
+namespace
+{
+const quint64 digitLimit = Q_UINT64_C( 0x100000000 );
+const quint64 allocStep	 = 64;
+const int maxRunChars	 = 4096;
+
+int compareLevel( const IdLevel &a, const IdLevel &b )
+{
+    if ( a.digit != b.digit )
+        return a.digit < b.digit ? -1 : 1;
+    if ( a.site != b.site )
+        return a.site < b.site ? -1 : 1;
+    if ( a.clock != b.clock )
+        return a.clock < b.clock ? -1 : 1;
+    return 0;
+}
+
+// Compares character ka of a run starting at a with character kb of a run
+// starting at b. Characters of a run differ only in the last digit.
+int compareChar( const CharId &a, int ka, const CharId &b, int kb )
+{
+    const int na = a.size();
+    const int nb = b.size();
+    const int n	 = qMin( na, nb );
+    for ( int i = 0; i < n; ++i ) {
+        IdLevel left = a.at( i );
+        if ( i == na - 1 )
+            left.digit += ka;
+        IdLevel right = b.at( i );
+        if ( i == nb - 1 )
+            right.digit += kb;
+        const int c = compareLevel( left, right );
+        if ( c )
+            return c;
+    }
+    return na < nb ? -1 : ( na > nb ? 1 : 0 );
+}
+
+CharId bumped( const CharId &base, int offset )
+{
+    CharId id = base;
+    if ( !id.isEmpty() )
+        id.last().digit += offset;
+    return id;
+}
+
+bool newerStamp( quint32 clock, quint32 site, quint32 thanClock, quint32 thanSite )
+{
+    return clock != thanClock ? clock > thanClock : site > thanSite;
+}
+
+bool newerStamp( quint32 clock, quint32 site, const ReplicatedText::Run &run )
+{
+    return newerStamp( clock, site, run.clock, run.site );
+}
+
+int findProp( const QVector<ReplicatedText::PropStamp> &props, int property )
+{
+    for ( int i = 0; i < props.size(); ++i ) {
+        if ( props.at( i ).property >= property )
+            return i;
+    }
+    return props.size();
+}
+
+bool canMerge( const ReplicatedText::Run &a, const ReplicatedText::Run &b )
+{
+    return a.format == b.format && a.clock == b.clock && a.site == b.site &&
+           a.props == b.props && a.text.size() + b.text.size() <= maxRunChars &&
+           a.base.size() == b.base.size() &&
+           compareChar( a.base, a.text.size(), b.base, 0 ) == 0;
+}
+} // namespace
+
+ReplicatedText::ReplicatedText( quint32 site ) : m_site( site ), m_random( site )
+{
+}
+
+quint32 ReplicatedText::site() const
+{
+    return m_site;
+}
+
+int ReplicatedText::size() const
+{
+    return m_runs.chars();
+}
+
+int ReplicatedText::runCount() const
+{
+    return m_runs.size();
+}
+
+QString ReplicatedText::text() const
+{
+    QString out;
+    out.reserve( m_runs.chars() );
+    m_runs.forEach( [&out]( const Run &run ) { out += run.text; } );
+    return out;
+}
+
+QString ReplicatedText::text( int pos, int length ) const
+{
+    QString out;
+    int r, k;
+    locatePos( pos, r, k );
+    for ( ; length > 0 && r < m_runs.size(); ++r, k = 0 ) {
+        const QString &chunk = m_runs.at( r ).text;
+        const int count	     = qMin( length, chunk.size() - k );
+        out += chunk.midRef( k, count );
+        length -= count;
+    }
+    return out;
+}
+
+FormatTable &ReplicatedText::formats()
+{
+    return m_formats;
+}
+
+const FormatTable &ReplicatedText::formats() const
+{
+    return m_formats;
+}
+
+QVector<SyncOp> ReplicatedText::contents() const
+{
+    return contents( 0, m_runs.chars() );
+}
+
+// The range as inserts of uniformly formatted text, for filling the editor.
+QVector<SyncOp> ReplicatedText::contents( int pos, int length ) const
+{
+    QVector<SyncOp> ops;
+    int r, k;
+    locatePos( pos, r, k );
+    for ( ; length > 0 && r < m_runs.size(); ++r, k = 0 ) {
+        const Run &run		 = m_runs.at( r );
+        const int count		 = qMin( length, run.text.size() - k );
+        const QByteArray &format = m_formats.format( run.format );
+        if ( !ops.isEmpty() && ops.last().format == format ) {
+            ops.last().text += run.text.midRef( k, count );
+            ops.last().length += count;
+        } else {
+            SyncOp op;
+            op.type	  = SyncOp::Insert;
+            op.pos	  = pos;
+            op.length = count;
+            op.text	  = run.text.mid( k, count );
+            op.format = format;
+            ops.append( op );
+        }
+        pos += count;
+        length -= count;
+    }
+    return ops;
+}
+
+//----------local edits-----------------
+QVector<SyncOp> ReplicatedText::localInsert( int pos, const QString &text,
+                         const QByteArray &format )
+{
+    QVector<SyncOp> ops;
+    if ( text.isEmpty() || pos < 0 || pos > size() )
+        return ops;
+
+    const int fmt = m_formats.intern( format );
+    int lr = -1, lk = -1, rr, rk;
+    if ( pos > 0 )
+        locatePos( pos - 1, lr, lk );
+    locatePos( pos, rr, rk );
+    const CharId right = rr < m_runs.size() ? charId( rr, rk ) : CharId();
+
+    SyncOp op;
+    op.type   = SyncOp::Insert;
+    op.pos    = pos;
+    op.length = text.size();
+    op.text   = text;
+    op.format = format;
+
+    // Typing right after our own run keeps extending it.
+    if ( lr >= 0 ) {
+        const Run &run	    = m_runs.at( lr );
+        const IdLevel &last = run.base.last();
+        const int length    = run.text.size();
+        if ( lk == length - 1 && last.site == m_site && run.site == m_site &&
+             run.clock == last.clock && run.format == fmt && run.props.isEmpty() &&
+             length + text.size() <= maxRunChars &&
+             m_nextDigit.value( last.clock ) == last.digit + length &&
+             quint64( last.digit ) + length + text.size() < digitLimit &&
+             ( right.isEmpty() ||
+               compareChar( run.base, length + text.size() - 1, right, 0 ) < 0 ) ) {
+            op.id    = bumped( run.base, length );
+            op.clock = run.clock;
+            op.site  = run.site;
+            m_nextDigit[last.clock] += text.size();
+            m_runs.appendText( lr, text );
+            ops.append( op );
+            return ops;
+        }
+    }
+
+    ++m_clock;
+    const CharId left = lr >= 0 ? charId( lr, lk ) : CharId();
+
+    const CharId base = allocate( left, right, text.size() );
+    m_nextDigit.insert( m_clock, base.last().digit + text.size() );
+
+    int at = lr >= 0 ? splitRun( lr, lk + 1 ) : 0;
+    for ( int done = 0; done < text.size(); done += maxRunChars ) {
+        Run run;
+        run.base   = bumped( base, done );
+        run.text   = text.mid( done, maxRunChars );
+        run.format = fmt;
+        run.clock  = m_clock;
+        run.site   = m_site;
+        m_runs.insert( at++, run );
+    }
+
+    op.id    = base;
+    op.clock = m_clock;
+    op.site  = m_site;
+    ops.append( op );
+    return ops;
+}
+
+QVector<SyncOp> ReplicatedText::localRemove( int pos, int length )
+{
+    QVector<SyncOp> ops;
+    if ( pos < 0 || length <= 0 )
+        return ops;
+
+    int r, k;
+    locatePos( pos, r, k );
+    r = splitRun( r, k );
+    while ( length > 0 && r < m_runs.size() ) {
+        splitRun( r, length );
+        const Run &run = m_runs.at( r );
+
+        SyncOp op;
+        op.type	  = SyncOp::Remove;
+        op.pos	  = pos;
+        op.length = run.text.size();
+        op.id	  = run.base;
+        op.clock  = m_clock;
+        op.site	  = m_site;
+        ops.append( op );
+
+        length -= run.text.size();
+        m_runs.remove( r );
+    }
+    mergeAround( r - 1 );
+    return ops;
+}
+
+QVector<SyncOp> ReplicatedText::localFormat( int pos, int length, const QByteArray &format )
+{
+    QVector<SyncOp> ops;
+    if ( pos < 0 || length <= 0 )
+        return ops;
+
+    const int fmt = m_formats.intern( format );
+    ++m_clock;
+
+    int r, k;
+    locatePos( pos, r, k );
+    r		= splitRun( r, k );
+    const int first = r;
+    while ( length > 0 && r < m_runs.size() ) {
+        splitRun( r, length );
+        Run &run   = m_runs[r];
+        run.format = fmt;
+        run.clock  = m_clock;
+        run.site   = m_site;
+        run.props.clear();
+
+        SyncOp op;
+        op.type	  = SyncOp::Format;
+        op.pos	  = pos;
+        op.length = run.text.size();
+        op.format = format;
+        op.id	  = run.base;
+        op.clock  = m_clock;
+        op.site	  = m_site;
+        ops.append( op );
+
+        pos += run.text.size();
+        length -= run.text.size();
+        ++r;
+    }
+    for ( int i = r - 1; i >= first - 1 && i >= 0; --i )
+        mergeAround( i );
+    return ops;
+}
+
+// Only the runs' properties named in the delta change, so peers merge the
+// delta into exactly this range instead of replacing whole formats.
+QVector<SyncOp> ReplicatedText::localMerge( int pos, int length, const QByteArray &delta )
+{
+    QVector<SyncOp> ops;
+    if ( pos < 0 || length <= 0 )
+        return ops;
+
+    const QTextCharFormat format = SyncOp::unpackFormat( delta );
+    ++m_clock;
+
+    int r, k;
+    locatePos( pos, r, k );
+    r		= splitRun( r, k );
+    const int first = r;
+    while ( length > 0 && r < m_runs.size() ) {
+        splitRun( r, length );
+        QTextCharFormat won;
+        mergeRun( r, format, m_clock, m_site, won );
+        const Run &run = m_runs.at( r );
+
+        SyncOp op;
+        op.type	  = SyncOp::Merge;
+        op.pos	  = pos;
+        op.length = run.text.size();
+        op.format = delta;
+        op.id	  = run.base;
+        op.clock  = m_clock;
+        op.site	  = m_site;
+        ops.append( op );
+
+        pos += run.text.size();
+        length -= run.text.size();
+        ++r;
+    }
+    for ( int i = r - 1; i >= first - 1 && i >= 0; --i )
+        mergeAround( i );
+    return ops;
+}
+
+//----------remote edits-----------------
+QVector<SyncOp> ReplicatedText::integrate( const SyncOp &op )
+{
+    m_clock = qMax( m_clock, op.clock );
+    if ( op.id.isEmpty() || op.length <= 0 )
+        return QVector<SyncOp>();
+
+    switch ( op.type ) {
+    case SyncOp::Insert:
+        return integrateInsert( op );
+    case SyncOp::Remove:
+        return integrateRemove( op );
+    case SyncOp::Format:
+        return integrateFormat( op );
+    case SyncOp::Merge:
+        return integrateMerge( op );
+    }
+    return QVector<SyncOp>();
+}
+
+// Characters of a remote run may land on both sides of characters that were
+// inserted concurrently, so the run is placed in as many pieces as needed.
+QVector<SyncOp> ReplicatedText::integrateInsert( const SyncOp &op )
+{
+    QVector<SyncOp> ops;
+    const int fmt = m_formats.intern( op.format );
+    const int total = qMin( op.length, op.text.size() );
+
+    int done = 0;
+    while ( done < total ) {
+        int r, k;
+        if ( locateId( op.id, done, r, k ) ) {
+            ++done;
+            continue;
+        }
+
+        int count = qMin( total - done, maxRunChars );
+        int nr, nk;
+        if ( nextChar( r, k, nr, nk ) ) {
+            int lo = done, hi = done + count;
+            while ( lo < hi ) {
+                const int mid = ( lo + hi ) / 2;
+                if ( compareChar( op.id, mid, m_runs.at( nr ).base, nk ) < 0 )
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            count = lo - done;
+        }
+
+        Run run;
+        run.base   = bumped( op.id, done );
+        run.text   = op.text.mid( done, count );
+        run.format = fmt;
+        run.clock  = op.clock;
+        run.site   = op.site;
+
+        const int at = r >= 0 ? splitRun( r, k + 1 ) : 0;
+        m_runs.insert( at, run );
+
+        SyncOp applied;
+        applied.type   = SyncOp::Insert;
+        applied.pos    = m_runs.start( at );
+        applied.length = count;
+        applied.text   = run.text;
+        applied.format = op.format;
+        ops.append( applied );
+
+        mergeAround( at );
+        done += count;
+    }
+    return ops;
+}
+
+QVector<SyncOp> ReplicatedText::integrateRemove( const SyncOp &op )
+{
+    QVector<SyncOp> ops;
+    int done = 0;
+    while ( done < op.length ) {
+        int r, k;
+        if ( !locateId( op.id, done, r, k ) ) {
+            int nr, nk;
+            if ( !nextChar( r, k, nr, nk ) )
+                break;
+            int lo = done, hi = op.length;
+            while ( lo < hi ) {
+                const int mid = ( lo + hi ) / 2;
+                if ( compareChar( op.id, mid, m_runs.at( nr ).base, nk ) < 0 )
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            done = lo;
+            continue;
+        }
+
+        const int count = qMin( op.length - done, m_runs.at( r ).text.size() - k );
+        SyncOp applied;
+        applied.type   = SyncOp::Remove;
+        applied.pos    = m_runs.start( r ) + k;
+        applied.length = count;
+        ops.append( applied );
+
+        const int at = splitRun( r, k );
+        splitRun( at, count );
+        m_runs.remove( at );
+        mergeAround( at - 1 );
+        done += count;
+    }
+    return ops;
+}
+
+QVector<SyncOp> ReplicatedText::integrateFormat( const SyncOp &op )
+{
+    QVector<SyncOp> ops;
+    int done = 0;
+    while ( done < op.length ) {
+        int r, k;
+        if ( !locateId( op.id, done, r, k ) ) {
+            int nr, nk;
+            if ( !nextChar( r, k, nr, nk ) )
+                break;
+            int lo = done, hi = op.length;
+            while ( lo < hi ) {
+                const int mid = ( lo + hi ) / 2;
+                if ( compareChar( op.id, mid, m_runs.at( nr ).base, nk ) < 0 )
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            done = lo;
+            continue;
+        }
+
+        const int count = qMin( op.length - done, m_runs.at( r ).text.size() - k );
+        if ( newerStamp( op.clock, op.site, m_runs.at( r ) ) ) {
+            const int at = splitRun( r, k );
+            splitRun( at, count );
+
+            SyncOp applied;
+            applied.type   = SyncOp::Format;
+            applied.pos    = m_runs.start( at );
+            applied.length = count;
+            replaceFormat( at, op.format, op.clock, op.site, applied.format );
+            ops.append( applied );
+            mergeAround( at );
+        }
+        done += count;
+    }
+    return ops;
+}
+
+QVector<SyncOp> ReplicatedText::integrateMerge( const SyncOp &op )
+{
+    QVector<SyncOp> ops;
+    const QTextCharFormat delta = SyncOp::unpackFormat( op.format );
+
+    int done = 0;
+    while ( done < op.length ) {
+        int r, k;
+        if ( !locateId( op.id, done, r, k ) ) {
+            int nr, nk;
+            if ( !nextChar( r, k, nr, nk ) )
+                break;
+            int lo = done, hi = op.length;
+            while ( lo < hi ) {
+                const int mid = ( lo + hi ) / 2;
+                if ( compareChar( op.id, mid, m_runs.at( nr ).base, nk ) < 0 )
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            done = lo;
+            continue;
+        }
+
+        const int count = qMin( op.length - done, m_runs.at( r ).text.size() - k );
+        const int at	= splitRun( r, k );
+        splitRun( at, count );
+
+        QTextCharFormat won;
+        if ( mergeRun( at, delta, op.clock, op.site, won ) ) {
+            SyncOp applied;
+            applied.type   = SyncOp::Merge;
+            applied.pos    = m_runs.start( at );
+            applied.length = count;
+            applied.format = SyncOp::packFormat( won );
+            ops.append( applied );
+        }
+        mergeAround( at );
+        done += count;
+    }
+    return ops;
+}
+
+//----------formats-----------------
+// Merges the properties of delta that are newer than what run r has, and
+// collects them in won.
+bool ReplicatedText::mergeRun( int r, const QTextCharFormat &delta, quint32 clock, quint32 site,
+                   QTextCharFormat &won )
+{
+    Run &run		   = m_runs[r];
+    QTextCharFormat format = m_formats.charFormat( run.format );
+    const QMap<int, QVariant> properties = delta.properties();
+
+    bool changed = false;
+    for ( auto it = properties.constBegin(); it != properties.constEnd(); ++it ) {
+        const int i	     = findProp( run.props, it.key() );
+        const bool stamped   = i < run.props.size() && run.props.at( i ).property == it.key();
+        const quint32 pclock = stamped ? run.props.at( i ).clock : run.clock;
+        const quint32 psite  = stamped ? run.props.at( i ).site : run.site;
+        if ( !newerStamp( clock, site, pclock, psite ) )
+            continue;
+
+        format.setProperty( it.key(), it.value() );
+        won.setProperty( it.key(), it.value() );
+        PropStamp stamp;
+        stamp.property = it.key();
+        stamp.clock    = clock;
+        stamp.site     = site;
+        if ( stamped )
+            run.props[i] = stamp;
+        else
+            run.props.insert( i, stamp );
+        changed = true;
+    }
+    if ( changed )
+        run.format = m_formats.intern( SyncOp::packFormat( format ) );
+    return changed;
+}
+
+// Replaces the format of run r, keeping the properties merged in later than
+// the replacement; result is the format the run ends up with.
+void ReplicatedText::replaceFormat( int r, const QByteArray &format, quint32 clock, quint32 site,
+                    QByteArray &result )
+{
+    Run &run = m_runs[r];
+    QVector<PropStamp> kept;
+    for ( const PropStamp &stamp : run.props ) {
+        if ( newerStamp( stamp.clock, stamp.site, clock, site ) )
+            kept.append( stamp );
+    }
+
+    result = format;
+    if ( !kept.isEmpty() ) {
+        const QTextCharFormat old = m_formats.charFormat( run.format );
+        QTextCharFormat next	  = SyncOp::unpackFormat( format );
+        for ( const PropStamp &stamp : kept ) {
+            if ( old.hasProperty( stamp.property ) )
+                next.setProperty( stamp.property, old.property( stamp.property ) );
+            else
+                next.clearProperty( stamp.property );
+        }
+        result = SyncOp::packFormat( next );
+    }
+
+    run.format = m_formats.intern( result );
+    run.clock  = clock;
+    run.site   = site;
+    run.props  = kept;
+}
+
+//----------identifiers-----------------
+// Picks ids for count characters strictly between left and right (empty means
+// the document edge). Digits are taken close to the left neighbour, which
+// leaves room for text typed after them.
+CharId ReplicatedText::allocate( const CharId &left, const CharId &right, int count )
+{
+    CharId id;
+    bool boundLeft  = !left.isEmpty();
+    bool boundRight = !right.isEmpty();
+    for ( int i = 0;; ++i ) {
+        const bool hasLeft  = boundLeft && i < left.size();
+        const bool hasRight = boundRight && i < right.size();
+        const quint64 lo    = hasLeft ? left.at( i ).digit : 0;
+        const quint64 hi    = hasRight ? right.at( i ).digit : digitLimit;
+
+        if ( hi > lo + count ) {
+            const quint64 room = qMin<quint64>( hi - lo - count, allocStep );
+            IdLevel level;
+            level.digit = quint32( lo + 1 + m_random() % room );
+            level.site  = m_site;
+            level.clock = m_clock;
+            id.append( level );
+            return id;
+        }
+
+        IdLevel level;
+        if ( hasLeft ) {
+            level = left.at( i );
+        } else if ( hasRight && hi == 0 ) {
+            level = right.at( i );
+        } else {
+            level.site  = m_site;
+            level.clock = m_clock;
+        }
+        id.append( level );
+        boundLeft  = hasLeft && level == left.at( i );
+        boundRight = hasRight && level == right.at( i );
+    }
+}
+
+CharId ReplicatedText::charId( int r, int k ) const
+{
+    return bumped( m_runs.at( r ).base, k );
+}
+
+//----------run index-----------------
+ReplicatedText::Runs::Runs()
+{
+    rebuild();
+}
+
+int ReplicatedText::Runs::size() const
+{
+    return m_runs;
+}
+
+int ReplicatedText::Runs::chars() const
+{
+    return m_chars;
+}
+
+const ReplicatedText::Run &ReplicatedText::Runs::at( int r ) const
+{
+    int i;
+    const int b = blockOf( r, i );
+    return m_blocks.at( b ).at( i );
+}
+
+ReplicatedText::Run &ReplicatedText::Runs::operator[]( int r )
+{
+    int i;
+    const int b = blockOf( r, i );
+    return m_blocks[b][i];
+}
+
+// Characters before run r.
+int ReplicatedText::Runs::start( int r ) const
+{
+    if ( r >= m_runs )
+        return m_chars;
+    int i;
+    const int b = blockOf( r, i );
+    int pos	    = prefix( m_charTree, b );
+    const QVector<Run> &block = m_blocks.at( b );
+    for ( int j = 0; j < i; ++j )
+        pos += block.at( j ).text.size();
+    return pos;
+}
+
+void ReplicatedText::Runs::locate( int pos, int &r, int &k ) const
+{
+    if ( pos >= m_chars ) {
+        r = m_runs;
+        k = 0;
+        return;
+    }
+    k			  = pos;
+    const int b		  = find( m_charTree, k );
+    const QVector<Run> &block = m_blocks.at( b );
+    int i		  = 0;
+    for ( ; k >= block.at( i ).text.size(); ++i )
+        k -= block.at( i ).text.size();
+    r = prefix( m_runTree, b ) + i;
+}
+
+void ReplicatedText::Runs::insert( int r, const Run &run )
+{
+    if ( m_blocks.isEmpty() ) {
+        append( run );
+        return;
+    }
+
+    int i;
+    const int b = r < m_runs ? blockOf( r, i ) : m_blocks.size() - 1;
+    if ( r >= m_runs )
+        i = m_blocks.at( b ).size();
+    m_blocks[b].insert( i, run );
+    m_cacheBlock = -1;
+
+    if ( m_blocks.at( b ).size() > MaxBlock ) {
+        m_blocks.insert( b + 1, m_blocks.at( b ).mid( MaxBlock / 2 ) );
+        m_blocks[b].resize( MaxBlock / 2 );
+        int moved = 0;
+        for ( const Run &tail : m_blocks.at( b + 1 ) )
+            moved += tail.text.size();
+        m_blockChars[b] += run.text.size() - moved;
+        m_blockChars.insert( b + 1, moved );
+        m_runs += 1;
+        m_chars += run.text.size();
+        rebuild();
+    } else {
+        add( b, 1, run.text.size() );
+    }
+}
+
+void ReplicatedText::Runs::remove( int r )
+{
+    int i;
+    const int b	      = blockOf( r, i );
+    const int length  = m_blocks.at( b ).at( i ).text.size();
+    m_blocks[b].remove( i );
+    m_cacheBlock = -1;
+
+    if ( m_blocks.at( b ).isEmpty() ) {
+        m_blocks.remove( b );
+        m_blockChars.remove( b );
+        m_runs -= 1;
+        m_chars -= length;
+        rebuild();
+    } else {
+        add( b, -1, -length );
+    }
+}
+
+void ReplicatedText::Runs::appendText( int r, const QString &text )
+{
+    int i;
+    const int b = blockOf( r, i );
+    m_blocks[b][i].text += text;
+    add( b, 0, text.size() );
+}
+
+void ReplicatedText::Runs::truncateText( int r, int length )
+{
+    int i;
+    const int b	   = blockOf( r, i );
+    QString &text  = m_blocks[b][i].text;
+    const int diff = length - text.size();
+    text.truncate( length );
+    add( b, 0, diff );
+}
+
+void ReplicatedText::Runs::append( const Run &run )
+{
+    if ( m_blocks.isEmpty() || m_blocks.last().size() >= MaxBlock ) {
+        m_blocks.append( QVector<Run>() );
+        m_blocks.last().reserve( MaxBlock );
+        m_blocks.last().append( run );
+        m_blockChars.append( run.text.size() );
+        m_runs += 1;
+        m_chars += run.text.size();
+        rebuild();
+        return;
+    }
+    m_blocks.last().append( run );
+    add( m_blocks.size() - 1, 1, run.text.size() );
+}
+
+void ReplicatedText::Runs::clear()
+{
+    m_blocks.clear();
+    m_blockChars.clear();
+    m_runs  = 0;
+    m_chars = 0;
+    rebuild();
+}
+
+// The totals are Fenwick trees over the blocks, rebuilt in linear time
+// whenever a block is split off or dropped.
+void ReplicatedText::Runs::rebuild()
+{
+    const int count = m_blocks.size();
+    m_runTree.fill( 0, count + 1 );
+    m_charTree.fill( 0, count + 1 );
+    for ( int b = 0; b < count; ++b ) {
+        m_runTree[b + 1] += m_blocks.at( b ).size();
+        m_charTree[b + 1] += m_blockChars.at( b );
+        const int parent = b + 1 + ( ( b + 1 ) & -( b + 1 ) );
+        if ( parent <= count ) {
+            m_runTree[parent] += m_runTree.at( b + 1 );
+            m_charTree[parent] += m_charTree.at( b + 1 );
+        }
+    }
+    m_cacheBlock = -1;
+}
+
+void ReplicatedText::Runs::add( int b, int runs, int chars )
+{
+    m_runs += runs;
+    m_chars += chars;
+    m_blockChars[b] += chars;
+    for ( int i = b + 1; i < m_runTree.size(); i += i & -i ) {
+        m_runTree[i] += runs;
+        m_charTree[i] += chars;
+    }
+}
+
+// Total of the blocks before block b.
+int ReplicatedText::Runs::prefix( const QVector<int> &tree, int b ) const
+{
+    int sum = 0;
+    for ( int i = b; i > 0; i -= i & -i )
+        sum += tree.at( i );
+    return sum;
+}
+
+// The block holding item index of the tree's totals; index becomes the
+// offset within that block.
+int ReplicatedText::Runs::find( const QVector<int> &tree, int &index ) const
+{
+    const int count = tree.size() - 1;
+    int step	    = 1;
+    while ( step * 2 <= count )
+        step *= 2;
+
+    int b = 0;
+    for ( ; step > 0; step /= 2 ) {
+        if ( b + step <= count && tree.at( b + step ) <= index ) {
+            b += step;
+            index -= tree.at( b );
+        }
+    }
+    return b;
+}
+
+// Sequential access stays within one block, so the last block found is
+// tried first.
+int ReplicatedText::Runs::blockOf( int r, int &i ) const
+{
+    if ( m_cacheBlock >= 0 && r >= m_cacheFirst &&
+         r < m_cacheFirst + m_blocks.at( m_cacheBlock ).size() ) {
+        i = r - m_cacheFirst;
+        return m_cacheBlock;
+    }
+    i		 = r;
+    m_cacheBlock = find( m_runTree, i );
+    m_cacheFirst = r - i;
+    return m_cacheBlock;
+}
+
+void ReplicatedText::locatePos( int pos, int &r, int &k ) const
+{
+    m_runs.locate( pos, r, k );
+}
+
+// Finds the last character not greater than the id at base + offset. Returns
+// true if that character is the id itself; r is -1 if every character is
+// greater.
+bool ReplicatedText::locateId( const CharId &base, int offset, int &r, int &k ) const
+{
+    int lo = 0, hi = m_runs.size();
+    while ( lo < hi ) {
+        const int mid = ( lo + hi ) / 2;
+        if ( compareChar( m_runs.at( mid ).base, 0, base, offset ) <= 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    r = lo - 1;
+    k = -1;
+    if ( r < 0 )
+        return false;
+
+    const Run &run = m_runs.at( r );
+    lo	       = 0;
+    hi	       = run.text.size();
+    while ( lo < hi ) {
+        const int mid = ( lo + hi ) / 2;
+        if ( compareChar( run.base, mid, base, offset ) <= 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    k = lo - 1;
+    return compareChar( run.base, k, base, offset ) == 0;
+}
+
+bool ReplicatedText::nextChar( int r, int k, int &nr, int &nk ) const
+{
+    if ( r < 0 ) {
+        nr = 0;
+        nk = 0;
+    } else if ( k + 1 < m_runs.at( r ).text.size() ) {
+        nr = r;
+        nk = k + 1;
+    } else {
+        nr = r + 1;
+        nk = 0;
+    }
+    return nr < m_runs.size();
+}
+
+// Splits run r so that a new run starts at its character k, and returns the
+// index of the run that starts there.
+int ReplicatedText::splitRun( int r, int k )
+{
+    if ( r < 0 )
+        return 0;
+    if ( r >= m_runs.size() )
+        return m_runs.size();
+    if ( k <= 0 )
+        return r;
+    if ( k >= m_runs.at( r ).text.size() )
+        return r + 1;
+
+    Run tail  = m_runs.at( r );
+    tail.base = bumped( tail.base, k );
+    tail.text = tail.text.mid( k );
+    m_runs.truncateText( r, k );
+    m_runs.insert( r + 1, tail );
+    return r + 1;
+}
+
+void ReplicatedText::mergeAround( int r )
+{
+    if ( r >= 0 && r + 1 < m_runs.size() && canMerge( m_runs.at( r ), m_runs.at( r + 1 ) ) ) {
+        m_runs.appendText( r, m_runs.at( r + 1 ).text );
+        m_runs.remove( r + 1 );
+    }
+    if ( r > 0 && r < m_runs.size() && canMerge( m_runs.at( r - 1 ), m_runs.at( r ) ) ) {
+        m_runs.appendText( r - 1, m_runs.at( r ).text );
+        m_runs.remove( r );
+    }
+}
+
+//----------snapshot-----------------
+QDataStream &operator<<( QDataStream &out, const ReplicatedText &doc )
+{
+    out << doc.m_clock << doc.m_formats.formats() << quint32( doc.m_runs.size() );
+    doc.m_runs.forEach( [&out]( const ReplicatedText::Run &run ) {
+        out << run.base << run.text << qint32( run.format ) << run.clock << run.site
+            << quint32( run.props.size() );
+        for ( const ReplicatedText::PropStamp &stamp : run.props )
+            out << qint32( stamp.property ) << stamp.clock << stamp.site;
+    } );
+    return out;
+}
+
+QDataStream &operator>>( QDataStream &in, ReplicatedText &doc )
+{
+    quint32 clock, count;
+    QVector<QByteArray> formats;
+    in >> clock >> formats >> count;
+    doc.m_clock = qMax( doc.m_clock, clock );
+
+    // The table only grows, so formats this replica knew already keep their
+    // indices and the snapshot's are mapped onto them.
+    QVector<int> remap;
+    for ( const QByteArray &format : formats )
+        remap.append( doc.m_formats.intern( format ) );
+
+    doc.m_runs.clear();
+    for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+        ReplicatedText::Run run;
+        qint32 format;
+        quint32 props;
+        in >> run.base >> run.text >> format >> run.clock >> run.site >> props;
+        run.format = remap.value( format );
+        for ( quint32 p = 0; p < props && in.status() == QDataStream::Ok; ++p ) {
+            ReplicatedText::PropStamp stamp;
+            qint32 property;
+            in >> property >> stamp.clock >> stamp.site;
+            stamp.property = property;
+            run.props.append( stamp );
+        }
+        doc.m_runs.append( run );
+    }
+    return in;
+}
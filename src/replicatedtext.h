@@ -0,0 +1,149 @@
+#ifndef REPLICATEDTEXT_H
+#define REPLICATEDTEXT_H
+
+#include "Structs.h"
+#include "formattable.h"
+#include <QDataStream>
+#include <QHash>
+#include <QVector>
+#include <random>
+
+// Replicated character sequence in the LogootSplit style. Every character has
+// a dense identifier, and the document is the characters sorted by id, so all
+// replicas converge whatever order the ops arrive in. A run holds consecutive
+// characters of one insert whose ids differ only in the last digit, so typing
+// grows one run and memory stays close to the size of the text. Runs are
+// capped in length, so splitting one never copies more than a few kilobytes
+// whatever was pasted. Removed characters are dropped; there are no
+// tombstones.
+//
+// Formats are last-writer-wins. Replacing a run's whole format stamps the run;
+// merging a format delta stamps just the properties it sets, so concurrent
+// deltas touching different properties both survive.
+class ReplicatedText
+{
+public:
+    struct PropStamp {
+        int property  = 0;
+        quint32 clock = 0;
+        quint32 site  = 0;
+
+        bool operator==( const PropStamp &other ) const
+        {
+            return property == other.property && clock == other.clock && site == other.site;
+        }
+    };
+
+    struct Run {
+        CharId base;
+        QString text;
+        int format    = 0;
+        quint32 clock = 0;
+        quint32 site  = 0;
+        // Properties merged in after the format was last replaced, by id.
+        QVector<PropStamp> props;
+    };
+
+    // Runs in document order, kept in blocks with running totals per block,
+    // so a run is found by index or by character position in O(log n) and an
+    // edit only shifts the runs of its own block.
+    class Runs
+    {
+    public:
+        Runs();
+
+        int size() const;
+        int chars() const;
+        const Run &at( int r ) const;
+        // For changes that keep the run's length.
+        Run &operator[]( int r );
+        int start( int r ) const;
+        void locate( int pos, int &r, int &k ) const;
+
+        void insert( int r, const Run &run );
+        void remove( int r );
+        void appendText( int r, const QString &text );
+        void truncateText( int r, int length );
+        void append( const Run &run );
+        void clear();
+
+        template <typename F> void forEach( F visit ) const
+        {
+            for ( const QVector<Run> &block : m_blocks )
+                for ( const Run &run : block )
+                    visit( run );
+        }
+
+    private:
+        static const int MaxBlock = 64;
+
+        QVector<QVector<Run>> m_blocks;
+        QVector<int> m_blockChars;
+        QVector<int> m_runTree;
+        QVector<int> m_charTree;
+        int m_runs  = 0;
+        int m_chars = 0;
+        mutable int m_cacheBlock = -1;
+        mutable int m_cacheFirst = 0;
+
+        void rebuild();
+        void add( int b, int runs, int chars );
+        int prefix( const QVector<int> &tree, int b ) const;
+        int find( const QVector<int> &tree, int &index ) const;
+        int blockOf( int r, int &i ) const;
+    };
+
+    explicit ReplicatedText( quint32 site = 0 );
+
+    quint32 site() const;
+    int size() const;
+    int runCount() const;
+    QString text() const;
+    QString text( int pos, int length ) const;
+    QVector<SyncOp> contents() const;
+    QVector<SyncOp> contents( int pos, int length ) const;
+    FormatTable &formats();
+    const FormatTable &formats() const;
+
+    QVector<SyncOp> localInsert( int pos, const QString &text, const QByteArray &format );
+    QVector<SyncOp> localRemove( int pos, int length );
+    QVector<SyncOp> localFormat( int pos, int length, const QByteArray &format );
+    QVector<SyncOp> localMerge( int pos, int length, const QByteArray &delta );
+
+    QVector<SyncOp> integrate( const SyncOp &op );
+
+    friend QDataStream &operator<<( QDataStream &out, const ReplicatedText &doc );
+    friend QDataStream &operator>>( QDataStream &in, ReplicatedText &doc );
+
+private:
+    quint32 m_site;
+    quint32 m_clock = 0;
+    Runs m_runs;
+    FormatTable m_formats;
+    QHash<quint32, quint32> m_nextDigit;
+    std::mt19937 m_random;
+
+    bool mergeRun( int r, const QTextCharFormat &delta, quint32 clock, quint32 site,
+               QTextCharFormat &won );
+    void replaceFormat( int r, const QByteArray &format, quint32 clock, quint32 site,
+                QByteArray &result );
+    CharId allocate( const CharId &left, const CharId &right, int count );
+    CharId charId( int r, int k ) const;
+
+    void locatePos( int pos, int &r, int &k ) const;
+    bool locateId( const CharId &base, int offset, int &r, int &k ) const;
+    bool nextChar( int r, int k, int &nr, int &nk ) const;
+    int splitRun( int r, int k );
+    void mergeAround( int r );
+
+    QVector<SyncOp> integrateInsert( const SyncOp &op );
+    QVector<SyncOp> integrateRemove( const SyncOp &op );
+    QVector<SyncOp> integrateFormat( const SyncOp &op );
+    QVector<SyncOp> integrateMerge( const SyncOp &op );
+};
+
+Q_DECLARE_TYPEINFO( ReplicatedText::PropStamp, Q_PRIMITIVE_TYPE );
+Q_DECLARE_TYPEINFO( ReplicatedText::Run, Q_MOVABLE_TYPE );
+Q_DECLARE_METATYPE( ReplicatedText )
+
+#endif // REPLICATEDTEXT_H
@@ -0,0 +1,260 @@
+#include "ringtransport.h"
+#include <QDebug>
+#include <cstddef>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+const quint32 ringMagic	  = 0x52494e47;
+const quint32 ringVersion = 1;
+const quint32 slotCount	  = 1024;
+const quint32 slotSize	  = 4096;
+const int idleWait	  = 100;
+const int writerSpins	  = 1000;
+const int attachTries	  = 50;
+const qint64 stallLimit	  = 1000000000;
+} // namespace
+
+// Slot stamps are 2 * seq + 1 while slot seq is being written and
+// 2 * seq + 2 once it is readable, so a stale or overwritten slot is told
+// apart from the one a reader expects.
+struct RingTransport::Header {
+    quint32 magic;
+    quint32 version;
+    quint32 slotCount;
+    quint32 slotSize;
+    std::atomic<quint64> head;
+    std::atomic<quint32> wake;
+    std::atomic<quint32> sleepers;
+};
+
+struct RingTransport::Slot {
+    std::atomic<quint64> stamp;
+    qint64 sentAt;
+    quint32 size;
+    quint32 reserved;
+    char data[1];
+};
+
+namespace
+{
+const int headerSize = ( sizeof( RingTransport::Header ) + 63 ) & ~63;
+const int slotHeader = offsetof( RingTransport::Slot, data );
+
+#ifdef Q_OS_LINUX
+void futexWait( std::atomic<quint32> *word, quint32 expected, int msec )
+{
+    timespec timeout;
+    timeout.tv_sec  = msec / 1000;
+    timeout.tv_nsec = ( msec % 1000 ) * 1000000L;
+    syscall( SYS_futex, reinterpret_cast<quint32 *>( word ), FUTEX_WAIT, expected, &timeout,
+         nullptr, 0 );
+}
+
+void futexWake( std::atomic<quint32> *word )
+{
+    syscall( SYS_futex, reinterpret_cast<quint32 *>( word ), FUTEX_WAKE, INT_MAX, nullptr,
+         nullptr, 0 );
+}
+#endif
+} // namespace
+
+RingTransport::RingTransport( const QString &key, QObject *parent )
+    : Transport( parent ), m_memory( key ), m_stop( false ), m_reader( this )
+{
+}
+
+RingTransport::~RingTransport()
+{
+    m_stop = true;
+    m_reader.wait();
+}
+
+QString RingTransport::name() const
+{
+    return "ring";
+}
+
+int RingTransport::maxFrameSize() const
+{
+    return slotSize - slotHeader;
+}
+
+// The first peer of the session creates and formats the segment; the ones
+// after it attach. The segment lock keeps a late peer from seeing it half
+// formatted.
+bool RingTransport::open()
+{
+#ifdef Q_OS_LINUX
+    const int size = headerSize + slotCount * slotSize;
+    bool created   = m_memory.create( size );
+    if ( !created && m_memory.error() == QSharedMemory::AlreadyExists )
+        m_memory.attach();
+    if ( !m_memory.isAttached() ) {
+        qInfo() << "ring transport unavailable:" << m_memory.errorString();
+        return false;
+    }
+
+    bool ok = false;
+    for ( int tries = 0; !ok && tries < attachTries; ++tries ) {
+        if ( tries )
+            QThread::msleep( 10 );
+        m_memory.lock();
+        const bool formatted = created || static_cast<Header *>( m_memory.data() )->magic;
+        ok		     = formatted && initialize( created );
+        m_memory.unlock();
+        if ( formatted && !ok )
+            break;
+    }
+    if ( !ok ) {
+        m_memory.detach();
+        return false;
+    }
+
+    m_reader.start();
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool RingTransport::initialize( bool created )
+{
+    if ( created ) {
+        memset( m_memory.data(), 0, m_memory.size() );
+        m_header	    = new ( m_memory.data() ) Header;
+        m_header->magic	    = ringMagic;
+        m_header->version   = ringVersion;
+        m_header->slotCount = slotCount;
+        m_header->slotSize  = slotSize;
+        m_header->head	    = 0;
+        m_header->wake	    = 0;
+        m_header->sleepers  = 0;
+        return true;
+    }
+
+    m_header = static_cast<Header *>( m_memory.data() );
+    if ( m_memory.size() < headerSize + int( slotCount * slotSize ) ||
+         m_header->magic != ringMagic || m_header->version != ringVersion ||
+         m_header->slotCount != slotCount || m_header->slotSize != slotSize ) {
+        qInfo() << "ring transport: incompatible segment" << m_memory.key();
+        m_header = nullptr;
+        return false;
+    }
+    return true;
+}
+
+RingTransport::Slot *RingTransport::slotAt( quint64 seq ) const
+{
+    char *base = reinterpret_cast<char *>( m_header ) + headerSize;
+    return reinterpret_cast<Slot *>( base + ( seq % slotCount ) * slotSize );
+}
+
+// The frame is written straight into the shared slot; readers copy it out
+// once, with no daemon in between.
+bool RingTransport::send( const QByteArray &frame )
+{
+#ifdef Q_OS_LINUX
+    if ( !m_header || frame.size() > maxFrameSize() )
+        return false;
+
+    const quint64 seq = m_header->head.fetch_add( 1 );
+    Slot *slot	      = slotAt( seq );
+    slot->stamp.store( 2 * seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    slot->sentAt = LatencyHistogram::now();
+    slot->size	 = frame.size();
+    memcpy( slot->data, frame.constData(), frame.size() );
+    slot->stamp.store( 2 * seq + 2, std::memory_order_release );
+
+    m_header->wake.fetch_add( 1 );
+    if ( m_header->sleepers.load() > 0 )
+        futexWake( &m_header->wake );
+    return true;
+#else
+    Q_UNUSED( frame );
+    return false;
+#endif
+}
+
+RingTransport::Reader::Reader( RingTransport *ring ) : m_ring( ring )
+{
+}
+
+void RingTransport::Reader::run()
+{
+    m_ring->readLoop();
+}
+
+// Reads are optimistic: the payload is copied first and kept only if the
+// slot's stamp is unchanged afterwards, so a writer lapping a slow reader can
+// never hand it a torn frame.
+void RingTransport::readLoop()
+{
+#ifdef Q_OS_LINUX
+    quint64 cursor	= m_header->head.load();
+    int spins		= 0;
+    qint64 stalledSince = 0;
+
+    while ( !m_stop ) {
+        const quint32 wake  = m_header->wake.load();
+        Slot *slot	    = slotAt( cursor );
+        const quint64 ready = 2 * cursor + 2;
+        const quint64 stamp = slot->stamp.load( std::memory_order_acquire );
+
+        if ( stamp == ready ) {
+            const quint32 size	 = qMin<quint32>( slot->size, maxFrameSize() );
+            const qint64 sentAt	 = slot->sentAt;
+            const QByteArray frame( slot->data, size );
+            std::atomic_thread_fence( std::memory_order_acquire );
+            if ( slot->stamp.load( std::memory_order_relaxed ) == ready ) {
+                m_latency.record( LatencyHistogram::now() - sentAt );
+                emit frameReceived( frame );
+                ++cursor;
+                spins	     = 0;
+                stalledSince = 0;
+                continue;
+            }
+        }
+
+        if ( stamp > ready || slot->stamp.load() > ready ) {
+            const quint64 head = m_header->head.load();
+            emit framesLost( head - cursor );
+            cursor	 = head;
+            spins	 = 0;
+            stalledSince = 0;
+            continue;
+        }
+
+        // A writer has claimed this slot but not published it yet; if it
+        // stays that way the writer is gone and the slot is given up.
+        if ( cursor < m_header->head.load() ) {
+            if ( spins++ < writerSpins ) {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            if ( !stalledSince ) {
+                stalledSince = LatencyHistogram::now();
+            } else if ( LatencyHistogram::now() - stalledSince > stallLimit ) {
+                emit framesLost( 1 );
+                ++cursor;
+                spins	     = 0;
+                stalledSince = 0;
+                continue;
+            }
+        }
+
+        m_header->sleepers.fetch_add( 1 );
+        futexWait( &m_header->wake, wake, idleWait );
+        m_header->sleepers.fetch_sub( 1 );
+    }
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef RINGTRANSPORT_H
+#define RINGTRANSPORT_H
+
+#include "transport.h"
+#include <QSharedMemory>
+#include <QThread>
+#include <atomic>
+
+// Broadcast ring in shared memory for peers on the same host. Any number of
+// writers claim slots with one fetch-add on the shared head and publish them
+// with a release store of the slot's sequence stamp; every reader walks the
+// ring with a private cursor and sleeps on a futex word when it catches up.
+// A reader that falls a full lap behind loses frames and reports it.
+class RingTransport : public Transport
+{
+    Q_OBJECT
+
+public:
+    struct Header;
+    struct Slot;
+
+    RingTransport( const QString &key, QObject *parent = nullptr );
+    ~RingTransport();
+
+    bool open();
+    QString name() const override;
+    bool send( const QByteArray &frame ) override;
+
+    int maxFrameSize() const;
+
+private:
+    class Reader : public QThread
+    {
+        RingTransport *m_ring;
+
+    public:
+        explicit Reader( RingTransport *ring );
+
+    protected:
+        void run() override;
+    };
+
+    QSharedMemory m_memory;
+    Header *m_header = nullptr;
+    std::atomic<bool> m_stop;
+    Reader m_reader;
+
+    Slot *slotAt( quint64 seq ) const;
+    bool initialize( bool created );
+    void readLoop();
+};
+
+#endif // RINGTRANSPORT_H
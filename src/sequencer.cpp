@@ -0,0 +1,115 @@
+#include "sequencer.h"
+#include "wireformat.h"
+#include <QDBusConnectionInterface>
+#include <QDBusReply>
+#include <QDebug>
+
+namespace
+{
+const int maxHeld = 256;
+}
+
+Sequencer::Sequencer( const QDBusConnection &conn, const QString &ifaceName, QObject *parent )
+    : QObject( parent ), m_conn( conn ), m_leaderName( ifaceName + ".leader" ),
+      m_self( conn.baseService() ),
+      m_watcher( m_leaderName, conn, QDBusServiceWatcher::WatchForOwnerChange )
+{
+    connect( &m_watcher, &QDBusServiceWatcher::serviceOwnerChanged, this,
+         &Sequencer::ownerChanged );
+}
+
+// Queues for the leader name; the first replica of the session gets it.
+bool Sequencer::start()
+{
+    QDBusConnectionInterface *bus = m_conn.interface();
+    if ( !bus->registerService( m_leaderName, QDBusConnectionInterface::QueueService,
+                    QDBusConnectionInterface::DontAllowReplacement )
+              .isValid() ) {
+        qInfo() << "can\'t join leader queue" << bus->lastError().message();
+        return false;
+    }
+
+    QDBusReply<QString> owner = bus->serviceOwner( m_leaderName );
+    setLeader( owner.isValid() ? owner.value() : QString() );
+    return true;
+}
+
+bool Sequencer::isLeader() const
+{
+    return !m_leader.isEmpty() && m_leader == m_self;
+}
+
+QString Sequencer::leader() const
+{
+    return m_leader;
+}
+
+QByteArray Sequencer::order( const QByteArray &frame )
+{
+    return WireFormat::encodeOrdered( m_self, m_next++, frame );
+}
+
+bool Sequencer::receive( const QString &term, quint64 order, const QByteArray &frame,
+             QVector<QByteArray> &due )
+{
+    if ( term != m_term ) {
+        if ( !m_term.isEmpty() && term != m_leader ) {
+            due.append( frame );
+            return true;
+        }
+        m_term = term;
+        m_next = order;
+        m_held.clear();
+    }
+    if ( order < m_next )
+        return true;
+
+    m_held.insert( order, frame );
+    for ( auto it = m_held.begin(); it != m_held.end() && it.key() == m_next; ++m_next ) {
+        due.append( it.value() );
+        it = m_held.erase( it );
+    }
+    return m_held.size() <= maxHeld;
+}
+
+void Sequencer::reset()
+{
+    m_term.clear();
+    m_held.clear();
+}
+
+QVector<QByteArray> Sequencer::takeHeld()
+{
+    const QVector<QByteArray> frames = m_held.values().toVector();
+    m_held.clear();
+    return frames;
+}
+
+int Sequencer::held() const
+{
+    return m_held.size();
+}
+
+quint64 Sequencer::position() const
+{
+    return m_next;
+}
+
+void Sequencer::ownerChanged( const QString &name, const QString &oldOwner,
+                  const QString &newOwner )
+{
+    Q_UNUSED( name );
+    Q_UNUSED( oldOwner );
+    setLeader( newOwner );
+}
+
+// A new leader carries on numbering from where it had got to as a follower.
+void Sequencer::setLeader( const QString &leader )
+{
+    if ( leader == m_leader )
+        return;
+    m_leader = leader;
+    if ( isLeader() )
+        m_term = m_self;
+    emit leaderChanged( leader );
+}
@@ -0,0 +1,61 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <QDBusConnection>
+#include <QDBusServiceWatcher>
+#include <QMap>
+#include <QObject>
+#include <QVector>
+
+// Total order of one session's frames. Every replica queues for the
+// session's leader name; the owner numbers the frames the others submit and
+// broadcasts them under its term, and when it exits the bus hands the name
+// to the next one in line. Followers apply frames strictly in order, holding
+// back whatever arrives early, and give up on a gap that grows too wide.
+class Sequencer : public QObject
+{
+    Q_OBJECT
+
+public:
+    Sequencer( const QDBusConnection &conn, const QString &ifaceName, QObject *parent = nullptr );
+
+    bool start();
+    bool isLeader() const;
+    // Unique bus name of the current leader, empty while there is none.
+    QString leader() const;
+
+    // On the leader: the frame wrapped with the next number.
+    QByteArray order( const QByteArray &frame );
+    // On a follower: the frames now due, in order. A new leader's term starts
+    // the count again; frames of an older term are due at once, since the
+    // model converges anyway. False once too many frames wait behind a gap.
+    bool receive( const QString &term, quint64 order, const QByteArray &frame,
+              QVector<QByteArray> &due );
+    // Forgets the position; the next ordered frame sets it again.
+    void reset();
+    // The frames still held back, for a follower that became the leader.
+    QVector<QByteArray> takeHeld();
+    int held() const;
+    quint64 position() const;
+
+signals:
+    void leaderChanged( const QString &leader );
+
+private slots:
+    void ownerChanged( const QString &name, const QString &oldOwner, const QString &newOwner );
+
+private:
+    QDBusConnection m_conn;
+    const QString m_leaderName;
+    const QString m_self;
+    QDBusServiceWatcher m_watcher;
+
+    QString m_leader;
+    QString m_term;
+    quint64 m_next = 0;
+    QMap<quint64, QByteArray> m_held;
+
+    void setLeader( const QString &leader );
+};
+
+#endif // SEQUENCER_H
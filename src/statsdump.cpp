@@ -0,0 +1,54 @@
+#include "statsdump.h"
+#include "dbushandler.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+namespace
+{
+const int statsTimeout = 2000;
+
+bool dumpOnce( QDBusConnection &conn, const QString &ifaceName )
+{
+    QDBusReply<QStringList> owners =
+        conn.interface()->call( "ListQueuedOwners", ifaceName + ".members" );
+    if ( !owners.isValid() ) {
+        fprintf( stderr, "no replicas of %s\n", qPrintable( ifaceName ) );
+        return false;
+    }
+
+    for ( const QString &owner : owners.value() ) {
+        QDBusMessage msg = QDBusMessage::createMethodCall( owner, DBusHandler::objectPath( ifaceName ),
+                                   ifaceName, "getStats" );
+        QDBusReply<QString> reply = conn.call( msg, QDBus::Block, statsTimeout );
+        if ( !reply.isValid() ) {
+            fprintf( stderr, "%s: %s\n", qPrintable( owner ), qPrintable( reply.error().message() ) );
+            continue;
+        }
+
+        QJsonObject stats = QJsonDocument::fromJson( reply.value().toUtf8() ).object();
+        stats["owner"]	  = owner;
+        fprintf( stdout, "%s\n", QJsonDocument( stats ).toJson( QJsonDocument::Compact ).constData() );
+    }
+    fflush( stdout );
+    return true;
+}
+} // namespace
+
+int dumpStats( const SessionOptions &options )
+{
+    QDBusConnection conn( QDBusConnection::sessionBus() );
+    if ( !conn.isConnected() ) {
+        fprintf( stderr, "%s\n", qPrintable( conn.lastError().message() ) );
+        return 1;
+    }
+
+    const QString ifaceName = DBusHandler::interfaceName( options.session );
+    if ( options.statsInterval <= 0 )
+        return dumpOnce( conn, ifaceName ) ? 0 : 1;
+
+    while ( true ) {
+        dumpOnce( conn, ifaceName );
+        QThread::sleep( ulong( options.statsInterval ) );
+    }
+}
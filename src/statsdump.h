@@ -0,0 +1,10 @@
+#ifndef STATSDUMP_H
+#define STATSDUMP_H
+
+#include "Structs.h"
+
+// --stats: prints the metrics of every running replica of the session as one
+// JSON line each, once or every options.statsInterval seconds.
+int dumpStats( const SessionOptions &options );
+
+#endif // STATSDUMP_H
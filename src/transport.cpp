@@ -0,0 +1,68 @@
+#include "transport.h"
+#include <QDBusMessage>
+
+Transport::Transport( QObject *parent ) : QObject( parent )
+{
+}
+
+const LatencyHistogram &Transport::latency() const
+{
+    return m_latency;
+}
+
+PeerLink::PeerLink( QObject *parent ) : Transport( parent )
+{
+}
+
+bool PeerLink::open()
+{
+    return true;
+}
+
+bool PeerLink::isReady() const
+{
+    return true;
+}
+
+//----------bus-----------------
+BusTransport::BusTransport( const QDBusConnection &conn, const QString &objName,
+                const QString &ifaceName, const QString &rangedName, QObject *parent )
+    : Transport( parent ), m_conn( conn ), m_objName( objName ), m_ifaceName( ifaceName )
+{
+    if ( !rangedName.isEmpty() )
+        follow( rangedName );
+}
+
+QString BusTransport::name() const
+{
+    return "bus";
+}
+
+bool BusTransport::send( const QByteArray &frame )
+{
+    QDBusMessage msg = QDBusMessage::createSignal( m_objName, m_ifaceName, "syncFrame" );
+    msg << frame << qulonglong( LatencyHistogram::now() );
+    return m_conn.send( msg );
+}
+
+void BusTransport::follow( const QString &owner )
+{
+    if ( m_followed.contains( owner ) )
+        return;
+    if ( m_conn.connect( owner, m_objName, m_ifaceName, "syncFrame", this,
+                 SLOT( syncFrame( QByteArray, qulonglong ) ) ) )
+        m_followed.insert( owner );
+}
+
+void BusTransport::unfollow( const QString &owner )
+{
+    if ( m_followed.remove( owner ) )
+        m_conn.disconnect( owner, m_objName, m_ifaceName, "syncFrame", this,
+                   SLOT( syncFrame( QByteArray, qulonglong ) ) );
+}
+
+void BusTransport::syncFrame( const QByteArray &frame, qulonglong sentAt )
+{
+    m_latency.record( LatencyHistogram::now() - qint64( sentAt ) );
+    emit frameReceived( frame );
+}
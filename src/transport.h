@@ -0,0 +1,94 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "histogram.h"
+#include <QDBusConnection>
+#include <QObject>
+#include <QSet>
+
+// Carries encoded frames between the replicas of one session. Discovery,
+// membership and the join RPCs stay on D-Bus whatever carries the frames,
+// unless the transport is a PeerLink. Every transport stamps frames with the
+// sender's clock and records the delivery latency of what it receives.
+class Transport : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Transport( QObject *parent = nullptr );
+
+    virtual QString name() const = 0;
+    // False when the frame can't go this way and the caller should fall back.
+    virtual bool send( const QByteArray &frame ) = 0;
+
+    const LatencyHistogram &latency() const;
+
+signals:
+    void frameReceived( const QByteArray &frame );
+    // The transport dropped frames it had no room for; the replica must resync.
+    void framesLost( quint64 count );
+
+protected:
+    LatencyHistogram m_latency;
+};
+
+// A transport that carries a whole session without the bus: besides frames it
+// knows the peers and moves snapshots between them. A replica given one
+// keeps off D-Bus altogether.
+class PeerLink : public Transport
+{
+    Q_OBJECT
+
+public:
+    explicit PeerLink( QObject *parent = nullptr );
+
+    // Starts reaching the peers, once the replica listens to the link.
+    virtual bool open();
+    // The peers are known well enough to pick one to join from; until then
+    // a join waits for ready.
+    virtual bool isReady() const;
+    // The peer to join from, empty once none is left to try.
+    virtual QString bestPeer() const = 0;
+    virtual void markFailed( const QString &peer ) = 0;
+    // Asks peer for its state; snapshotReceived brings the answer.
+    virtual void requestSnapshot( const QString &peer ) = 0;
+    virtual void answerSnapshot( const QString &joiner, const QByteArray &snapshot ) = 0;
+
+signals:
+    void ready();
+    void snapshotRequested( const QString &joiner );
+    // An encoded snapshot, empty when the peer couldn't give one.
+    void snapshotReceived( const QString &peer, const QByteArray &snapshot );
+};
+
+// Frames as a D-Bus signal through the session daemon. The transport holds
+// one match rule per peer, keyed on its unique name and the session's path,
+// so the daemon never routes a replica's own frames back to it. Membership
+// drives the rules; a newcomer joins only once every member has answered
+// its hello, which each sends after adding the newcomer's rule.
+class BusTransport : public Transport
+{
+    Q_OBJECT
+    QDBusConnection m_conn;
+    const QString m_objName;
+    const QString m_ifaceName;
+    QSet<QString> m_followed;
+
+public:
+    // A non-empty rangedName is the only sender listened to; otherwise
+    // peers are listened to as they are followed.
+    BusTransport( const QDBusConnection &conn, const QString &objName, const QString &ifaceName,
+              const QString &rangedName, QObject *parent = nullptr );
+
+    QString name() const override;
+    bool send( const QByteArray &frame ) override;
+
+public slots:
+    void follow( const QString &owner );
+    void unfollow( const QString &owner );
+
+private slots:
+    void syncFrame( const QByteArray &frame, qulonglong sentAt );
+};
+
+#endif // TRANSPORT_H
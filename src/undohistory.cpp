@@ -0,0 +1,161 @@
+#include "undohistory.h"
+
+namespace
+{
+bool isSingle( const QVector<SyncOp> &ops, int type )
+{
+    return ops.size() == 1 && ops.first().type == type && ops.first().length == 1;
+}
+} // namespace
+
+UndoHistory::UndoHistory( int depth ) : m_depth( depth )
+{
+}
+
+void UndoHistory::record( const QVector<SyncOp> &inverse )
+{
+    if ( inverse.isEmpty() )
+        return;
+    m_redo.clear();
+    if ( !merge( inverse ) )
+        push( m_undo, inverse );
+    m_mergeable = isSingle( inverse, SyncOp::Remove ) || isSingle( inverse, SyncOp::Insert );
+}
+
+bool UndoHistory::canUndo() const
+{
+    return !m_undo.isEmpty();
+}
+
+bool UndoHistory::canRedo() const
+{
+    return !m_redo.isEmpty();
+}
+
+QVector<SyncOp> UndoHistory::takeUndo()
+{
+    m_mergeable = false;
+    return m_undo.isEmpty() ? QVector<SyncOp>() : m_undo.takeLast();
+}
+
+void UndoHistory::undone( const QVector<SyncOp> &inverse )
+{
+    if ( !inverse.isEmpty() )
+        push( m_redo, inverse );
+}
+
+QVector<SyncOp> UndoHistory::takeRedo()
+{
+    m_mergeable = false;
+    return m_redo.isEmpty() ? QVector<SyncOp>() : m_redo.takeLast();
+}
+
+void UndoHistory::redone( const QVector<SyncOp> &inverse )
+{
+    if ( !inverse.isEmpty() )
+        push( m_undo, inverse );
+}
+
+void UndoHistory::rebase( const QVector<SyncOp> &remote )
+{
+    for ( const SyncOp &op : remote ) {
+        rebase( m_undo, op );
+        rebase( m_redo, op );
+    }
+}
+
+void UndoHistory::clear()
+{
+    m_undo.clear();
+    m_redo.clear();
+    m_mergeable = false;
+}
+
+void UndoHistory::push( QVector<QVector<SyncOp>> &steps, const QVector<SyncOp> &ops )
+{
+    steps.append( ops );
+    if ( steps.size() > m_depth )
+        steps.removeFirst();
+}
+
+// A character typed right after the last one grows the step that removes
+// them; one erased next to the last one erased goes in front of the step
+// that puts them back, and so is put back first.
+bool UndoHistory::merge( const QVector<SyncOp> &inverse )
+{
+    if ( !m_mergeable || m_undo.isEmpty() )
+        return false;
+    QVector<SyncOp> &last = m_undo.last();
+    const SyncOp &op      = inverse.first();
+
+    if ( isSingle( inverse, SyncOp::Remove ) ) {
+        if ( last.size() != 1 || last.first().type != SyncOp::Remove ||
+             last.first().pos + last.first().length != op.pos )
+            return false;
+        ++last.first().length;
+        return true;
+    }
+    if ( !isSingle( inverse, SyncOp::Insert ) || last.first().type != SyncOp::Insert ||
+         ( last.first().pos != op.pos && last.first().pos != op.pos + 1 ) )
+        return false;
+
+    SyncOp &next = last.first();
+    if ( next.pos == op.pos + 1 && next.format == op.format ) {
+        next.pos = op.pos;
+        next.text.prepend( op.text );
+        ++next.length;
+    } else {
+        last.prepend( op );
+    }
+    return true;
+}
+
+// Every op of a step is moved as if it applied to the text as it is now;
+// the ops of one step are local edits close together, rarely depending on
+// each other's positions. A peer's insert inside a range splits it, so
+// reverting our insert or format never touches the peer's text.
+void UndoHistory::rebase( QVector<QVector<SyncOp>> &steps, const SyncOp &remote )
+{
+    if ( remote.type != SyncOp::Insert && remote.type != SyncOp::Remove )
+        return;
+    const int from = remote.pos;
+    const int to   = remote.pos + remote.length;
+
+    for ( auto step = steps.begin(); step != steps.end(); ) {
+        QVector<SyncOp> moved;
+        for ( SyncOp op : *step ) {
+            const int start = op.pos;
+            const int end   = op.type == SyncOp::Insert ? op.pos : op.pos + op.length;
+            if ( remote.type == SyncOp::Insert ) {
+                if ( from <= start ) {
+                    op.pos += remote.length;
+                } else if ( from < end ) {
+                    SyncOp tail = op;
+                    tail.pos    = to;
+                    tail.length = end - from;
+                    moved.append( tail );
+                    op.length = from - start;
+                }
+                moved.append( op );
+                continue;
+            }
+
+            const int newStart = start - qBound( 0, start - from, remote.length );
+            const int newEnd   = end - qBound( 0, end - from, remote.length );
+            op.pos		   = newStart;
+            if ( op.type != SyncOp::Insert ) {
+                op.length = newEnd - newStart;
+                if ( !op.length )
+                    continue;
+            }
+            moved.append( op );
+        }
+
+        if ( moved.isEmpty() ) {
+            step = steps.erase( step );
+        } else {
+            *step = moved;
+            ++step;
+        }
+    }
+}
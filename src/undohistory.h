@@ -0,0 +1,44 @@
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include "Structs.h"
+#include <QVector>
+
+// Undo and redo of this replica's own edits. The editor's document keeps no
+// history, since peers' changes go through it too and undoing one of those
+// would send it back out as ours. Each step holds the ops that revert one of
+// our edits, in model positions; peers' changes shift the steps, and drop
+// whatever of them they removed, so a step only ever touches our own text.
+// Typing and erasing one character after another make a single step.
+class UndoHistory
+{
+    QVector<QVector<SyncOp>> m_undo;
+    QVector<QVector<SyncOp>> m_redo;
+    bool m_mergeable = false;
+    const int m_depth;
+
+public:
+    explicit UndoHistory( int depth );
+
+    // A new local edit, by the ops that revert it; the redo steps go.
+    void record( const QVector<SyncOp> &inverse );
+    bool canUndo() const;
+    bool canRedo() const;
+    // The next step to revert, and the ops that revert the revert.
+    QVector<SyncOp> takeUndo();
+    void undone( const QVector<SyncOp> &inverse );
+    QVector<SyncOp> takeRedo();
+    void redone( const QVector<SyncOp> &inverse );
+
+    // Ops the model took from peers, in the order it took them.
+    void rebase( const QVector<SyncOp> &remote );
+    // The model was replaced; the positions mean nothing any more.
+    void clear();
+
+private:
+    void push( QVector<QVector<SyncOp>> &steps, const QVector<SyncOp> &ops );
+    bool merge( const QVector<SyncOp> &inverse );
+    static void rebase( QVector<QVector<SyncOp>> &steps, const SyncOp &remote );
+};
+
+#endif // UNDOHISTORY_H
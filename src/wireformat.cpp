@@ -0,0 +1,440 @@
+#include "wireformat.h"
+
+namespace
+{
+class Writer
+{
+    QByteArray &m_out;
+
+public:
+    explicit Writer( QByteArray &out ) : m_out( out )
+    {
+    }
+
+    void byte( quint8 value )
+    {
+        m_out.append( char( value ) );
+    }
+
+    void varint( quint64 value )
+    {
+        while ( value >= 0x80 ) {
+            m_out.append( char( ( value & 0x7f ) | 0x80 ) );
+            value >>= 7;
+        }
+        m_out.append( char( value ) );
+    }
+
+    void signedVarint( qint64 value )
+    {
+        varint( ( quint64( value ) << 1 ) ^ quint64( value >> 63 ) );
+    }
+
+    void fixed32( quint32 value )
+    {
+        for ( int i = 0; i < 4; ++i )
+            m_out.append( char( ( value >> ( 8 * i ) ) & 0xff ) );
+    }
+
+    void fixed64( quint64 value )
+    {
+        for ( int i = 0; i < 8; ++i )
+            m_out.append( char( ( value >> ( 8 * i ) ) & 0xff ) );
+    }
+
+    void bytes( const QByteArray &value )
+    {
+        varint( value.size() );
+        m_out.append( value );
+    }
+
+    void text( const QString &value )
+    {
+        bytes( value.toUtf8() );
+    }
+};
+
+class Reader
+{
+    const QByteArray &m_in;
+    int m_pos  = 0;
+    bool m_ok  = true;
+
+public:
+    explicit Reader( const QByteArray &in ) : m_in( in )
+    {
+    }
+
+    bool ok() const
+    {
+        return m_ok;
+    }
+
+    bool atEnd() const
+    {
+        return m_pos >= m_in.size();
+    }
+
+    quint8 byte()
+    {
+        if ( m_pos >= m_in.size() ) {
+            m_ok = false;
+            return 0;
+        }
+        return quint8( m_in.at( m_pos++ ) );
+    }
+
+    quint64 varint()
+    {
+        quint64 value = 0;
+        for ( int shift = 0; shift < 64; shift += 7 ) {
+            const quint8 b = byte();
+            value |= quint64( b & 0x7f ) << shift;
+            if ( !( b & 0x80 ) )
+                return value;
+        }
+        m_ok = false;
+        return 0;
+    }
+
+    qint64 signedVarint()
+    {
+        const quint64 value = varint();
+        return qint64( value >> 1 ) ^ -qint64( value & 1 );
+    }
+
+    quint32 fixed32()
+    {
+        quint32 value = 0;
+        for ( int i = 0; i < 4; ++i )
+            value |= quint32( byte() ) << ( 8 * i );
+        return value;
+    }
+
+    quint64 fixed64()
+    {
+        quint64 value = 0;
+        for ( int i = 0; i < 8; ++i )
+            value |= quint64( byte() ) << ( 8 * i );
+        return value;
+    }
+
+    // Counts are checked against the bytes left so a corrupt message can not
+    // make the decoder allocate without bound.
+    int count()
+    {
+        const quint64 value = varint();
+        if ( value > quint64( m_in.size() - m_pos ) ) {
+            m_ok = false;
+            return 0;
+        }
+        return int( value );
+    }
+
+    QByteArray bytes()
+    {
+        const int size = count();
+        if ( !m_ok )
+            return QByteArray();
+        const QByteArray value = m_in.mid( m_pos, size );
+        m_pos += size;
+        return value;
+    }
+
+    QString text()
+    {
+        return QString::fromUtf8( bytes() );
+    }
+};
+
+bool readHeader( Reader &in, WireFormat::Kind kind )
+{
+    return in.byte() == WireFormat::Magic && in.byte() == WireFormat::Version &&
+           in.byte() == kind && in.ok();
+}
+
+void writeHeader( Writer &out, WireFormat::Kind kind )
+{
+    out.byte( WireFormat::Magic );
+    out.byte( WireFormat::Version );
+    out.byte( kind );
+}
+} // namespace
+
+//----------frames-----------------
+QByteArray WireFormat::encodeFrame( const SyncFrame &frame, FormatTable &table )
+{
+    QVector<int> formats;
+    QHash<QByteArray, int> formatIds;
+    QVector<quint32> sites;
+    QHash<quint32, int> siteIds;
+
+    auto internSite = [&]( quint32 site ) {
+        if ( !siteIds.contains( site ) ) {
+            siteIds.insert( site, sites.size() );
+            sites.append( site );
+        }
+    };
+    for ( const SyncOp &op : frame.ops ) {
+        internSite( op.site );
+        for ( const IdLevel &level : op.id )
+            internSite( level.site );
+        if ( op.type != SyncOp::Remove && !formatIds.contains( op.format ) ) {
+            formatIds.insert( op.format, formats.size() );
+            formats.append( table.intern( op.format ) );
+        }
+    }
+
+    QByteArray bytes;
+    Writer out( bytes );
+    writeHeader( out, FrameKind );
+    out.text( frame.sender );
+    out.varint( frame.seq );
+    out.signedVarint( frame.cursor );
+
+    out.varint( sites.size() );
+    for ( quint32 site : sites )
+        out.fixed32( site );
+    out.varint( formats.size() );
+    for ( int index : formats ) {
+        const bool spelled = table.announce( index );
+        out.fixed64( table.id( index ) );
+        out.byte( spelled ? 1 : 0 );
+        if ( spelled )
+            out.bytes( table.format( index ) );
+    }
+
+    out.varint( frame.ops.size() );
+    for ( const SyncOp &op : frame.ops ) {
+        out.byte( quint8( op.type ) );
+        out.signedVarint( op.pos );
+        out.varint( op.length );
+        out.varint( op.clock );
+        out.varint( siteIds.value( op.site ) );
+        out.varint( op.id.size() );
+        for ( const IdLevel &level : op.id ) {
+            out.varint( level.digit );
+            out.varint( siteIds.value( level.site ) );
+            out.varint( level.clock );
+        }
+        if ( op.type == SyncOp::Insert )
+            out.text( op.text );
+        if ( op.type != SyncOp::Remove )
+            out.varint( formatIds.value( op.format ) );
+    }
+    // Trails the frame, so frames outside a stream are unchanged.
+    if ( frame.streamLeft > 0 )
+        out.varint( quint64( frame.streamLeft ) );
+    return bytes;
+}
+
+bool WireFormat::decodeFrame( const QByteArray &bytes, SyncFrame &frame, FormatTable &table )
+{
+    ParsedFrame parsed;
+    if ( !parseFrame( bytes, parsed ) || !resolveFrame( parsed, table ) )
+        return false;
+    frame = parsed.frame;
+    return true;
+}
+
+bool WireFormat::parseFrame( const QByteArray &bytes, ParsedFrame &parsed )
+{
+    parsed.bytes = bytes;
+    Reader in( bytes );
+    if ( !readHeader( in, FrameKind ) )
+        return false;
+
+    SyncFrame &frame = parsed.frame;
+    frame.sender     = in.text();
+    frame.seq	     = quint32( in.varint() );
+    frame.cursor     = int( in.signedVarint() );
+
+    QVector<quint32> sites( in.count() );
+    for ( quint32 &site : sites )
+        site = in.fixed32();
+    const int formats = in.count();
+    parsed.formatIds.resize( formats );
+    parsed.spelled.resize( formats );
+    for ( int i = 0; i < formats && in.ok(); ++i ) {
+        parsed.formatIds[i] = in.fixed64();
+        if ( in.byte() ) {
+            parsed.spelled[i] = in.bytes();
+            if ( !in.ok() || FormatTable::idOf( parsed.spelled.at( i ) ) != parsed.formatIds.at( i ) )
+                return false;
+        }
+    }
+
+    auto site = [&]( quint64 index ) -> quint32 {
+        if ( index >= quint64( sites.size() ) )
+            return 0;
+        return sites.at( int( index ) );
+    };
+
+    const int count = in.count();
+    frame.ops.clear();
+    frame.ops.reserve( count );
+    parsed.opFormats.clear();
+    parsed.opFormats.reserve( count );
+    for ( int i = 0; i < count && in.ok(); ++i ) {
+        SyncOp op;
+        op.type	  = in.byte();
+        op.pos	  = int( in.signedVarint() );
+        op.length = int( in.varint() );
+        op.clock  = quint32( in.varint() );
+        op.site	  = site( in.varint() );
+        op.id.resize( in.count() );
+        for ( IdLevel &level : op.id ) {
+            level.digit = quint32( in.varint() );
+            level.site  = site( in.varint() );
+            level.clock = quint32( in.varint() );
+        }
+        if ( op.type == SyncOp::Insert )
+            op.text = in.text();
+        int format = -1;
+        if ( op.type != SyncOp::Remove ) {
+            const quint64 index = in.varint();
+            if ( index >= quint64( formats ) )
+                return false;
+            format = int( index );
+        }
+        if ( op.type > SyncOp::Merge )
+            return false;
+        frame.ops.append( op );
+        parsed.opFormats.append( format );
+    }
+    frame.streamLeft = in.ok() && !in.atEnd() ? int( in.varint() ) : 0;
+    return in.ok();
+}
+
+bool WireFormat::resolveFrame( ParsedFrame &parsed, FormatTable &table )
+{
+    QVector<QByteArray> formats( parsed.formatIds.size() );
+    for ( int i = 0; i < formats.size(); ++i ) {
+        int index;
+        if ( !parsed.spelled.at( i ).isEmpty() ) {
+            index = table.intern( parsed.spelled.at( i ) );
+        } else {
+            index = table.indexOf( parsed.formatIds.at( i ) );
+            if ( index < 0 )
+                return false;
+        }
+        formats[i] = table.format( index );
+    }
+
+    QVector<SyncOp> &ops = parsed.frame.ops;
+    for ( int i = 0; i < ops.size(); ++i ) {
+        if ( parsed.opFormats.at( i ) >= 0 )
+            ops[i].format = formats.at( parsed.opFormats.at( i ) );
+    }
+    return true;
+}
+
+bool WireFormat::peekSender( const QByteArray &bytes, QString &sender, quint32 &seq )
+{
+    Reader in( bytes );
+    if ( !readHeader( in, FrameKind ) )
+        return false;
+    sender = in.text();
+    seq	   = quint32( in.varint() );
+    return in.ok();
+}
+
+int WireFormat::kindOf( const QByteArray &bytes )
+{
+    if ( bytes.size() < 3 || quint8( bytes.at( 0 ) ) != Magic || quint8( bytes.at( 1 ) ) != Version )
+        return 0;
+    return quint8( bytes.at( 2 ) );
+}
+
+QByteArray WireFormat::encodeOrdered( const QString &term, quint64 order, const QByteArray &frame )
+{
+    QByteArray bytes;
+    Writer out( bytes );
+    writeHeader( out, OrderedKind );
+    out.text( term );
+    out.varint( order );
+    out.bytes( frame );
+    return bytes;
+}
+
+bool WireFormat::decodeOrdered( const QByteArray &bytes, QString &term, quint64 &order,
+                QByteArray &frame )
+{
+    Reader in( bytes );
+    if ( !readHeader( in, OrderedKind ) )
+        return false;
+    term  = in.text();
+    order = in.varint();
+    frame = in.bytes();
+    return in.ok();
+}
+
+//----------char state-----------------
+QByteArray WireFormat::encodeCharState( const CharState &state )
+{
+    QByteArray bytes;
+    Writer out( bytes );
+    writeHeader( out, CharStateKind );
+    out.byte( ( state.bold ? 1 : 0 ) | ( state.underline ? 2 : 0 ) | ( state.italic ? 4 : 0 ) );
+    out.text( state.size );
+    out.text( state.font );
+    out.text( state.color );
+    out.signedVarint( state.position );
+    return bytes;
+}
+
+bool WireFormat::decodeCharState( const QByteArray &bytes, CharState &state )
+{
+    Reader in( bytes );
+    if ( !readHeader( in, CharStateKind ) )
+        return false;
+
+    const quint8 flags = in.byte();
+    state.bold	       = flags & 1;
+    state.underline    = flags & 2;
+    state.italic       = flags & 4;
+    state.size	       = in.text();
+    state.font	       = in.text();
+    state.color	       = in.text();
+    state.position     = int( in.signedVarint() );
+    return in.ok();
+}
+
+//----------snapshot-----------------
+QByteArray WireFormat::encodeSnapshot( const Snapshot &snapshot )
+{
+    QByteArray bytes;
+    Writer out( bytes );
+    writeHeader( out, SnapshotKind );
+    out.varint( snapshot.version );
+    out.varint( snapshot.seen.size() );
+    for ( auto it = snapshot.seen.constBegin(); it != snapshot.seen.constEnd(); ++it ) {
+        out.text( it.key() );
+        out.varint( it.value() );
+    }
+    out.bytes( snapshot.model );
+    out.varint( snapshot.tail.size() );
+    for ( const QByteArray &frame : snapshot.tail )
+        out.bytes( frame );
+    return bytes;
+}
+
+bool WireFormat::decodeSnapshot( const QByteArray &bytes, Snapshot &snapshot )
+{
+    Reader in( bytes );
+    if ( !readHeader( in, SnapshotKind ) )
+        return false;
+
+    snapshot.version = in.varint();
+    snapshot.seen.clear();
+    const int senders = in.count();
+    for ( int i = 0; i < senders && in.ok(); ++i ) {
+        const QString sender = in.text();
+        snapshot.seen.insert( sender, quint32( in.varint() ) );
+    }
+    snapshot.model = in.bytes();
+    snapshot.tail.resize( in.count() );
+    for ( QByteArray &frame : snapshot.tail )
+        frame = in.bytes();
+    return in.ok();
+}
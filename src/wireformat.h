@@ -0,0 +1,56 @@
+#ifndef WIREFORMAT_H
+#define WIREFORMAT_H
+
+#include "Structs.h"
+#include "formattable.h"
+#include <QByteArray>
+#include <QHash>
+
+// A frame read without the format table, so it can be parsed off the GUI
+// thread; resolving its formats against the table is left to the owner.
+struct ParsedFrame {
+    SyncFrame frame;
+    QByteArray bytes;
+    QVector<quint64> formatIds;
+    // Empty where the sender referred to a format by id only.
+    QVector<QByteArray> spelled;
+    // Index into formatIds for every op, -1 for removes.
+    QVector<int> opFormats;
+};
+Q_DECLARE_METATYPE( ParsedFrame )
+
+// Versioned binary encoding of everything peers exchange, sent over D-Bus as
+// one byte array. Integers are LEB128 varints (zigzag for signed ones), text
+// is UTF-8, and sites are interned once per message and referred to by index.
+// Formats are referred to by their session-wide id and spelled out only the
+// first time their sender uses them.
+class WireFormat
+{
+public:
+    enum Kind { FrameKind = 1, CharStateKind = 2, SnapshotKind = 3, OrderedKind = 4 };
+
+    static const quint8 Magic	= 0x53;
+    static const quint8 Version = 4;
+
+    static QByteArray encodeFrame( const SyncFrame &frame, FormatTable &formats );
+    // Fails on a format the table doesn't know, which means frames were lost.
+    static bool decodeFrame( const QByteArray &bytes, SyncFrame &frame, FormatTable &formats );
+    // decodeFrame in two steps: parseFrame touches nothing shared.
+    static bool parseFrame( const QByteArray &bytes, ParsedFrame &parsed );
+    static bool resolveFrame( ParsedFrame &parsed, FormatTable &formats );
+    static bool peekSender( const QByteArray &bytes, QString &sender, quint32 &seq );
+    static int kindOf( const QByteArray &bytes );
+
+    // A frame as numbered by the session's sequencer, whose term names it.
+    static QByteArray encodeOrdered( const QString &term, quint64 order, const QByteArray &frame );
+    static bool decodeOrdered( const QByteArray &bytes, QString &term, quint64 &order,
+                   QByteArray &frame );
+
+    static QByteArray encodeCharState( const CharState &state );
+    static bool decodeCharState( const QByteArray &bytes, CharState &state );
+
+    static QByteArray encodeSnapshot( const Snapshot &snapshot );
+    static bool decodeSnapshot( const QByteArray &bytes, Snapshot &snapshot );
+};
+
+#endif // WIREFORMAT_H